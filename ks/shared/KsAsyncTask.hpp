@@ -0,0 +1,405 @@
+/*
+   Copyright (C) 2015 Preet Desai (preet.desai@gmail.com)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef KS_ASYNC_TASK_HPP
+#define KS_ASYNC_TASK_HPP
+
+// AsyncTask requires C++20 coroutines. Without them this header
+// is empty and KS_ASYNC_TASK_AVAILABLE isn't defined, so it can
+// be included unconditionally.
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#define KS_ASYNC_TASK_AVAILABLE
+#endif
+#endif
+
+#if defined(KS_ASYNC_TASK_AVAILABLE)
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+
+#include <ks/shared/KsThreadPool.hpp>
+
+namespace ks
+{
+    // ============================================================= //
+
+    // Usage:
+    //
+    // AsyncTask<Image> LoadImage(ThreadPool &pool,std::string path)
+    // {
+    //     co_await pool.Schedule();          // continue on a worker
+    //     auto data = ReadFile(path);
+    //     co_await pool.ScheduleAfter(Milliseconds(10));
+    //     co_return DecodePNG(data);
+    // }
+    //
+    // AsyncTask<void> BuildAtlas(ThreadPool &pool)
+    // {
+    //     Image image = co_await LoadImage(pool,"a.png");
+    //     co_await AwaitTask(pool,pool.Submit(...));
+    //     ...
+    // }
+    //
+    // No thread is held while a coroutine is suspended.
+
+    template<typename T>
+    class AsyncTask;
+
+    namespace async_detail
+    {
+        // Shared by the coroutine frame and its AsyncTask; the
+        // frame is destroyed once both the coroutine has finished
+        // and the AsyncTask has been destroyed, so an AsyncTask
+        // can be dropped while its coroutine is still running
+        class PromiseBase
+        {
+        public:
+            PromiseBase() :
+                m_ref_count(2),
+                m_continuation(nullptr),
+                m_done(false)
+            {}
+
+            // Start running right away on the calling thread
+            std::suspend_never initial_suspend() noexcept
+            {
+                return {};
+            }
+
+            struct FinalAwaiter
+            {
+                bool await_ready() const noexcept
+                {
+                    return false;
+                }
+
+                template<typename Promise>
+                std::coroutine_handle<> await_suspend(
+                        std::coroutine_handle<Promise> handle) noexcept
+                {
+                    return handle.promise().onFinalSuspend(handle);
+                }
+
+                void await_resume() const noexcept
+                {
+                    // empty
+                }
+            };
+
+            FinalAwaiter final_suspend() noexcept
+            {
+                return {};
+            }
+
+            void unhandled_exception()
+            {
+                m_exception = std::current_exception();
+            }
+
+            bool IsDone()
+            {
+                std::lock_guard<std::mutex> lock(m_wait_mutex);
+                return m_done;
+            }
+
+            void Wait()
+            {
+                std::unique_lock<std::mutex> lock(m_wait_mutex);
+                m_wait_cond.wait(lock,[this](){ return m_done; });
+            }
+
+            // Sets the coroutine to resume once this one finishes;
+            // returns false if it has already finished
+            bool SetContinuation(std::coroutine_handle<> continuation)
+            {
+                void* expected = nullptr;
+                return m_continuation.compare_exchange_strong(
+                            expected,continuation.address());
+            }
+
+            // Returns true if the frame should be destroyed
+            bool Release()
+            {
+                return (m_ref_count.fetch_sub(1) == 1);
+            }
+
+        protected:
+            void rethrowIfFailed()
+            {
+                if(m_exception) {
+                    std::rethrow_exception(m_exception);
+                }
+            }
+
+        private:
+            void* doneState() const
+            {
+                return const_cast<PromiseBase*>(this);
+            }
+
+            template<typename Promise>
+            std::coroutine_handle<> onFinalSuspend(
+                    std::coroutine_handle<Promise> handle) noexcept
+            {
+                {
+                    std::lock_guard<std::mutex> lock(m_wait_mutex);
+                    m_done = true;
+                }
+                m_wait_cond.notify_all();
+
+                void* continuation = m_continuation.exchange(doneState());
+
+                // Nothing may be touched after the frame is destroyed
+                if(Release()) {
+                    handle.destroy();
+                }
+
+                // Resume the awaiting coroutine on this thread
+                return continuation ?
+                            std::coroutine_handle<>::from_address(continuation) :
+                            std::noop_coroutine();
+            }
+
+            std::atomic<uint> m_ref_count;
+
+            // nullptr while running without an awaiting coroutine,
+            // the awaiting coroutine's address, or doneState()
+            std::atomic<void*> m_continuation;
+
+            std::exception_ptr m_exception;
+
+            std::mutex m_wait_mutex;
+            std::condition_variable m_wait_cond;
+            bool m_done;
+        };
+
+        template<typename T>
+        class Promise final : public PromiseBase
+        {
+        public:
+            AsyncTask<T> get_return_object();
+
+            template<typename U>
+            void return_value(U&& value)
+            {
+                m_value.emplace(std::forward<U>(value));
+            }
+
+            T TakeResult()
+            {
+                rethrowIfFailed();
+                return std::move(*m_value);
+            }
+
+        private:
+            std::optional<T> m_value;
+        };
+
+        template<>
+        class Promise<void> final : public PromiseBase
+        {
+        public:
+            AsyncTask<void> get_return_object();
+
+            void return_void()
+            {
+                // empty
+            }
+
+            void TakeResult()
+            {
+                rethrowIfFailed();
+            }
+        };
+    }
+
+    // ============================================================= //
+
+    // AsyncTask
+    // * the return type of a coroutine that produces a T
+    // * the coroutine starts running on the calling thread and
+    //   continues wherever it's resumed, typically on a ThreadPool
+    //   worker after co_await pool.Schedule()
+    // * co_await an AsyncTask to suspend until it finishes; the
+    //   awaiting coroutine is resumed on the thread that finishes
+    //   it. Exceptions thrown by the coroutine are rethrown there
+    // * the result is moved out, so an AsyncTask may only be
+    //   awaited (or Get called) once
+    // * destroying an AsyncTask doesn't stop its coroutine
+    template<typename T=void>
+    class AsyncTask final
+    {
+    public:
+        using promise_type = async_detail::Promise<T>;
+        using Handle = std::coroutine_handle<promise_type>;
+
+        class Awaiter final
+        {
+        public:
+            Awaiter(Handle handle) :
+                m_handle(handle)
+            {}
+
+            bool await_ready() const
+            {
+                return m_handle.promise().IsDone();
+            }
+
+            bool await_suspend(std::coroutine_handle<> continuation)
+            {
+                // Don't suspend if the task has finished since
+                return m_handle.promise().SetContinuation(continuation);
+            }
+
+            T await_resume()
+            {
+                return m_handle.promise().TakeResult();
+            }
+
+        private:
+            Handle m_handle;
+        };
+
+        explicit AsyncTask(Handle handle) :
+            m_handle(handle)
+        {}
+
+        AsyncTask(AsyncTask &&other) noexcept :
+            m_handle(other.m_handle)
+        {
+            other.m_handle = nullptr;
+        }
+
+        AsyncTask & operator=(AsyncTask &&other) noexcept
+        {
+            if(this != &other) {
+                release();
+                m_handle = other.m_handle;
+                other.m_handle = nullptr;
+            }
+            return *this;
+        }
+
+        AsyncTask(AsyncTask const &) = delete;
+        AsyncTask & operator=(AsyncTask const &) = delete;
+
+        ~AsyncTask()
+        {
+            release();
+        }
+
+        bool IsDone() const
+        {
+            return m_handle.promise().IsDone();
+        }
+
+        // Blocks until the coroutine finishes; don't call
+        // this from a worker of a pool the coroutine needs
+        void Wait()
+        {
+            m_handle.promise().Wait();
+        }
+
+        // Waits and returns the result (or rethrows)
+        T Get()
+        {
+            Wait();
+            return m_handle.promise().TakeResult();
+        }
+
+        Awaiter operator co_await() const
+        {
+            return Awaiter(m_handle);
+        }
+
+    private:
+        void release()
+        {
+            if(m_handle && m_handle.promise().Release()) {
+                m_handle.destroy();
+            }
+            m_handle = nullptr;
+        }
+
+        Handle m_handle;
+    };
+
+    namespace async_detail
+    {
+        template<typename T>
+        AsyncTask<T> Promise<T>::get_return_object()
+        {
+            return AsyncTask<T>(
+                        std::coroutine_handle<Promise<T>>::from_promise(*this));
+        }
+
+        inline AsyncTask<void> Promise<void>::get_return_object()
+        {
+            return AsyncTask<void>(
+                        std::coroutine_handle<Promise<void>>::from_promise(*this));
+        }
+    }
+
+    // ============================================================= //
+
+    // AwaitTask
+    // * co_await AwaitTask(pool,task) suspends the calling coroutine
+    //   until task has ended and resumes it on pool; see
+    //   ThreadPool::Then
+    // * a null task counts as ended (ie. a rejected Submit)
+    // * if the resumption is rejected by a full bounded queue
+    //   the coroutine is resumed right away on the thread that
+    //   ended task instead, or on the awaiting thread if task
+    //   had already ended (see ThreadPool::ResumeTask)
+    class AwaitTask final
+    {
+    public:
+        AwaitTask(ThreadPool &thread_pool,shared_ptr<ThreadPool::Task> task) :
+            m_thread_pool(&thread_pool),
+            m_task(std::move(task))
+        {}
+
+        bool await_ready() const
+        {
+            return false;
+        }
+
+        void await_suspend(std::coroutine_handle<> handle)
+        {
+            // The coroutine may be resumed (and this awaiter
+            // destroyed) before the call returns
+            using Resume = ThreadPool::ResumeTask<std::coroutine_handle<>>;
+            m_thread_pool->then(m_task,ThreadPool::MakeTask<Resume>(handle));
+        }
+
+        void await_resume() const
+        {
+            // empty
+        }
+
+    private:
+        ThreadPool* m_thread_pool;
+        shared_ptr<ThreadPool::Task> m_task;
+    };
+
+    // ============================================================= //
+}
+
+#endif // KS_ASYNC_TASK_AVAILABLE
+
+#endif // KS_ASYNC_TASK_HPP
@@ -0,0 +1,97 @@
+/*
+   Copyright (C) 2015 Preet Desai (preet.desai@gmail.com)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <ks/shared/KsBinPackAtlas.hpp>
+
+#include <limits>
+
+namespace ks
+{
+    BinPackAtlas::BinPackAtlas(uint page_width,
+                               uint page_height,
+                               uint spacing,
+                               uint max_pages) :
+        m_page_width(page_width),
+        m_page_height(page_height),
+        m_spacing(spacing),
+        m_max_pages(max_pages)
+    {
+        // empty
+    }
+
+    uint BinPackAtlas::GetPageWidth() const
+    {
+        return m_page_width;
+    }
+
+    uint BinPackAtlas::GetPageHeight() const
+    {
+        return m_page_height;
+    }
+
+    uint BinPackAtlas::GetPageCount() const
+    {
+        return m_list_pages.size();
+    }
+
+    bool BinPackAtlas::AddRectangle(BinPackRectangle &rect,uint &page)
+    {
+        // Find the page with the tightest fit; ties go
+        // to the earlier page
+        uint best_page = m_list_pages.size();
+        uint best_short_side = std::numeric_limits<uint>::max();
+        uint best_long_side = std::numeric_limits<uint>::max();
+
+        for(uint i=0; i < m_list_pages.size(); i++) {
+            uint short_side;
+            uint long_side;
+            if(!m_list_pages[i].GetFit(rect,short_side,long_side)) {
+                continue;
+            }
+
+            if(short_side < best_short_side ||
+               (short_side == best_short_side && long_side < best_long_side))
+            {
+                best_page = i;
+                best_short_side = short_side;
+                best_long_side = long_side;
+                if(short_side == 0 && long_side == 0) {
+                    break;
+                }
+            }
+        }
+
+        if(best_page < m_list_pages.size()) {
+            m_list_pages[best_page].AddRectangle(rect);
+            page = best_page;
+            return true;
+        }
+
+        // Open a new page
+        if(m_max_pages > 0 && m_list_pages.size() == m_max_pages) {
+            return false;
+        }
+
+        BinPackMaxRects new_page(m_page_width,m_page_height,m_spacing);
+        if(!new_page.AddRectangle(rect)) {
+            return false;
+        }
+
+        m_list_pages.push_back(std::move(new_page));
+        page = m_list_pages.size()-1;
+        return true;
+    }
+}
@@ -0,0 +1,65 @@
+/*
+   Copyright (C) 2015 Preet Desai (preet.desai@gmail.com)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef KS_BINPACK_ATLAS_HPP
+#define KS_BINPACK_ATLAS_HPP
+
+#include <vector>
+#include <ks/shared/KsBinPackMaxRects.hpp>
+
+namespace ks
+{
+    // BinPackAtlas
+    // * packs rectangles across a list of same sized pages
+    //   (bins), such as the textures of a glyph atlas
+    // * each rectangle goes in the page where it fits best,
+    //   and a new page is opened when it doesn't fit in any
+    //   of the existing ones
+    class BinPackAtlas
+    {
+    public:
+        // max_pages limits the number of pages that will
+        // be opened; zero means no limit
+        BinPackAtlas(uint page_width,
+                     uint page_height,
+                     uint spacing,
+                     uint max_pages=0);
+
+        uint GetPageWidth() const;
+        uint GetPageHeight() const;
+        uint GetPageCount() const;
+
+        // AddRectangle
+        // * add the given BinPackRectangle to the atlas
+        // * sets the position of the rectangle and the
+        //   page it was placed in
+        // * a new page was opened if page is equal to the
+        //   previous page count
+        // * returns false if the rectangle doesn't fit in
+        //   an empty page or the page limit was reached
+        bool AddRectangle(BinPackRectangle &rect,uint &page);
+
+    private:
+        uint m_page_width;
+        uint m_page_height;
+        uint m_spacing;
+        uint m_max_pages;
+
+        std::vector<BinPackMaxRects> m_list_pages;
+    };
+}
+
+#endif // KS_BINPACK_ATLAS_HPP
@@ -0,0 +1,209 @@
+/*
+   Copyright (C) 2015 Preet Desai (preet.desai@gmail.com)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <ks/shared/KsBinPackBatch.hpp>
+#include <ks/shared/KsBinPackMaxRects.hpp>
+#include <ks/shared/KsBinPackSkyline.hpp>
+
+#include <algorithm>
+#include <limits>
+
+namespace ks
+{
+    namespace
+    {
+        u64 GetSortKey(BinPackRectangle const &rect,BinPackBatch::Sort sort)
+        {
+            // Sort by the space taken up including padding
+            uint const width = rect.width+2*rect.padding;
+            uint const height = rect.height+2*rect.padding;
+
+            switch(sort) {
+                case BinPackBatch::Sort::Height:
+                    return height;
+                case BinPackBatch::Sort::Area:
+                    return u64(width)*height;
+                case BinPackBatch::Sort::Perimeter:
+                    return u64(width)+height;
+                case BinPackBatch::Sort::MaxSide:
+                    return std::max(width,height);
+            }
+            return 0;
+        }
+
+        struct Attempt
+        {
+            u64 area;
+            uint count;
+
+            // Placed rectangles as (index,rect)
+            std::vector<std::pair<uint,BinPackRectangle>> list_placed;
+        };
+
+        template<typename BinPack>
+        void TryPack(std::vector<BinPackRectangle> const &list_rects,
+                     std::vector<uint> const &list_sorted,
+                     uint width,
+                     uint height,
+                     uint spacing,
+                     Attempt &attempt)
+        {
+            BinPack bin(width,height,spacing);
+
+            attempt.area = 0;
+            attempt.count = 0;
+            attempt.list_placed.clear();
+
+            for(uint index : list_sorted) {
+                BinPackRectangle rect = list_rects[index];
+                if(bin.AddRectangle(rect)) {
+                    attempt.area += u64(rect.width)*rect.height;
+                    attempt.count++;
+                    attempt.list_placed.emplace_back(index,rect);
+                }
+            }
+        }
+    }
+
+    uint const BinPackBatch::k_no_bin = std::numeric_limits<uint>::max();
+
+    BinPackBatch::BinPackBatch(uint width,
+                               uint height,
+                               uint spacing) :
+        m_width(width),
+        m_height(height),
+        m_spacing(spacing)
+    {
+        // empty
+    }
+
+    uint BinPackBatch::GetWidth() const
+    {
+        return m_width;
+    }
+
+    uint BinPackBatch::GetHeight() const
+    {
+        return m_height;
+    }
+
+    BinPackBatch::Result BinPackBatch::Pack(
+            std::vector<BinPackRectangle> &list_rects) const
+    {
+        Result result;
+        result.bin_count = 0;
+        result.list_bins.assign(list_rects.size(),k_no_bin);
+
+        std::vector<uint> list_remaining(list_rects.size());
+        for(uint i=0; i < list_remaining.size(); i++) {
+            list_remaining[i] = i;
+        }
+
+        std::vector<uint> list_sorted;
+        Attempt attempt;
+        Attempt best;
+
+        while(!list_remaining.empty()) {
+            best.area = 0;
+            best.count = 0;
+            best.list_placed.clear();
+            Sort best_sort = Sort::Height;
+            Method best_method = Method::Shelf;
+
+            for(Sort sort : { Sort::Height, Sort::Area,
+                              Sort::Perimeter, Sort::MaxSide })
+            {
+                // Largest first; ties are broken by the other side
+                // and then by index so the result is deterministic
+                list_sorted = list_remaining;
+                std::sort(list_sorted.begin(),list_sorted.end(),
+                          [&](uint a,uint b) {
+                              auto const &rect_a = list_rects[a];
+                              auto const &rect_b = list_rects[b];
+                              u64 const key_a = GetSortKey(rect_a,sort);
+                              u64 const key_b = GetSortKey(rect_b,sort);
+                              if(key_a != key_b) {
+                                  return (key_a > key_b);
+                              }
+                              if(rect_a.width != rect_b.width) {
+                                  return (rect_a.width > rect_b.width);
+                              }
+                              return (a < b);
+                          });
+
+                for(Method method : { Method::Shelf,
+                                      Method::Skyline,
+                                      Method::MaxRects })
+                {
+                    if(method == Method::Shelf) {
+                        TryPack<BinPackShelf>(
+                                    list_rects,list_sorted,
+                                    m_width,m_height,m_spacing,attempt);
+                    }
+                    else if(method == Method::Skyline) {
+                        TryPack<BinPackSkyline>(
+                                    list_rects,list_sorted,
+                                    m_width,m_height,m_spacing,attempt);
+                    }
+                    else {
+                        TryPack<BinPackMaxRects>(
+                                    list_rects,list_sorted,
+                                    m_width,m_height,m_spacing,attempt);
+                    }
+
+                    if(attempt.area > best.area ||
+                       (attempt.area == best.area && attempt.count > best.count))
+                    {
+                        std::swap(attempt,best);
+                        best_sort = sort;
+                        best_method = method;
+                    }
+                }
+            }
+
+            // Whatever is left doesn't fit in an empty bin
+            if(best.count == 0) {
+                break;
+            }
+
+            uint const bin = result.bin_count++;
+            result.list_bin_sorts.push_back(best_sort);
+            result.list_bin_methods.push_back(best_method);
+
+            for(auto const &placed : best.list_placed) {
+                list_rects[placed.first] = placed.second;
+                result.list_bins[placed.first] = bin;
+            }
+
+            list_remaining.erase(
+                        std::remove_if(
+                            list_remaining.begin(),
+                            list_remaining.end(),
+                            [&](uint index) {
+                                return (result.list_bins[index] != k_no_bin);
+                            }),
+                        list_remaining.end());
+        }
+
+        for(uint i=0; i < result.list_bins.size(); i++) {
+            if(result.list_bins[i] != 0) {
+                result.list_spilled.push_back(i);
+            }
+        }
+
+        return result;
+    }
+}
@@ -0,0 +1,93 @@
+/*
+   Copyright (C) 2015 Preet Desai (preet.desai@gmail.com)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef KS_BINPACK_BATCH_HPP
+#define KS_BINPACK_BATCH_HPP
+
+#include <vector>
+#include <ks/shared/KsBinPackShelf.hpp>
+
+namespace ks
+{
+    // BinPackBatch
+    // * packs a set of rectangles that are all known up front
+    //   (offline), instead of one at a time in arrival order
+    // * each bin is filled by trying every combination of sort
+    //   order and packer and keeping the one that covers the
+    //   most area; the rectangles that didn't fit spill over to
+    //   the next bin, which is filled the same way
+    class BinPackBatch
+    {
+    public:
+        // Rectangles are sorted largest first by
+        enum class Sort
+        {
+            Height,
+            Area,
+            Perimeter,
+            MaxSide
+        };
+
+        enum class Method
+        {
+            Shelf,
+            Skyline,
+            MaxRects
+        };
+
+        // The bin of a rectangle that doesn't fit in
+        // an empty bin
+        static uint const k_no_bin;
+
+        struct Result
+        {
+            // Number of bins used
+            uint bin_count;
+
+            // The bin of each rectangle, in input order
+            std::vector<uint> list_bins;
+
+            // Indices of the rectangles that didn't fit in
+            // the first bin, including those with k_no_bin
+            std::vector<uint> list_spilled;
+
+            // The sort order and packer picked for each bin
+            std::vector<Sort> list_bin_sorts;
+            std::vector<Method> list_bin_methods;
+        };
+
+        BinPackBatch(uint width,
+                     uint height,
+                     uint spacing);
+
+        uint GetWidth() const;
+        uint GetHeight() const;
+
+        // Pack
+        // * sets the position of every rectangle in
+        //   list_rects and returns the bin of each one
+        // * rectangles that are too large for an empty bin
+        //   are left at their original position
+        Result Pack(std::vector<BinPackRectangle> &list_rects) const;
+
+    private:
+        uint m_width;
+        uint m_height;
+        uint m_spacing;
+    };
+}
+
+#endif // KS_BINPACK_BATCH_HPP
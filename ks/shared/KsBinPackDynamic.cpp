@@ -0,0 +1,315 @@
+/*
+   Copyright (C) 2015 Preet Desai (preet.desai@gmail.com)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <ks/shared/KsBinPackDynamic.hpp>
+
+#include <algorithm>
+
+namespace ks
+{
+    namespace
+    {
+        bool Contains(BinPackRectangle const &a,BinPackRectangle const &b)
+        {
+            return (b.x >= a.x) && (b.y >= a.y) &&
+                   (b.x+b.width <= a.x+a.width) &&
+                   (b.y+b.height <= a.y+a.height);
+        }
+
+        BinPackRectangle MakeRect(uint x,uint y,uint width,uint height)
+        {
+            BinPackRectangle rect;
+            rect.x = x;
+            rect.y = y;
+            rect.width = width;
+            rect.height = height;
+            return rect;
+        }
+    }
+
+    BinPackDynamic::BinPackDynamic(uint width,
+                                   uint height,
+                                   uint spacing) :
+        BinPackMaxRects(width,height,spacing),
+        m_used_area(0)
+    {
+        // empty
+    }
+
+    uint BinPackDynamic::GetRectangleCount() const
+    {
+        return m_list_used_rects.size();
+    }
+
+    u64 BinPackDynamic::GetFreeArea() const
+    {
+        return u64(m_width)*m_height-m_used_area;
+    }
+
+    bool BinPackDynamic::AddRectangle(BinPackRectangle &rect)
+    {
+        if(!BinPackMaxRects::AddRectangle(rect)) {
+            return false;
+        }
+
+        m_list_used_rects.push_back(rect);
+
+        BinPackRectangle const cell = getCell(rect);
+        m_used_area += u64(cell.width)*cell.height;
+        return true;
+    }
+
+    bool BinPackDynamic::RemoveRectangle(BinPackRectangle const &rect)
+    {
+        auto it = std::find_if(
+                    m_list_used_rects.begin(),
+                    m_list_used_rects.end(),
+                    [&rect](BinPackRectangle const &used_rect) {
+                        return (used_rect.x == rect.x &&
+                                used_rect.y == rect.y &&
+                                used_rect.width == rect.width &&
+                                used_rect.height == rect.height);
+                    });
+
+        if(it == m_list_used_rects.end()) {
+            return false;
+        }
+
+        BinPackRectangle const cell = getCell(*it);
+        m_used_area -= u64(cell.width)*cell.height;
+
+        // Order doesn't matter
+        *it = m_list_used_rects.back();
+        m_list_used_rects.pop_back();
+
+        if(m_list_used_rects.empty()) {
+            m_list_free_rects.clear();
+            m_list_free_rects.push_back(MakeRect(0,0,m_width,m_height));
+            return true;
+        }
+
+        freeCell(cell);
+        return true;
+    }
+
+    std::vector<BinPackMove> BinPackDynamic::Defragment(uint max_moves)
+    {
+        std::vector<BinPackMove> list_moves;
+        moveTopLeft(max_moves,list_moves);
+
+        // Merging freed space with its neighbours doesn't
+        // find every maximal free rectangle, so once nothing
+        // moves the free list is rebuilt exactly from the
+        // rectangles in the bin to see if more can be moved
+        if(list_moves.empty()) {
+            rebuildFreeRects();
+            moveTopLeft(max_moves,list_moves);
+        }
+
+        return list_moves;
+    }
+
+    void BinPackDynamic::moveTopLeft(uint max_moves,
+                                     std::vector<BinPackMove> &list_moves)
+    {
+        // Start with the rectangles furthest from the top left
+        std::vector<uint> list_order(m_list_used_rects.size());
+        for(uint i=0; i < list_order.size(); i++) {
+            list_order[i] = i;
+        }
+        std::sort(list_order.begin(),list_order.end(),
+                  [this](uint a,uint b) {
+                      auto const &rect_a = m_list_used_rects[a];
+                      auto const &rect_b = m_list_used_rects[b];
+                      uint const bottom_a = rect_a.y+rect_a.height;
+                      uint const bottom_b = rect_b.y+rect_b.height;
+                      if(bottom_a != bottom_b) {
+                          return (bottom_a > bottom_b);
+                      }
+                      return (rect_a.x > rect_b.x);
+                  });
+
+        for(uint index : list_order) {
+            if(list_moves.size() == max_moves) {
+                break;
+            }
+
+            BinPackRectangle &rect = m_list_used_rects[index];
+            BinPackRectangle const cell = getCell(rect);
+
+            // Lift the rectangle out and put it back in the
+            // topmost, then leftmost free position, which is
+            // where it already is if it can't be moved up
+            freeCell(cell);
+
+            BinPackRectangle new_cell;
+            findTopLeft(cell.width,cell.height,new_cell);
+
+            bool const moved =
+                    (new_cell.y < cell.y) ||
+                    (new_cell.y == cell.y && new_cell.x < cell.x);
+
+            if(!moved) {
+                placeCell(cell);
+                continue;
+            }
+
+            placeCell(new_cell);
+
+            BinPackMove move;
+            move.from = rect;
+            rect.x = new_cell.x+m_spacing+rect.padding;
+            rect.y = new_cell.y+m_spacing+rect.padding;
+            move.to = rect;
+            list_moves.push_back(move);
+        }
+    }
+
+    void BinPackDynamic::rebuildFreeRects()
+    {
+        m_list_free_rects.clear();
+        m_list_free_rects.push_back(MakeRect(0,0,m_width,m_height));
+
+        for(auto const &rect : m_list_used_rects) {
+            placeCell(getCell(rect));
+        }
+    }
+
+    BinPackRectangle BinPackDynamic::getCell(BinPackRectangle const &rect) const
+    {
+        // The area taken up by a rectangle includes the
+        // spacing to its top and left and its padding
+        return MakeRect(rect.x-m_spacing-rect.padding,
+                        rect.y-m_spacing-rect.padding,
+                        rect.width+m_spacing+2*rect.padding,
+                        rect.height+m_spacing+2*rect.padding);
+    }
+
+    void BinPackDynamic::freeCell(BinPackRectangle const &cell)
+    {
+        uint const cell_right = cell.x+cell.width;
+        uint const cell_bottom = cell.y+cell.height;
+
+        // Along with the cell itself, free rectangles that
+        // touch one of its sides can be extended across it
+        // over the span they share with that side
+        m_list_split_rects.clear();
+        m_list_split_rects.push_back(cell);
+
+        for(auto const &free_rect : m_list_free_rects) {
+            uint const free_right = free_rect.x+free_rect.width;
+            uint const free_bottom = free_rect.y+free_rect.height;
+
+            if(free_right == cell.x || cell_right == free_rect.x) {
+                uint const top = std::max(free_rect.y,cell.y);
+                uint const bottom = std::min(free_bottom,cell_bottom);
+                if(top < bottom) {
+                    uint const left = std::min(free_rect.x,cell.x);
+                    uint const right = std::max(free_right,cell_right);
+                    m_list_split_rects.push_back(
+                                MakeRect(left,top,right-left,bottom-top));
+                }
+            }
+            else if(free_bottom == cell.y || cell_bottom == free_rect.y) {
+                uint const left = std::max(free_rect.x,cell.x);
+                uint const right = std::min(free_right,cell_right);
+                if(left < right) {
+                    uint const top = std::min(free_rect.y,cell.y);
+                    uint const bottom = std::max(free_bottom,cell_bottom);
+                    m_list_split_rects.push_back(
+                                MakeRect(left,top,right-left,bottom-top));
+                }
+            }
+        }
+
+        // Unlike after a split, the new rectangles can contain
+        // existing ones, so containment is checked both ways
+        for(size_t i=0; i < m_list_split_rects.size(); i++) {
+            auto const &new_rect = m_list_split_rects[i];
+            bool contained = false;
+
+            for(size_t j=0; j < m_list_split_rects.size(); j++) {
+                if(i == j || m_list_split_rects[j].width == 0) {
+                    continue;
+                }
+                if(Contains(m_list_split_rects[j],new_rect)) {
+                    contained = true;
+                    break;
+                }
+            }
+
+            for(auto &free_rect : m_list_free_rects) {
+                if(contained) {
+                    break;
+                }
+                if(free_rect.width == 0) {
+                    continue;
+                }
+                if(Contains(free_rect,new_rect)) {
+                    contained = true;
+                }
+                else if(Contains(new_rect,free_rect)) {
+                    free_rect.width = 0;
+                }
+            }
+
+            if(contained) {
+                m_list_split_rects[i].width = 0;
+            }
+        }
+
+        m_list_free_rects.erase(
+                    std::remove_if(
+                        m_list_free_rects.begin(),
+                        m_list_free_rects.end(),
+                        [](BinPackRectangle const &free_rect) {
+                            return (free_rect.width == 0);
+                        }),
+                    m_list_free_rects.end());
+
+        for(auto const &new_rect : m_list_split_rects) {
+            if(new_rect.width > 0) {
+                m_list_free_rects.push_back(new_rect);
+            }
+        }
+    }
+
+    void BinPackDynamic::placeCell(BinPackRectangle const &cell)
+    {
+        splitFreeRects(cell);
+        pruneFreeRects();
+    }
+
+    bool BinPackDynamic::findTopLeft(uint width,
+                                     uint height,
+                                     BinPackRectangle &cell) const
+    {
+        bool found = false;
+        for(auto const &free_rect : m_list_free_rects) {
+            if(free_rect.width < width || free_rect.height < height) {
+                continue;
+            }
+            if(!found ||
+               (free_rect.y < cell.y) ||
+               (free_rect.y == cell.y && free_rect.x < cell.x))
+            {
+                cell = MakeRect(free_rect.x,free_rect.y,width,height);
+                found = true;
+            }
+        }
+        return found;
+    }
+}
@@ -0,0 +1,99 @@
+/*
+   Copyright (C) 2015 Preet Desai (preet.desai@gmail.com)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef KS_BINPACK_DYNAMIC_HPP
+#define KS_BINPACK_DYNAMIC_HPP
+
+#include <vector>
+#include <ks/shared/KsBinPackMaxRects.hpp>
+
+namespace ks
+{
+    struct BinPackMove
+    {
+        BinPackRectangle from;
+        BinPackRectangle to;
+    };
+
+    // BinPackDynamic
+    // * a BinPackMaxRects bin that keeps track of the rectangles
+    //   it holds so they can be removed again, for caches where
+    //   the contents of the bin change over time
+    // * removed space is merged with the free space next to it
+    // * Defragment moves rectangles up and to the left a few at
+    //   a time so that free space collects at the bottom of the
+    //   bin instead of being scattered between rectangles
+    class BinPackDynamic : private BinPackMaxRects
+    {
+    public:
+        BinPackDynamic(uint width,
+                       uint height,
+                       uint spacing);
+
+        using BinPackMaxRects::GetWidth;
+        using BinPackMaxRects::GetHeight;
+        using BinPackMaxRects::GetFit;
+
+        // Number of rectangles in the bin
+        uint GetRectangleCount() const;
+
+        // Area of the bin not covered by rectangles
+        // or the spacing and padding around them
+        u64 GetFreeArea() const;
+
+        // AddRectangle
+        // * add the given BinPackRectangle to this bin
+        // * sets the position of the rectangle
+        // * returns false if there wasn't enough space
+        //   to place the rectangle
+        bool AddRectangle(BinPackRectangle &rect);
+
+        // RemoveRectangle
+        // * removes the rectangle previously added at the
+        //   given position with the given size
+        // * returns false if there's no such rectangle
+        bool RemoveRectangle(BinPackRectangle const &rect);
+
+        // Defragment
+        // * moves up to max_moves rectangles to free positions
+        //   closer to the top left of the bin, starting with the
+        //   rectangles furthest down
+        // * returns the moves made, which should be applied in
+        //   order; at the time of each move its destination is
+        //   free, but it may overlap its own source
+        // * returns an empty list once no rectangle can be moved
+        //   further, so it can be called a few moves at a time
+        //   until then
+        std::vector<BinPackMove> Defragment(uint max_moves);
+
+    private:
+        void moveTopLeft(uint max_moves,
+                         std::vector<BinPackMove> &list_moves);
+        void rebuildFreeRects();
+        BinPackRectangle getCell(BinPackRectangle const &rect) const;
+        void freeCell(BinPackRectangle const &cell);
+        void placeCell(BinPackRectangle const &cell);
+        bool findTopLeft(uint width,
+                         uint height,
+                         BinPackRectangle &cell) const;
+
+        u64 m_used_area;
+
+        std::vector<BinPackRectangle> m_list_used_rects;
+    };
+}
+
+#endif // KS_BINPACK_DYNAMIC_HPP
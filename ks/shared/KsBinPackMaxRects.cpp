@@ -0,0 +1,238 @@
+/*
+   Copyright (C) 2015 Preet Desai (preet.desai@gmail.com)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <ks/shared/KsBinPackMaxRects.hpp>
+
+#include <algorithm>
+#include <limits>
+
+namespace ks
+{
+    namespace
+    {
+        uint const k_no_fit = std::numeric_limits<uint>::max();
+
+        bool Contains(BinPackRectangle const &a,BinPackRectangle const &b)
+        {
+            return (b.x >= a.x) && (b.y >= a.y) &&
+                   (b.x+b.width <= a.x+a.width) &&
+                   (b.y+b.height <= a.y+a.height);
+        }
+
+        BinPackRectangle MakeRect(uint x,uint y,uint width,uint height)
+        {
+            BinPackRectangle rect;
+            rect.x = x;
+            rect.y = y;
+            rect.width = width;
+            rect.height = height;
+            return rect;
+        }
+    }
+
+    BinPackMaxRects::BinPackMaxRects(uint width,
+                                     uint height,
+                                     uint spacing) :
+        m_width(width),
+        m_height(height),
+        m_spacing(spacing)
+    {
+        // Each rectangle is placed with spacing to its top and
+        // left and its own padding on every side, so free
+        // rectangles are tracked for the padded size and the
+        // spacing and padding come out of the top left
+        m_list_free_rects.push_back(MakeRect(0,0,m_width,m_height));
+    }
+
+    uint BinPackMaxRects::GetWidth() const
+    {
+        return m_width;
+    }
+
+    uint BinPackMaxRects::GetHeight() const
+    {
+        return m_height;
+    }
+
+    bool BinPackMaxRects::GetFit(BinPackRectangle const &rect,
+                                 uint &short_side,
+                                 uint &long_side) const
+    {
+        uint const index = findFreeRect(rect.width+m_spacing+2*rect.padding,
+                                        rect.height+m_spacing+2*rect.padding,
+                                        short_side,
+                                        long_side);
+
+        return (index != k_no_fit);
+    }
+
+    bool BinPackMaxRects::AddRectangle(BinPackRectangle &rect)
+    {
+        uint const width = rect.width+m_spacing+2*rect.padding;
+        uint const height = rect.height+m_spacing+2*rect.padding;
+
+        uint short_side;
+        uint long_side;
+        uint const index = findFreeRect(width,height,short_side,long_side);
+        if(index == k_no_fit) {
+            return false;
+        }
+
+        BinPackRectangle const used =
+                MakeRect(m_list_free_rects[index].x,
+                         m_list_free_rects[index].y,
+                         width,
+                         height);
+
+        splitFreeRects(used);
+        pruneFreeRects();
+
+        rect.x = used.x+m_spacing+rect.padding;
+        rect.y = used.y+m_spacing+rect.padding;
+        rect.rotated = false;
+
+        return true;
+    }
+
+    uint BinPackMaxRects::findFreeRect(uint width,
+                                       uint height,
+                                       uint &best_short_side,
+                                       uint &best_long_side) const
+    {
+        uint best_index = k_no_fit;
+        best_short_side = k_no_fit;
+        best_long_side = k_no_fit;
+
+        for(uint i=0; i < m_list_free_rects.size(); i++) {
+            auto const &free_rect = m_list_free_rects[i];
+            if(free_rect.width < width || free_rect.height < height) {
+                continue;
+            }
+
+            uint const leftover_x = free_rect.width-width;
+            uint const leftover_y = free_rect.height-height;
+            uint const short_side = std::min(leftover_x,leftover_y);
+            uint const long_side = std::max(leftover_x,leftover_y);
+
+            if(short_side < best_short_side ||
+               (short_side == best_short_side && long_side < best_long_side))
+            {
+                best_index = i;
+                best_short_side = short_side;
+                best_long_side = long_side;
+            }
+        }
+
+        return best_index;
+    }
+
+    void BinPackMaxRects::splitFreeRects(BinPackRectangle const &used)
+    {
+        uint const used_right = used.x+used.width;
+        uint const used_bottom = used.y+used.height;
+
+        // Replace each free rectangle that intersects the used
+        // area with the (up to four) maximal rectangles around it
+        m_list_split_rects.clear();
+        for(auto &free_rect : m_list_free_rects) {
+            uint const free_right = free_rect.x+free_rect.width;
+            uint const free_bottom = free_rect.y+free_rect.height;
+
+            if(used.x >= free_right || used_right <= free_rect.x ||
+               used.y >= free_bottom || used_bottom <= free_rect.y)
+            {
+                continue;
+            }
+
+            if(used.x > free_rect.x) {
+                m_list_split_rects.push_back(
+                            MakeRect(free_rect.x,free_rect.y,
+                                     used.x-free_rect.x,free_rect.height));
+            }
+            if(used_right < free_right) {
+                m_list_split_rects.push_back(
+                            MakeRect(used_right,free_rect.y,
+                                     free_right-used_right,free_rect.height));
+            }
+            if(used.y > free_rect.y) {
+                m_list_split_rects.push_back(
+                            MakeRect(free_rect.x,free_rect.y,
+                                     free_rect.width,used.y-free_rect.y));
+            }
+            if(used_bottom < free_bottom) {
+                m_list_split_rects.push_back(
+                            MakeRect(free_rect.x,used_bottom,
+                                     free_rect.width,free_bottom-used_bottom));
+            }
+
+            // Mark for removal
+            free_rect.width = 0;
+        }
+
+        m_list_free_rects.erase(
+                    std::remove_if(
+                        m_list_free_rects.begin(),
+                        m_list_free_rects.end(),
+                        [](BinPackRectangle const &free_rect) {
+                            return (free_rect.width == 0);
+                        }),
+                    m_list_free_rects.end());
+    }
+
+    void BinPackMaxRects::pruneFreeRects()
+    {
+        // The remaining free rectangles don't contain each other,
+        // so only the rectangles that were just split off need to
+        // be checked, which keeps this from going quadratic in
+        // the size of the free list
+
+        // Drop split rectangles contained in another split rectangle
+        for(size_t i=0; i < m_list_split_rects.size(); i++) {
+            auto const &split_rect = m_list_split_rects[i];
+            for(size_t j=0; j < m_list_split_rects.size(); j++) {
+                if(i == j || m_list_split_rects[j].width == 0) {
+                    continue;
+                }
+                if(Contains(m_list_split_rects[j],split_rect)) {
+                    m_list_split_rects[i].width = 0;
+                    break;
+                }
+            }
+        }
+
+        // Drop split rectangles contained in a remaining free
+        // rectangle; split rectangles come from free rectangles
+        // that were removed so they can't contain any that remain
+        size_t const free_count = m_list_free_rects.size();
+        for(auto const &split_rect : m_list_split_rects) {
+            if(split_rect.width == 0) {
+                continue;
+            }
+
+            bool contained = false;
+            for(size_t i=0; i < free_count; i++) {
+                if(Contains(m_list_free_rects[i],split_rect)) {
+                    contained = true;
+                    break;
+                }
+            }
+
+            if(!contained) {
+                m_list_free_rects.push_back(split_rect);
+            }
+        }
+    }
+}
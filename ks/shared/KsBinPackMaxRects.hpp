@@ -0,0 +1,83 @@
+/*
+   Copyright (C) 2015 Preet Desai (preet.desai@gmail.com)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef KS_BINPACK_MAX_RECTS_HPP
+#define KS_BINPACK_MAX_RECTS_HPP
+
+#include <vector>
+#include <ks/shared/KsBinPackShelf.hpp>
+
+namespace ks
+{
+    // BinPackMaxRects
+    // * keeps a list of the maximal free rectangles in the bin
+    //   and places each rectangle in the free rectangle that
+    //   leaves the shortest leftover side (best short side fit)
+    // * unlike BinPackShelf, space next to and below short
+    //   rectangles is reused, which packs much more densely at
+    //   the cost of slower insertion as the free list grows
+    // * spacing is left between rectangles and between the
+    //   rectangles and the top and left edges of the bin
+    class BinPackMaxRects
+    {
+    public:
+        BinPackMaxRects(uint width,
+                        uint height,
+                        uint spacing);
+
+        uint GetWidth() const;
+        uint GetHeight() const;
+
+        // AddRectangle
+        // * add the given BinPackRectangle to this bin
+        // * sets the position of the rectangle
+        // * returns false if there wasn't enough space
+        //   to place the rectangle
+        bool AddRectangle(BinPackRectangle &rect);
+
+        // GetFit
+        // * gets how well the given rectangle would fit if it
+        //   was added now, as the leftover sides of the free
+        //   space it would go in (compare short_side first,
+        //   then long_side; lower is better)
+        // * returns false if the rectangle doesn't fit
+        bool GetFit(BinPackRectangle const &rect,
+                    uint &short_side,
+                    uint &long_side) const;
+
+    protected:
+        uint findFreeRect(uint width,
+                          uint height,
+                          uint &best_short_side,
+                          uint &best_long_side) const;
+
+        void splitFreeRects(BinPackRectangle const &used);
+        void pruneFreeRects();
+
+        uint m_width;
+        uint m_height;
+        uint m_spacing;
+
+        // Free space in the bin; rectangles may overlap
+        std::vector<BinPackRectangle> m_list_free_rects;
+
+        // Scratch list of the rectangles split off by the
+        // last placement
+        std::vector<BinPackRectangle> m_list_split_rects;
+    };
+}
+
+#endif // KS_BINPACK_MAX_RECTS_HPP
@@ -16,6 +16,8 @@
 
 #include <ks/shared/KsBinPackShelf.hpp>
 
+#include <algorithm>
+
 namespace ks
 {
     BinPackShelf::BinPackShelf(uint width,
@@ -23,7 +25,9 @@ namespace ks
                                uint spacing) :
         m_width(width),
         m_height(height),
-        m_spacing(spacing)
+        m_spacing(spacing),
+        m_allow_rotation(false),
+        m_alignment(1)
     {
         // start the initial placement at
         // the top left corner
@@ -42,55 +46,123 @@ namespace ks
         return m_height;
     }
 
-    bool BinPackShelf::AddRectangle(BinPackRectangle &rect)
+    void BinPackShelf::SetAllowRotation(bool allow_rotation)
     {
-        rect.x = m_place_x+m_spacing;
-        rect.y = m_place_y+m_spacing;
-        uint rect_right = rect.x+rect.width;
-        uint rect_bottom = rect.y+rect.height;
+        m_allow_rotation = allow_rotation;
+    }
 
-        if(rect_bottom < m_height) {
-            if(rect_right < m_width) {
-                // the rectangle fits
+    void BinPackShelf::SetAlignment(uint alignment)
+    {
+        m_alignment = std::max(1u,alignment);
+    }
 
-                // advance place
-                m_place_x = rect_right;
+    bool BinPackShelf::AddRectangle(BinPackRectangle &rect)
+    {
+        uint const padding = rect.padding;
+
+        // Orientations to try; the second is the rotated one
+        uint const list_widths[2] = { rect.width, rect.height };
+        uint const list_heights[2] = { rect.height, rect.width };
+        uint const orientation_count =
+                (m_allow_rotation && rect.width != rect.height) ? 2 : 1;
+
+        uint best = orientation_count;
+        uint best_x = 0;
+        uint best_y = 0;
+        uint best_bottom = 0;
+        uint best_right = 0;
+
+        // Try the current shelf first, picking the orientation
+        // that raises the shelf the least and then the one
+        // that uses up the least of the shelf's width
+        for(uint i=0; i < orientation_count; i++) {
+            uint x,y;
+            if(!getPosition(m_place_x,m_place_y,
+                            list_widths[i],list_heights[i],padding,x,y)) {
+                continue;
+            }
+
+            uint const right = x+list_widths[i]+padding;
+            uint const bottom = std::max(m_shelf_y,y+list_heights[i]+padding);
+            if(best == orientation_count ||
+               bottom < best_bottom ||
+               (bottom == best_bottom && right < best_right))
+            {
+                best = i;
+                best_x = x;
+                best_y = y;
+                best_right = right;
+                best_bottom = bottom;
+            }
+        }
 
-                // adjust shelf
-                if(m_shelf_y < rect_bottom) {
-                    m_shelf_y = rect_bottom;
+        // Otherwise try jumping up a shelf, picking the
+        // orientation that makes the new shelf the lowest
+        bool new_shelf = false;
+        if(best == orientation_count) {
+            for(uint i=0; i < orientation_count; i++) {
+                uint x,y;
+                if(!getPosition(0,m_shelf_y,
+                                list_widths[i],list_heights[i],padding,x,y)) {
+                    continue;
                 }
 
-                return true;
-            }
-            else {
-                // try jumping up a shelf
-                m_place_x = 0;
-                m_place_y = m_shelf_y;
-                rect.x = m_place_x + m_spacing; // left
-                rect.y = m_place_y + m_spacing; // bottom
-                rect_right = rect.x + rect.width;
-                rect_bottom = rect.y + rect.height;
-
-                // check if the new placement
-                // allows the rectangle to fit
-                if(rect_bottom < m_height) {
-                    if(rect_right < m_width) {
-                        // the rectangle fits;
-
-                        // advance place
-                        m_place_x = rect_right;
-
-                        // adjust shelf
-                        if(m_shelf_y < rect_bottom) {
-                            m_shelf_y = rect_bottom;
-                        }
-
-                        return true;
-                    }
+                uint const right = x+list_widths[i]+padding;
+                uint const bottom = y+list_heights[i]+padding;
+                if(best == orientation_count ||
+                   bottom < best_bottom ||
+                   (bottom == best_bottom && right < best_right))
+                {
+                    best = i;
+                    best_x = x;
+                    best_y = y;
+                    best_right = right;
+                    best_bottom = bottom;
                 }
             }
+
+            if(best == orientation_count) {
+                return false;
+            }
+            new_shelf = true;
+        }
+
+        if(new_shelf) {
+            m_place_y = m_shelf_y;
         }
-        return false;
+
+        // advance place
+        m_place_x = best_right;
+
+        // adjust shelf
+        m_shelf_y = std::max(m_shelf_y,best_bottom);
+
+        rect.x = best_x;
+        rect.y = best_y;
+        rect.width = list_widths[best];
+        rect.height = list_heights[best];
+        rect.rotated = (best == 1);
+
+        return true;
+    }
+
+    bool BinPackShelf::getPosition(uint place_x,
+                                   uint place_y,
+                                   uint width,
+                                   uint height,
+                                   uint padding,
+                                   uint &x,
+                                   uint &y) const
+    {
+        // Round the position up to the alignment
+        x = place_x+m_spacing+padding;
+        y = place_y+m_spacing+padding;
+        x = (x+m_alignment-1)/m_alignment*m_alignment;
+        y = (y+m_alignment-1)/m_alignment*m_alignment;
+
+        uint const rect_right = x+width+padding;
+        uint const rect_bottom = y+height+padding;
+
+        return (rect_bottom < m_height && rect_right < m_width);
     }
 }
@@ -30,11 +30,23 @@ namespace ks
         uint width;
         uint height;
 
+        // Extra space kept clear on every side of this
+        // rectangle, in addition to the bin's spacing
+        uint padding;
+
+        // Set if the rectangle was placed turned by 90 degrees,
+        // in which case width and height have been swapped
+        // * only BinPackShelf with rotation allowed turns
+        //   rectangles; the other packers clear it
+        bool rotated;
+
         BinPackRectangle() :
             x(0),
             y(0),
             width(0),
-            height(0)
+            height(0),
+            padding(0),
+            rotated(false)
         {}
     };
 
@@ -48,6 +60,19 @@ namespace ks
         uint GetWidth() const;
         uint GetHeight() const;
 
+        // SetAllowRotation
+        // * lets rectangles be turned by 90 degrees when it
+        //   keeps the shelves lower
+        // * off by default
+        void SetAllowRotation(bool allow_rotation);
+
+        // SetAlignment
+        // * rectangles are placed at x and y positions that are
+        //   a multiple of alignment, ie 4 to line rectangles up
+        //   with the blocks of a block compressed texture
+        // * defaults to 1 (no alignment)
+        void SetAlignment(uint alignment);
+
         // AddRectangle
         // * add the given BinPackRectangle to this bin
         // * may modify the position and orientation of
@@ -57,6 +82,14 @@ namespace ks
         bool AddRectangle(BinPackRectangle &rect);
 
     private:
+        bool getPosition(uint place_x,
+                         uint place_y,
+                         uint width,
+                         uint height,
+                         uint padding,
+                         uint &x,
+                         uint &y) const;
+
         uint m_width;
         uint m_height;
 
@@ -69,6 +102,9 @@ namespace ks
         // Spacing used in x and y between
         // adjacent rectangles
         uint m_spacing;
+
+        bool m_allow_rotation;
+        uint m_alignment;
     };
 }
 
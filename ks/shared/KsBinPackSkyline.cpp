@@ -0,0 +1,156 @@
+/*
+   Copyright (C) 2015 Preet Desai (preet.desai@gmail.com)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <ks/shared/KsBinPackSkyline.hpp>
+
+#include <algorithm>
+#include <limits>
+
+namespace ks
+{
+    BinPackSkyline::BinPackSkyline(uint width,
+                                   uint height,
+                                   uint spacing) :
+        m_width(width),
+        m_height(height),
+        m_spacing(spacing)
+    {
+        m_list_segments.push_back(Segment{0,0,m_width});
+    }
+
+    uint BinPackSkyline::GetWidth() const
+    {
+        return m_width;
+    }
+
+    uint BinPackSkyline::GetHeight() const
+    {
+        return m_height;
+    }
+
+    bool BinPackSkyline::AddRectangle(BinPackRectangle &rect)
+    {
+        // Rectangles are tracked with the spacing to their
+        // top and left and their padding included
+        uint const width = rect.width+m_spacing+2*rect.padding;
+        uint const height = rect.height+m_spacing+2*rect.padding;
+
+        uint best_index = std::numeric_limits<uint>::max();
+        uint best_bottom = std::numeric_limits<uint>::max();
+        uint best_width = std::numeric_limits<uint>::max();
+        uint best_y = 0;
+
+        for(uint i=0; i < m_list_segments.size(); i++) {
+            uint y;
+            if(!getFitY(i,width,height,y)) {
+                continue;
+            }
+
+            // Lowest bottom edge, then the narrowest segment
+            // to leave wider ones for wider rectangles
+            uint const bottom = y+height;
+            uint const segment_width = m_list_segments[i].width;
+            if(bottom < best_bottom ||
+               (bottom == best_bottom && segment_width < best_width))
+            {
+                best_index = i;
+                best_bottom = bottom;
+                best_width = segment_width;
+                best_y = y;
+            }
+        }
+
+        if(best_index == std::numeric_limits<uint>::max()) {
+            return false;
+        }
+
+        uint const x = m_list_segments[best_index].x;
+        addSegment(best_index,x,best_y,width,height);
+
+        rect.x = x+m_spacing+rect.padding;
+        rect.y = best_y+m_spacing+rect.padding;
+        rect.rotated = false;
+
+        return true;
+    }
+
+    bool BinPackSkyline::getFitY(uint index,
+                                 uint width,
+                                 uint height,
+                                 uint &y) const
+    {
+        // A rectangle with its left edge at the start of this
+        // segment rests on the highest segment it spans
+        if(m_list_segments[index].x+width > m_width) {
+            return false;
+        }
+
+        y = 0;
+        uint width_left = width;
+        while(width_left > 0) {
+            if(index == m_list_segments.size()) {
+                return false;
+            }
+            auto const &segment = m_list_segments[index];
+            y = std::max(y,segment.y);
+            if(y+height > m_height) {
+                return false;
+            }
+            width_left -= std::min(width_left,segment.width);
+            index++;
+        }
+
+        return true;
+    }
+
+    void BinPackSkyline::addSegment(uint index,
+                                    uint x,
+                                    uint y,
+                                    uint width,
+                                    uint height)
+    {
+        m_list_segments.insert(m_list_segments.begin()+index,
+                               Segment{x,y+height,width});
+
+        // Shrink or remove the segments now covered by the
+        // new one
+        uint const right = x+width;
+        uint i = index+1;
+        while(i < m_list_segments.size()) {
+            auto &segment = m_list_segments[i];
+            if(segment.x >= right) {
+                break;
+            }
+            uint const segment_right = segment.x+segment.width;
+            if(segment_right <= right) {
+                m_list_segments.erase(m_list_segments.begin()+i);
+                continue;
+            }
+            segment.width = segment_right-right;
+            segment.x = right;
+            break;
+        }
+
+        // Merge neighbouring segments of the same height
+        for(i=1; i < m_list_segments.size(); i++) {
+            if(m_list_segments[i-1].y == m_list_segments[i].y) {
+                m_list_segments[i-1].width += m_list_segments[i].width;
+                m_list_segments.erase(m_list_segments.begin()+i);
+                i--;
+            }
+        }
+    }
+}
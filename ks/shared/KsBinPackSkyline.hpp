@@ -0,0 +1,80 @@
+/*
+   Copyright (C) 2015 Preet Desai (preet.desai@gmail.com)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef KS_BINPACK_SKYLINE_HPP
+#define KS_BINPACK_SKYLINE_HPP
+
+#include <vector>
+#include <ks/shared/KsBinPackShelf.hpp>
+
+namespace ks
+{
+    // BinPackSkyline
+    // * tracks the height of the packed area across the width
+    //   of the bin as a list of horizontal segments (the skyline)
+    //   and places each rectangle where its bottom edge ends up
+    //   lowest (bottom left)
+    // * space under the skyline is never reused, so it packs
+    //   less densely than BinPackMaxRects, but insertion only
+    //   walks the skyline and stays fast as the bin fills up
+    // * spacing is left between rectangles and between the
+    //   rectangles and the top and left edges of the bin
+    class BinPackSkyline
+    {
+    public:
+        BinPackSkyline(uint width,
+                       uint height,
+                       uint spacing);
+
+        uint GetWidth() const;
+        uint GetHeight() const;
+
+        // AddRectangle
+        // * add the given BinPackRectangle to this bin
+        // * sets the position of the rectangle
+        // * returns false if there wasn't enough space
+        //   to place the rectangle
+        bool AddRectangle(BinPackRectangle &rect);
+
+    private:
+        struct Segment
+        {
+            uint x;
+            uint y;
+            uint width;
+        };
+
+        bool getFitY(uint index,
+                     uint width,
+                     uint height,
+                     uint &y) const;
+
+        void addSegment(uint index,
+                        uint x,
+                        uint y,
+                        uint width,
+                        uint height);
+
+        uint m_width;
+        uint m_height;
+        uint m_spacing;
+
+        // Ordered by x and spans the width of the bin
+        std::vector<Segment> m_list_segments;
+    };
+}
+
+#endif // KS_BINPACK_SKYLINE_HPP
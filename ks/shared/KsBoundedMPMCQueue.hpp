@@ -0,0 +1,203 @@
+/*
+   Copyright (C) 2015 Preet Desai (preet.desai@gmail.com)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef KS_BOUNDED_MPMC_QUEUE_HPP
+#define KS_BOUNDED_MPMC_QUEUE_HPP
+
+#include <atomic>
+#include <ks/KsGlobal.hpp>
+
+namespace ks
+{
+    // ============================================================= //
+
+    // ref: http://www.1024cores.net/home/lock-free-algorithms/
+    //      queues/bounded-mpmc-queue
+
+    // A lock-free, fixed capacity, multiple producer multiple
+    // consumer FIFO queue. Each cell carries a sequence number
+    // that tells producers and consumers whether the cell is
+    // ready to be written or read, so push and pop only need
+    // a single CAS on the shared position in the common case.
+
+    // T should be default constructible and movable
+    template<typename T>
+    class BoundedMPMCQueue final
+    {
+    public:
+        // The capacity is rounded up to a power of two
+        BoundedMPMCQueue(uint capacity) :
+            m_capacity(roundUpPow2(capacity)),
+            m_mask(m_capacity-1),
+            m_list_cells(new Cell[m_capacity]),
+            m_enqueue_pos(0),
+            m_dequeue_pos(0)
+        {
+            for(size_t i=0; i < m_capacity; i++) {
+                m_list_cells[i].sequence.store(i,std::memory_order_relaxed);
+            }
+        }
+
+        ~BoundedMPMCQueue()
+        {
+            // empty
+        }
+
+        // No copying or moving allowed
+        BoundedMPMCQueue(BoundedMPMCQueue const &) = delete;
+        BoundedMPMCQueue& operator=(BoundedMPMCQueue const &) = delete;
+
+        BoundedMPMCQueue(BoundedMPMCQueue&&) = delete;
+        BoundedMPMCQueue& operator=(BoundedMPMCQueue&&) = delete;
+
+        uint GetCapacity() const
+        {
+            return static_cast<uint>(m_capacity);
+        }
+
+        // Only a snapshot; may be stale as soon as it is returned
+        uint GetSizeApprox() const
+        {
+            size_t const enqueue_pos =
+                    m_enqueue_pos.load(std::memory_order_relaxed);
+
+            size_t const dequeue_pos =
+                    m_dequeue_pos.load(std::memory_order_relaxed);
+
+            return (enqueue_pos > dequeue_pos) ?
+                        static_cast<uint>(enqueue_pos-dequeue_pos) : 0;
+        }
+
+        // TryPush
+        // * moves value into the queue
+        // * returns false and leaves value untouched
+        //   if the queue is full
+        bool TryPush(T &value)
+        {
+            Cell* cell;
+            size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+
+            for(;;) {
+                cell = &m_list_cells[pos & m_mask];
+                size_t const seq =
+                        cell->sequence.load(std::memory_order_acquire);
+
+                intptr_t const diff =
+                        static_cast<intptr_t>(seq)-static_cast<intptr_t>(pos);
+
+                if(diff == 0) {
+                    // cell is free; try to claim it
+                    if(m_enqueue_pos.compare_exchange_weak(
+                                pos,pos+1,std::memory_order_relaxed)) {
+                        break;
+                    }
+                    // else pos was reloaded by compare_exchange
+                }
+                else if(diff < 0) {
+                    // cell still holds a value from the
+                    // previous lap: the queue is full
+                    return false;
+                }
+                else {
+                    // another producer claimed this cell
+                    pos = m_enqueue_pos.load(std::memory_order_relaxed);
+                }
+            }
+
+            cell->value = std::move(value);
+            cell->sequence.store(pos+1,std::memory_order_release);
+
+            return true;
+        }
+
+        // TryPop
+        // * moves the value at the front of the queue into value
+        // * returns false if the queue is empty
+        bool TryPop(T &value)
+        {
+            Cell* cell;
+            size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+
+            for(;;) {
+                cell = &m_list_cells[pos & m_mask];
+                size_t const seq =
+                        cell->sequence.load(std::memory_order_acquire);
+
+                intptr_t const diff =
+                        static_cast<intptr_t>(seq)-static_cast<intptr_t>(pos+1);
+
+                if(diff == 0) {
+                    // cell has a value; try to claim it
+                    if(m_dequeue_pos.compare_exchange_weak(
+                                pos,pos+1,std::memory_order_relaxed)) {
+                        break;
+                    }
+                }
+                else if(diff < 0) {
+                    // cell hasn't been written: the queue is empty
+                    return false;
+                }
+                else {
+                    // another consumer claimed this cell
+                    pos = m_dequeue_pos.load(std::memory_order_relaxed);
+                }
+            }
+
+            value = std::move(cell->value);
+
+            // Reset the cell so that it doesn't keep
+            // any resources alive until it is reused
+            cell->value = T();
+            cell->sequence.store(pos+m_mask+1,std::memory_order_release);
+
+            return true;
+        }
+
+    private:
+        static size_t roundUpPow2(uint capacity)
+        {
+            size_t pow2 = 2;
+            while(pow2 < capacity) {
+                pow2 <<= 1;
+            }
+            return pow2;
+        }
+
+        // The enqueue and dequeue positions are padded to
+        // avoid false sharing between producers and consumers
+        static size_t const k_cache_line_size = 64;
+
+        struct Cell
+        {
+            std::atomic<size_t> sequence;
+            T value;
+        };
+
+        size_t const m_capacity;
+        size_t const m_mask;
+        unique_ptr<Cell[]> const m_list_cells;
+
+        char m_pad0[k_cache_line_size];
+        std::atomic<size_t> m_enqueue_pos;
+        char m_pad1[k_cache_line_size];
+        std::atomic<size_t> m_dequeue_pos;
+        char m_pad2[k_cache_line_size];
+    };
+
+    // ============================================================= //
+}
+
+#endif // KS_BOUNDED_MPMC_QUEUE_HPP
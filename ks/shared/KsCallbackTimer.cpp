@@ -15,9 +15,183 @@
 */
 
 #include <ks/shared/KsCallbackTimer.hpp>
+#include <ks/shared/KsTraceRecorder.hpp>
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 namespace ks
 {
+    namespace
+    {
+        using Clock = std::chrono::steady_clock;
+
+        // Waits for the deadlines of precise CallbackTimers
+        // on a single thread shared by every event loop
+        class PreciseTimerQueue final
+        {
+        public:
+            // Never destroyed so that timers can still be started
+            // and stopped during static destruction
+            static PreciseTimerQueue& Get()
+            {
+                static PreciseTimerQueue* queue = new PreciseTimerQueue;
+                return *queue;
+            }
+
+            // Acquire / Release
+            // * called by timers that use a precise interval; the
+            //   thread is started by the first timer to acquire the
+            //   queue and is stopped and joined, dropping any
+            //   entries left, once the last one releases it
+            // * must not be called from the queue's thread
+            void Acquire()
+            {
+                std::lock_guard<std::mutex> thread_lock(m_thread_mutex);
+                if(m_timer_count++ > 0) {
+                    return;
+                }
+
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_stopped = false;
+                }
+                m_thread = std::thread(&PreciseTimerQueue::run,this);
+            }
+
+            void Release()
+            {
+                std::lock_guard<std::mutex> thread_lock(m_thread_mutex);
+                if(--m_timer_count > 0) {
+                    return;
+                }
+
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_stopped = true;
+                    m_heap_entries.clear();
+                }
+                m_cond.notify_one();
+                m_thread.join();
+            }
+
+            void Add(Clock::time_point deadline,std::function<void()> fire)
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_heap_entries.push_back(Entry{deadline,m_seq++,std::move(fire)});
+                std::push_heap(m_heap_entries.begin(),
+                               m_heap_entries.end(),
+                               compareEntries);
+
+                m_cond.notify_one();
+            }
+
+        private:
+            struct Entry
+            {
+                Clock::time_point deadline;
+                u64 seq;
+                std::function<void()> fire;
+            };
+
+            PreciseTimerQueue() :
+                m_timer_count(0),
+                m_seq(0),
+                m_stopped(true)
+            {}
+
+            // Orders the heap so the earliest deadline is first
+            static bool compareEntries(Entry const &a,Entry const &b)
+            {
+                if(a.deadline != b.deadline) {
+                    return (a.deadline > b.deadline);
+                }
+                return (a.seq > b.seq);
+            }
+
+            void run()
+            {
+                TraceRecorder::SetThreadName("CallbackTimer precise");
+
+                std::vector<std::function<void()>> list_due;
+                std::unique_lock<std::mutex> lock(m_mutex);
+
+                while(!m_stopped)
+                {
+                    if(m_heap_entries.empty()) {
+                        m_cond.wait(lock);
+                        continue;
+                    }
+
+                    // Sleep until just before the deadline since
+                    // waking up from a sleep isn't very precise
+                    auto const deadline = m_heap_entries.front().deadline;
+                    if(deadline-Clock::now() > CallbackTimer::k_precise_spin_us) {
+                        m_cond.wait_until(
+                                    lock,deadline-CallbackTimer::k_precise_spin_us);
+                        continue;
+                    }
+
+                    // Spin out the rest without the lock so that
+                    // timers can still be added
+                    lock.unlock();
+                    while(Clock::now() < deadline) {
+                        std::this_thread::yield();
+                    }
+                    lock.lock();
+
+                    auto const now = Clock::now();
+                    while(!m_heap_entries.empty() &&
+                          m_heap_entries.front().deadline <= now)
+                    {
+                        std::pop_heap(m_heap_entries.begin(),
+                                      m_heap_entries.end(),
+                                      compareEntries);
+                        list_due.push_back(std::move(m_heap_entries.back().fire));
+                        m_heap_entries.pop_back();
+                    }
+
+                    lock.unlock();
+                    for(auto &fire : list_due) {
+                        fire();
+                    }
+                    list_due.clear();
+                    lock.lock();
+                }
+            }
+
+            // Serializes starting and joining m_thread
+            std::mutex m_thread_mutex;
+            std::thread m_thread;
+            uint m_timer_count;
+
+            std::mutex m_mutex;
+            std::condition_variable m_cond;
+            std::vector<Entry> m_heap_entries;
+            u64 m_seq;
+            bool m_stopped;
+        };
+    }
+
+    // ============================================================= //
+
+    std::chrono::microseconds const CallbackTimer::k_precise_spin_us(200);
+
+    u64 CoalesceDeadline(u64 deadline,u64 slack)
+    {
+        u64 const latest = deadline+slack;
+        for(uint bit=63; bit > 0; bit--) {
+            u64 const aligned = latest & ~((u64(1) << bit)-1);
+            if(aligned >= deadline) {
+                return aligned;
+            }
+        }
+        return latest;
+    }
+
     CallbackTimer::CallbackTimer(ks::Object::Key const &key,
                                  shared_ptr<EventLoop> const &evloop,
                                  Milliseconds interval_ms,
@@ -26,8 +200,16 @@ namespace ks
         m_timer(MakeObject<Timer>(evloop)),
         m_active(false),
         m_interval_ms(interval_ms),
+        m_slack_ms(0),
         m_repeating(true),
-        m_callback(callback)
+        m_coalesced(false),
+        m_precise(false),
+        m_precise_interval(0),
+        m_precise_queue_acquired(false),
+        m_generation(0),
+        m_callback_state(make_shared<CallbackState>(std::move(callback))),
+        m_thread_pool(nullptr),
+        m_overlap(Overlap::Skip)
     {
 
     }
@@ -35,6 +217,8 @@ namespace ks
     void CallbackTimer::Init(ks::Object::Key const &,
                              shared_ptr<CallbackTimer> const &this_callback_timer)
     {
+        m_this_callback_timer = this_callback_timer;
+
         m_timer->signal_timeout.Connect(
                     this_callback_timer,
                     &CallbackTimer::onTimeout,
@@ -43,7 +227,9 @@ namespace ks
 
     CallbackTimer::~CallbackTimer()
     {
-
+        if(m_precise_queue_acquired) {
+            PreciseTimerQueue::Get().Release();
+        }
     }
 
     void CallbackTimer::SetRepeating(bool repeating)
@@ -53,25 +239,306 @@ namespace ks
 
     void CallbackTimer::SetInterval(Milliseconds interval_ms)
     {
+        if(interval_ms < Milliseconds(0)) {
+            throw CallbackTimerInvalidInterval(
+                        "CallbackTimer: interval must not be negative");
+        }
+
         m_interval_ms = interval_ms;
+        m_precise = false;
+    }
+
+    void CallbackTimer::SetPreciseInterval(std::chrono::nanoseconds interval)
+    {
+        if(interval <= std::chrono::nanoseconds(0)) {
+            throw CallbackTimerInvalidInterval(
+                        "CallbackTimer: precise interval must be positive");
+        }
+
+        m_precise_interval = interval;
+        m_precise = true;
+    }
+
+    void CallbackTimer::SetSlack(Milliseconds slack_ms)
+    {
+        m_slack_ms = slack_ms;
+    }
+
+    void CallbackTimer::SetThreadPool(ThreadPool* thread_pool,Overlap overlap)
+    {
+        m_thread_pool = thread_pool;
+        m_overlap = overlap;
     }
 
     void CallbackTimer::Start()
     {
         m_active = true;
-        m_timer->Start(m_interval_ms,m_repeating);
+        m_generation++;
+        m_coalesced = (!m_precise && m_slack_ms > Milliseconds(0));
+
+        {
+            std::lock_guard<std::mutex> lock(m_callback_state->mutex);
+            m_callback_state->interval = m_precise ?
+                        Clock::duration(m_precise_interval) :
+                        Clock::duration(m_interval_ms);
+        }
+
+        // Keep the precise timer thread running while this
+        // timer uses it
+        if(m_precise != m_precise_queue_acquired) {
+            if(m_precise) {
+                PreciseTimerQueue::Get().Acquire();
+            }
+            else {
+                PreciseTimerQueue::Get().Release();
+            }
+            m_precise_queue_acquired = m_precise;
+        }
+
+        if(m_precise) {
+            m_timer->Stop();
+            m_deadline = Clock::now()+m_precise_interval;
+            startPrecise();
+        }
+        else if(m_coalesced) {
+            m_deadline = Clock::now()+m_interval_ms;
+            startCoalesced();
+        }
+        else {
+            m_scheduled = Clock::now()+m_interval_ms;
+            m_timer->Start(m_interval_ms,m_repeating);
+        }
     }
 
     void CallbackTimer::Stop()
     {
         m_active = false;
+        m_generation++;
         m_timer->Stop();
     }
 
+    u64 CallbackTimer::GetMissedTicks() const
+    {
+        std::lock_guard<std::mutex> lock(m_callback_state->mutex);
+        return m_callback_state->stats.missed_ticks;
+    }
+
+    CallbackTimerStats CallbackTimer::GetStats() const
+    {
+        std::lock_guard<std::mutex> lock(m_callback_state->mutex);
+        return m_callback_state->stats;
+    }
+
+    void CallbackTimer::ResetStats()
+    {
+        std::lock_guard<std::mutex> lock(m_callback_state->mutex);
+        m_callback_state->stats = CallbackTimerStats();
+    }
+
     void CallbackTimer::onTimeout()
     {
-        if(m_active) {
-            m_callback();
+        if(!m_active) {
+            return;
+        }
+
+        auto const fire_time = Clock::now();
+        recordFire(fire_time);
+
+        if(m_coalesced) {
+            if(m_repeating) {
+                advanceDeadline(m_interval_ms);
+                startCoalesced();
+            }
+        }
+        else {
+            // ks::Timer schedules repeats from when it fires
+            m_scheduled = fire_time+m_interval_ms;
+        }
+
+        invokeCallback(fire_time);
+    }
+
+    void CallbackTimer::onPreciseTimeout(u64 generation)
+    {
+        // Ignore timeouts posted before the last Start or Stop
+        if(!m_active || generation != m_generation) {
+            return;
+        }
+
+        auto const fire_time = Clock::now();
+        recordFire(fire_time);
+
+        if(m_repeating) {
+            advanceDeadline(m_precise_interval);
+            startPrecise();
+        }
+
+        invokeCallback(fire_time);
+    }
+
+    void CallbackTimer::recordFire(Clock::time_point fire_time)
+    {
+        auto const lateness = std::max(fire_time-m_scheduled,Clock::duration(0));
+
+        std::lock_guard<std::mutex> lock(m_callback_state->mutex);
+        auto &stats = m_callback_state->stats;
+        stats.fire_count++;
+        stats.lateness.list_counts[CallbackTimerStats::Histogram::GetBucket(lateness)]++;
+        stats.max_lateness = std::max<CallbackTimerStats::Nanoseconds>(
+                    stats.max_lateness,lateness);
+    }
+
+    void CallbackTimer::advanceDeadline(Clock::duration interval)
+    {
+        // Coalesced timers may have a 0 interval; precise
+        // intervals are always positive (see SetPreciseInterval)
+        interval = std::max(interval,Clock::duration(1));
+        m_deadline += interval;
+
+        // Skip any deadlines that have already passed
+        auto const now = Clock::now();
+        if(m_deadline <= now) {
+            auto const missed = (now-m_deadline)/interval + 1;
+            m_deadline += interval*missed;
+
+            std::lock_guard<std::mutex> lock(m_callback_state->mutex);
+            m_callback_state->stats.missed_ticks += static_cast<u64>(missed);
+        }
+    }
+
+    void CallbackTimer::invokeCallback(Clock::time_point fire_time)
+    {
+        if(!m_thread_pool) {
+            m_callback_state->Run(fire_time,false);
+            return;
+        }
+
+        shared_ptr<CallbackState> state = m_callback_state;
+
+        if(m_overlap == Overlap::Concurrent) {
+            auto task = m_thread_pool->Submit([state,fire_time](){
+                state->Run(fire_time,true);
+            });
+            if(!task) {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                state->stats.skipped_count++;
+            }
+            return;
+        }
+
+        // Only the event loop thread adds invocations so a task is
+        // only submitted when pending goes from zero to one
+        if(m_overlap == Overlap::Skip) {
+            uint expected = 0;
+            if(!state->pending.compare_exchange_strong(expected,1)) {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                state->stats.skipped_count++;
+                return;
+            }
+        }
+        else if(state->pending.fetch_add(1) > 0) {
+            // The running task will run this invocation too
+            return;
+        }
+
+        auto task = m_thread_pool->Submit([state,fire_time](){
+            bool first = true;
+            do {
+                state->Run(fire_time,first);
+                first = false;
+            }
+            while(state->pending.fetch_sub(1) > 1);
+        });
+
+        if(!task) {
+            // Rejected by the pool
+            std::lock_guard<std::mutex> lock(state->mutex);
+            state->stats.skipped_count += state->pending;
+            state->pending = 0;
+        }
+    }
+
+    void CallbackTimer::CallbackState::Run(Clock::time_point fire_time,
+                                           bool dispatched)
+    {
+        auto const start = Clock::now();
+        {
+            KS_TRACE_SCOPE("CallbackTimer","Timer");
+            callback();
+        }
+        auto const run_time = Clock::now()-start;
+
+        using Histogram = CallbackTimerStats::Histogram;
+        using Nanoseconds = CallbackTimerStats::Nanoseconds;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        stats.run_count++;
+        stats.run_time.list_counts[Histogram::GetBucket(run_time)]++;
+        stats.max_run_time = std::max<Nanoseconds>(stats.max_run_time,run_time);
+        if(run_time > interval) {
+            stats.overrun_count++;
+        }
+
+        if(dispatched) {
+            auto const start_delay = start-fire_time;
+            stats.start_delay.list_counts[Histogram::GetBucket(start_delay)]++;
+            stats.max_start_delay =
+                    std::max<Nanoseconds>(stats.max_start_delay,start_delay);
+        }
+    }
+
+    void CallbackTimer::startCoalesced()
+    {
+        // Align to whole milliseconds of the steady clock so
+        // that every timer uses the same grid
+        auto const deadline = std::chrono::duration_cast<Milliseconds>(
+                    m_deadline.time_since_epoch()+Milliseconds(1)-
+                    Clock::duration(1));
+
+        u64 const expiry_ms =
+                CoalesceDeadline(static_cast<u64>(deadline.count()),
+                                 static_cast<u64>(m_slack_ms.count()));
+
+        Clock::time_point const expiry(
+                    Milliseconds(static_cast<Milliseconds::rep>(expiry_ms)));
+        m_scheduled = expiry;
+
+        auto const now = Clock::now();
+        Milliseconds delay_ms(0);
+        if(expiry > now) {
+            delay_ms = std::chrono::duration_cast<Milliseconds>(expiry-now);
+            if(expiry-now > delay_ms) {
+                delay_ms += Milliseconds(1);
+            }
         }
+
+        m_timer->Start(delay_ms,false);
+    }
+
+    void CallbackTimer::startPrecise()
+    {
+        m_scheduled = m_deadline;
+
+        weak_ptr<EventLoop> weak_evloop = GetEventLoop();
+        weak_ptr<CallbackTimer> weak_callback_timer = m_this_callback_timer;
+        u64 const generation = m_generation;
+
+        PreciseTimerQueue::Get().Add(
+                    m_deadline,
+                    [weak_evloop,weak_callback_timer,generation]() {
+                        auto evloop = weak_evloop.lock();
+                        if(!evloop) {
+                            return;
+                        }
+                        evloop->PostCallback(
+                                    [weak_callback_timer,generation]() {
+                                        auto callback_timer =
+                                                weak_callback_timer.lock();
+                                        if(callback_timer) {
+                                            callback_timer->onPreciseTimeout(
+                                                        generation);
+                                        }
+                                    });
+                    });
     }
 }
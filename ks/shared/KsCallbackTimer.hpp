@@ -17,13 +17,98 @@
 #ifndef KS_CALLBACK_TIMER_HPP
 #define KS_CALLBACK_TIMER_HPP
 
+#include <chrono>
+#include <mutex>
+#include <ks/KsException.hpp>
 #include <ks/KsTimer.hpp>
+#include <ks/shared/KsThreadPool.hpp>
+#include <ks/shared/KsThreadPoolMetrics.hpp>
 
 namespace ks
 {
+    // CoalesceDeadline
+    // * returns the most aligned point in [deadline,deadline+slack],
+    //   ie. the one with the most trailing zero bits
+    // * timers with overlapping windows tend to pick the same
+    //   point so they can be fired together
+    u64 CoalesceDeadline(u64 deadline,u64 slack);
+
+    // ============================================================= //
+
+    // A snapshot of a CallbackTimer's statistics; see
+    // CallbackTimer::GetStats
+    class CallbackTimerStats final
+    {
+    public:
+        using Nanoseconds = std::chrono::nanoseconds;
+        using Histogram = ThreadPoolMetrics::Histogram;
+
+        CallbackTimerStats() :
+            fire_count(0),
+            run_count(0),
+            overrun_count(0),
+            missed_ticks(0),
+            skipped_count(0),
+            max_lateness(0),
+            max_start_delay(0),
+            max_run_time(0)
+        {}
+
+        u64 fire_count;
+        u64 run_count;
+
+        // Callbacks that took longer than the timer's interval
+        u64 overrun_count;
+
+        // Deadlines skipped because they had already passed; only
+        // counted for timers with slack or a precise interval
+        u64 missed_ticks;
+
+        // Invocations dropped by Overlap::Skip or rejected by
+        // the timer's ThreadPool
+        u64 skipped_count;
+
+        // How much later than scheduled the timer fired; this
+        // grows when the event loop is saturated
+        Histogram lateness;
+        Nanoseconds max_lateness;
+
+        // Time from the timer firing to its callback starting on
+        // a ThreadPool worker; this grows when the pool is saturated.
+        // Queued invocations run back to back aren't counted
+        Histogram start_delay;
+        Nanoseconds max_start_delay;
+
+        // How long callbacks took to run
+        Histogram run_time;
+        Nanoseconds max_run_time;
+    };
+
+    // ============================================================= //
+
+    class CallbackTimerInvalidInterval : public ks::Exception
+    {
+    public:
+        CallbackTimerInvalidInterval(std::string msg) :
+            ks::Exception(ks::Exception::ErrorLevel::ERROR,std::move(msg)) {}
+
+        ~CallbackTimerInvalidInterval() = default;
+    };
+
+    // ============================================================= //
+
     class CallbackTimer final : public ks::Object
     {
     public:
+        // What to do when a timer that runs its callback on a
+        // ThreadPool fires while the last callback is still running
+        enum class Overlap : u8
+        {
+            Skip,       // drop the new invocation
+            Queue,      // run it after the last one is done
+            Concurrent  // run it right away on another worker
+        };
+
         CallbackTimer(ks::Object::Key const &key,
                       shared_ptr<EventLoop> const &evloop,
                       Milliseconds interval_ms,
@@ -35,19 +120,134 @@ namespace ks
         ~CallbackTimer();
 
         void SetRepeating(bool repeating);
+
+        // SetInterval
+        // * throws CallbackTimerInvalidInterval if interval_ms
+        //   is negative; 0 fires as soon as possible
         void SetInterval(Milliseconds interval_ms);
+
+        // SetSlack
+        // * lets the timer fire up to slack_ms after each deadline
+        // * deadlines are moved to the most aligned millisecond
+        //   of the steady clock within the slack, so timers on the
+        //   same event loop that allow some slack expire together
+        //   instead of each needing its own wakeup
+        // * repeating timers keep their phase; slack is applied to
+        //   each deadline separately and doesn't accumulate
+        // * takes effect on the next call to Start
+        void SetSlack(Milliseconds slack_ms);
+
+        // SetPreciseInterval
+        // * switches the timer to a high resolution, drift free
+        //   mode with the given interval; SetInterval switches back
+        // * deadlines are fixed to the steady clock phase set by
+        //   Start, ie. start + n*interval, so late callbacks don't
+        //   push later deadlines back
+        // * a shared timer thread waits for each deadline, spinning
+        //   for the last k_precise_spin_us, and then posts the
+        //   callback to the timer's event loop; callbacks are only
+        //   as punctual as the event loop is responsive
+        // * the thread is started by the first precise timer and
+        //   joined once no timers that were started in this mode
+        //   are left
+        // * slack is ignored in this mode
+        // * throws CallbackTimerInvalidInterval if interval isn't
+        //   positive
+        void SetPreciseInterval(std::chrono::nanoseconds interval);
+
+        // SetThreadPool
+        // * runs the callback as a task on thread_pool instead of
+        //   on the event loop thread so that slow callbacks don't
+        //   hold up other events; nullptr switches back
+        // * with Overlap::Skip and Overlap::Queue invocations never
+        //   run at the same time
+        // * the pool must outlive the timer; callbacks that are
+        //   still queued or running when the timer is destroyed
+        //   are run to completion
+        void SetThreadPool(ThreadPool* thread_pool,
+                           Overlap overlap=Overlap::Skip);
+
         void Start();
         void Stop();
 
+        // Number of deadlines skipped because they had already
+        // passed when the timer was rescheduled; only counted for
+        // timers with slack or a precise interval
+        u64 GetMissedTicks() const;
+
+        // GetStats / ResetStats
+        // * GetStats returns the timer's statistics since it was
+        //   created or ResetStats was called; see CallbackTimerStats
+        // * both may be called from any thread
+        CallbackTimerStats GetStats() const;
+        void ResetStats();
+
+        static std::chrono::microseconds const k_precise_spin_us;
+
     private:
+        using Clock = std::chrono::steady_clock;
+
         void onTimeout();
+        void onPreciseTimeout(u64 generation);
+        void recordFire(Clock::time_point fire_time);
+        void advanceDeadline(Clock::duration interval);
+        void invokeCallback(Clock::time_point fire_time);
+        void startCoalesced();
+        void startPrecise();
 
         shared_ptr<Timer> const m_timer;
 
         bool m_active;
         Milliseconds m_interval_ms;
+        Milliseconds m_slack_ms;
         bool m_repeating;
-        std::function<void()> m_callback;
+
+        // Timers with slack or a precise interval are
+        // restarted for each deadline
+        bool m_coalesced;
+        bool m_precise;
+        std::chrono::nanoseconds m_precise_interval;
+
+        // Whether this timer keeps the precise timer thread
+        // running; set by Start in precise mode
+        bool m_precise_queue_acquired;
+        Clock::time_point m_deadline;
+
+        // When the timer is expected to fire next
+        Clock::time_point m_scheduled;
+
+        // Incremented by Start and Stop so that precise
+        // timeouts that were already posted are ignored
+        u64 m_generation;
+
+        weak_ptr<CallbackTimer> m_this_callback_timer;
+
+        // Shared with the tasks that run the callback on a pool
+        struct CallbackState
+        {
+            CallbackState(std::function<void()> callback) :
+                callback(std::move(callback)),
+                pending(0),
+                interval(0)
+            {}
+
+            // Runs the callback and records how long it took
+            void Run(Clock::time_point fire_time,bool dispatched);
+
+            std::function<void()> const callback;
+
+            // Invocations that were dispatched and haven't finished
+            std::atomic<uint> pending;
+
+            // Guards interval and stats
+            mutable std::mutex mutex;
+            Clock::duration interval;
+            CallbackTimerStats stats;
+        };
+
+        shared_ptr<CallbackState> const m_callback_state;
+        ThreadPool* m_thread_pool;
+        Overlap m_overlap;
     };
 }
 
@@ -18,6 +18,7 @@
 
 #include <ks/shared/KsDynamicProperty.hpp>
 #include <ks/KsLog.hpp>
+#include <ks/shared/KsTraceRecorder.hpp>
 
 namespace ks
 {
@@ -120,6 +121,7 @@ namespace ks
     DynamicPropertyBase::DynamicPropertyBase(std::string name) :
         m_name(name),
         m_capture_failed(false),
+        m_trace_name(nullptr),
         m_vx_state(false)
     {
         m_list_inputs.reserve(8);
@@ -224,7 +226,13 @@ namespace ks
             it != list_rev_sorted_props.rend(); ++it)
         {
             DynamicPropertyBase* prop = (*it);
-            prop->evaluate();
+            if(TraceRecorder::IsEnabled()) {
+                KS_TRACE_SCOPE(prop->getTraceName(),"DynamicProperty");
+                prop->evaluate();
+            }
+            else {
+                prop->evaluate();
+            }
             prop->m_vx_state = 0; // reset state
         }
 
@@ -305,6 +313,15 @@ namespace ks
         }
     }
 
+    char const * DynamicPropertyBase::getTraceName()
+    {
+        if(!m_trace_name) {
+            m_trace_name = m_name.empty() ?
+                        "DynamicProperty" : TraceRecorder::Intern(m_name);
+        }
+        return m_trace_name;
+    }
+
     // ============================================================= //
     // ============================================================= //
 }
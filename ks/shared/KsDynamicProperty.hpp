@@ -60,8 +60,13 @@ namespace ks
         std::string m_name;
         bool m_capture_failed;
 
+        // Interned copy of m_name used for trace events; set
+        // the first time it's needed and reset by SetName
+        char const * m_trace_name;
+
     private:
         void registerInput(DynamicPropertyBase* input_prop);
+        char const * getTraceName();
         virtual void resetBinding() = 0;
 
         std::vector<DynamicPropertyBase*> m_list_inputs;
@@ -183,6 +188,7 @@ namespace ks
         void SetName(std::string name)
         {
             m_name = std::move(name);
+            m_trace_name = nullptr;
         }
 
         void SetNotifier(NotifierFn notifier)
@@ -52,7 +52,7 @@ namespace ks
             return m_null_node;
         }
 
-        std::vector<Node> const & GetSparseNodeList()
+        std::vector<Node> const & GetSparseNodeList() const
         {
             return m_list_nodes.GetList();
         }
@@ -4,6 +4,8 @@
 // lodepng
 #include <lodepng/lodepng.h>
 
+#include <ks/shared/KsTraceRecorder.hpp>
+
 namespace ks
 {
     // ============================================================= //
@@ -324,7 +326,11 @@ namespace ks
         // Decode the png
         unsigned width,height;
         std::vector<u8> list_bytes;
-        unsigned error = lodepng::decode(list_bytes,width,height,state,png_data);
+        unsigned error;
+        {
+            KS_TRACE_SCOPE("LoadPNG","Image");
+            error = lodepng::decode(list_bytes,width,height,state,png_data);
+        }
 
         if(error) {
             LOG.Error() << " Image: Failed to load png "
@@ -0,0 +1,236 @@
+/*
+   Copyright (C) 2015 Preet Desai (preet.desai@gmail.com)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef KS_PARALLEL_FOR_HPP
+#define KS_PARALLEL_FOR_HPP
+
+#include <vector>
+#include <algorithm>
+#include <chrono>
+
+#include <ks/KsGlobal.hpp>
+#include <ks/shared/KsThreadPool.hpp>
+
+namespace ks
+{
+    // ============================================================= //
+
+    namespace parallel_detail
+    {
+        using Clock = std::chrono::steady_clock;
+
+        // Approximate run time to aim for per chunk when
+        // the grain size is picked automatically
+        inline std::chrono::nanoseconds GetTargetChunkTime()
+        {
+            return std::chrono::microseconds(50);
+        }
+
+        // Minimum run time of a probe used to measure
+        // the cost per item
+        inline std::chrono::nanoseconds GetMinProbeTime()
+        {
+            return std::chrono::microseconds(10);
+        }
+
+        template<typename IndexT,typename Fn>
+        struct ForState
+        {
+            ThreadPool* thread_pool;
+            IndexT grain;
+            Fn* fn;
+            std::atomic<IndexT> remaining;
+        };
+
+        // Splits off the right half of the range as a new task
+        // until the range is no larger than the grain size, then
+        // runs what's left. Each task does the same, so the range
+        // is divided recursively across whichever threads pick
+        // the tasks up.
+        template<typename IndexT,typename Fn>
+        void RunRange(ForState<IndexT,Fn>* state,IndexT begin,IndexT end)
+        {
+            while(end-begin > state->grain) {
+                IndexT const mid = begin + (end-begin)/2;
+
+                auto task = state->thread_pool->Submit(
+                            [state,mid,end](){
+                                RunRange(state,mid,end);
+                            });
+
+                if(!task) {
+                    // The pool rejected the task; run
+                    // the remaining range on this thread
+                    break;
+                }
+
+                end = mid;
+            }
+
+            (*(state->fn))(begin,end);
+
+            // state may be destroyed once remaining reaches
+            // zero so it must not be accessed after this
+            state->remaining -= (end-begin);
+        }
+
+        // Runs increasingly large chunks from the start of the
+        // range on the calling thread until a chunk takes long
+        // enough to time reliably, then derives the grain size
+        // from the measured cost per item. begin is advanced
+        // past the items that were processed.
+        template<typename IndexT,typename Fn>
+        IndexT ProbeGrain(ThreadPool &thread_pool,
+                          IndexT &begin,
+                          IndexT const end,
+                          Fn &fn)
+        {
+            IndexT grain = 1;
+            IndexT probe_count = 1;
+
+            while(begin < end) {
+                IndexT const count = std::min<IndexT>(probe_count,end-begin);
+
+                auto const start = Clock::now();
+                fn(begin,begin+count);
+                auto const elapsed = Clock::now()-start;
+                begin += count;
+
+                if(elapsed >= GetMinProbeTime()) {
+                    double const ns_per_item =
+                            std::chrono::duration<double,std::nano>(
+                                elapsed).count()/count;
+
+                    double const target_ns =
+                            std::chrono::duration<double,std::nano>(
+                                GetTargetChunkTime()).count();
+
+                    grain = static_cast<IndexT>(
+                                std::max(1.0,target_ns/ns_per_item));
+                    break;
+                }
+
+                probe_count *= 2;
+                grain = probe_count;
+            }
+
+            // Keep enough chunks around for every
+            // thread (and the caller) to take part
+            IndexT const max_grain = std::max<IndexT>(
+                        1,(end-begin)/(4*(thread_pool.GetThreadCount()+1)));
+
+            return std::max<IndexT>(1,std::min(grain,max_grain));
+        }
+    }
+
+    // ============================================================= //
+
+    // ParallelFor
+    // * calls fn(range_begin,range_end) for consecutive,
+    //   non-overlapping sub ranges of [begin,end)
+    // * grain is the maximum number of items passed to a single
+    //   call of fn. If grain is 0, it is picked by timing the first
+    //   few items so that each call takes roughly 50us
+    // * the calling thread processes tasks from the pool until
+    //   the whole range is done, so it's safe to call from
+    //   within a task running on the same pool
+    template<typename IndexT,typename Fn>
+    void ParallelFor(ThreadPool &thread_pool,
+                     IndexT begin,
+                     IndexT end,
+                     IndexT grain,
+                     Fn fn)
+    {
+        static_assert(std::is_integral<IndexT>::value,
+                      "ERROR: ks: ParallelFor: "
+                      "IndexT must be an integral type");
+
+        if(!(begin < end)) {
+            return;
+        }
+
+        if(grain == 0) {
+            grain = parallel_detail::ProbeGrain(thread_pool,begin,end,fn);
+            if(!(begin < end)) {
+                return;
+            }
+        }
+
+        parallel_detail::ForState<IndexT,Fn> state;
+        state.thread_pool = &thread_pool;
+        state.grain = grain;
+        state.fn = &fn;
+        state.remaining = end-begin;
+
+        parallel_detail::RunRange(&state,begin,end);
+
+        // Help out until all of the range has been processed
+        while(state.remaining > 0) {
+            if(thread_pool.ProcessTask() == 0) {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    // ============================================================= //
+
+    // ParallelReduce
+    // * calls map_fn(range_begin,range_end) for sub ranges of
+    //   [begin,end) as in ParallelFor; each call returns a partial
+    //   result of type T
+    // * the partial results are combined with reduce_fn(T,T) in
+    //   order of their ranges, starting with identity, so reduce_fn
+    //   needs to be associative but not commutative
+    template<typename T,typename IndexT,typename MapFn,typename ReduceFn>
+    T ParallelReduce(ThreadPool &thread_pool,
+                     IndexT begin,
+                     IndexT end,
+                     IndexT grain,
+                     T identity,
+                     MapFn map_fn,
+                     ReduceFn reduce_fn)
+    {
+        std::mutex mutex;
+        std::vector<std::pair<IndexT,T>> list_partials;
+
+        ParallelFor(thread_pool,begin,end,grain,
+                    [&](IndexT range_begin,IndexT range_end) {
+                        T partial = map_fn(range_begin,range_end);
+
+                        std::lock_guard<std::mutex> lock(mutex);
+                        list_partials.emplace_back(
+                                    range_begin,std::move(partial));
+                    });
+
+        std::sort(list_partials.begin(),
+                  list_partials.end(),
+                  [](std::pair<IndexT,T> const &a,
+                     std::pair<IndexT,T> const &b) {
+                        return (a.first < b.first);
+                    });
+
+        T result = std::move(identity);
+        for(auto &partial : list_partials) {
+            result = reduce_fn(std::move(result),std::move(partial.second));
+        }
+
+        return result;
+    }
+
+    // ============================================================= //
+}
+
+#endif // KS_PARALLEL_FOR_HPP
@@ -0,0 +1,284 @@
+/*
+   Copyright (C) 2015 Preet Desai (preet.desai@gmail.com)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <ks/shared/KsTaskGraph.hpp>
+#include <ks/KsLog.hpp>
+
+#include <limits>
+
+namespace ks
+{
+    // ============================================================= //
+
+    // Queued in place of a node's task so that the graph
+    // can dispatch the node's outputs once it's done
+    class TaskGraph::NodeTask final : public ThreadPool::Task
+    {
+    public:
+        NodeTask(TaskGraph* graph,uint index) :
+            m_graph(graph),
+            m_index(index)
+        {}
+
+        void Cancel()
+        {
+            onCanceled();
+        }
+
+        // Runs the node on the calling thread, for
+        // nodes the thread pool rejected
+        void RunInline()
+        {
+            process();
+        }
+
+    private:
+        void process()
+        {
+            onStarted();
+            m_graph->runNode(m_index);
+            onFinished();
+            onEnded();
+        }
+
+        TaskGraph* const m_graph;
+        uint const m_index;
+    };
+
+    // ============================================================= //
+
+    TaskGraph::TaskGraph() :
+        m_prepared(false),
+        m_thread_pool(nullptr),
+        m_remaining(0),
+        m_running(false)
+    {
+        // empty
+    }
+
+    TaskGraph::TaskGraph(Graph<shared_ptr<Task>> const &graph) :
+        TaskGraph()
+    {
+        auto const &list_graph_nodes = graph.GetSparseNodeList();
+
+        // Map the sparse graph indices to task indices
+        uint const k_invalid = std::numeric_limits<uint>::max();
+        std::vector<uint> list_task_index(list_graph_nodes.size(),k_invalid);
+
+        for(uint i=0; i < list_graph_nodes.size(); i++) {
+            if(list_graph_nodes[i].valid) {
+                list_task_index[i] = AddTask(list_graph_nodes[i].value);
+            }
+        }
+
+        for(uint i=0; i < list_graph_nodes.size(); i++) {
+            if(list_graph_nodes[i].valid) {
+                for(auto output : list_graph_nodes[i].outputs) {
+                    AddDependency(list_task_index[i],
+                                  list_task_index[output]);
+                }
+            }
+        }
+    }
+
+    TaskGraph::~TaskGraph()
+    {
+        // Queued node tasks refer to this graph
+        this->Wait();
+    }
+
+    uint TaskGraph::AddTask(shared_ptr<Task> task)
+    {
+        m_prepared = false;
+        m_list_nodes.push_back(Node{std::move(task),nullptr,{},0});
+        return (m_list_nodes.size()-1);
+    }
+
+    void TaskGraph::AddDependency(uint before,uint after)
+    {
+        m_prepared = false;
+        m_list_nodes[before].outputs.push_back(after);
+        m_list_nodes[after].input_count++;
+    }
+
+    uint TaskGraph::GetTaskCount() const
+    {
+        return m_list_nodes.size();
+    }
+
+    bool TaskGraph::Run(ThreadPool &thread_pool)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if(m_running) {
+                LOG.Warn() << "TaskGraph: Run called while running";
+                return false;
+            }
+        }
+
+        if(!m_prepared) {
+            prepare();
+        }
+
+        if(m_list_nodes.empty()) {
+            return true;
+        }
+
+        // Tasks are reused on every run, so clear their state
+        // from the previous run. Node tasks are made fresh since
+        // a worker may still be ending one from the previous run
+        // after the graph has finished
+        std::vector<shared_ptr<Task>> list_roots;
+        std::vector<uint> list_root_indices;
+        for(uint i=0; i < m_list_nodes.size(); i++) {
+            m_list_nodes[i].task->reset();
+            m_list_nodes[i].node_task = ThreadPool::MakeTask<NodeTask>(this,i);
+            m_list_pending[i] = m_list_nodes[i].input_count;
+            if(m_list_nodes[i].input_count == 0) {
+                list_roots.push_back(m_list_nodes[i].node_task);
+                list_root_indices.push_back(i);
+            }
+        }
+
+        m_thread_pool = &thread_pool;
+        m_remaining = m_list_nodes.size();
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_running = true;
+        }
+
+        // With OverflowPolicy::Reject only a prefix of the roots
+        // may be queued. Every node has to run for the graph to
+        // finish, so run the rest on this thread
+        uint const queued_count = thread_pool.PushBatch(list_roots);
+        for(uint i=queued_count; i < list_root_indices.size(); i++) {
+            m_list_nodes[list_root_indices[i]].node_task->RunInline();
+        }
+
+        return true;
+    }
+
+    bool TaskGraph::IsFinished() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return !m_running;
+    }
+
+    TaskGraph::WaitStatus TaskGraph::Wait()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_wait_cond.wait(lock,[this](){ return !m_running; });
+        return WaitStatus::Done;
+    }
+
+    TaskGraph::WaitStatus TaskGraph::WaitFor(Milliseconds wait_ms)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if(m_wait_cond.wait_for(lock,wait_ms,[this](){ return !m_running; })) {
+            return WaitStatus::Done;
+        }
+
+        return WaitStatus::Timeout;
+    }
+
+    void TaskGraph::prepare()
+    {
+        // Check that every task can run with Kahn's
+        // algorithm; any tasks left over are in a cycle
+        std::vector<uint> list_input_count(m_list_nodes.size());
+        std::vector<uint> list_ready;
+
+        for(uint i=0; i < m_list_nodes.size(); i++) {
+            list_input_count[i] = m_list_nodes[i].input_count;
+            if(list_input_count[i] == 0) {
+                list_ready.push_back(i);
+            }
+        }
+
+        uint visit_count=0;
+        while(!list_ready.empty()) {
+            uint const index = list_ready.back();
+            list_ready.pop_back();
+            visit_count++;
+
+            for(auto output : m_list_nodes[index].outputs) {
+                list_input_count[output]--;
+                if(list_input_count[output] == 0) {
+                    list_ready.push_back(output);
+                }
+            }
+        }
+
+        if(visit_count != m_list_nodes.size()) {
+            throw TaskGraphCycleDetected(
+                        "TaskGraph: graph contains a cycle");
+        }
+
+        m_list_pending.reset(new std::atomic<uint>[m_list_nodes.size()]);
+
+        m_prepared = true;
+    }
+
+    void TaskGraph::runNode(uint index)
+    {
+        uint const k_invalid = std::numeric_limits<uint>::max();
+
+        // Ready nodes the thread pool rejected, which
+        // are run on this thread instead
+        std::vector<uint> list_rejected;
+
+        while(index != k_invalid)
+        {
+            Node const &node = m_list_nodes[index];
+            node.task->process();
+
+            // Run the first output that becomes ready on this
+            // thread and queue the others
+            uint next_index = k_invalid;
+            for(auto output : node.outputs) {
+                if(m_list_pending[output].fetch_sub(1) == 1) {
+                    if(next_index == k_invalid) {
+                        next_index = output;
+                    }
+                    else if(!m_thread_pool->PushBack(
+                                m_list_nodes[output].node_task))
+                    {
+                        list_rejected.push_back(output);
+                    }
+                }
+            }
+
+            if(next_index == k_invalid && !list_rejected.empty()) {
+                next_index = list_rejected.back();
+                list_rejected.pop_back();
+            }
+
+            if(m_remaining.fetch_sub(1) == 1) {
+                // This was the last task. The graph may be destroyed
+                // as soon as m_running is cleared, so notify while
+                // holding the lock and don't touch it afterwards
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_running = false;
+                m_wait_cond.notify_all();
+                return;
+            }
+
+            index = next_index;
+        }
+    }
+
+    // ============================================================= //
+}
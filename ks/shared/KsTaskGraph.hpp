@@ -0,0 +1,125 @@
+/*
+   Copyright (C) 2015 Preet Desai (preet.desai@gmail.com)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef KS_TASK_GRAPH_HPP
+#define KS_TASK_GRAPH_HPP
+
+#include <vector>
+
+#include <ks/KsGlobal.hpp>
+#include <ks/KsException.hpp>
+#include <ks/shared/KsGraph.hpp>
+#include <ks/shared/KsThreadPool.hpp>
+
+namespace ks
+{
+    // ============================================================= //
+
+    class TaskGraphCycleDetected : public ks::Exception
+    {
+    public:
+        TaskGraphCycleDetected(std::string msg) :
+            ks::Exception(ks::Exception::ErrorLevel::ERROR,std::move(msg)) {}
+
+        ~TaskGraphCycleDetected() = default;
+    };
+
+    // ============================================================= //
+
+    // TaskGraph
+    // * runs a DAG of tasks on a ThreadPool. Each task is queued
+    //   as soon as all of its inputs have finished, which is
+    //   tracked with an atomic counter of pending inputs per task
+    // * when a finished task makes more than one task ready, one
+    //   of them is run directly on the same thread and the rest
+    //   are queued
+    // * a graph can be run again once the previous run has
+    //   finished if its tasks support being processed more
+    //   than once
+    class TaskGraph final
+    {
+    public:
+        using Task = ThreadPool::Task;
+        using WaitStatus = ThreadPool::Task::WaitStatus;
+
+        TaskGraph();
+
+        // Copies the valid nodes and edges of graph. Edges go
+        // from a task to the tasks that depend on it
+        TaskGraph(Graph<shared_ptr<Task>> const &graph);
+
+        // Waits for any run in progress to finish
+        ~TaskGraph();
+
+        // No copying or moving allowed
+        TaskGraph(TaskGraph const &) = delete;
+        TaskGraph& operator=(TaskGraph const &) = delete;
+
+        TaskGraph(TaskGraph&&) = delete;
+        TaskGraph& operator=(TaskGraph&&) = delete;
+
+        // AddTask / AddDependency
+        // * AddTask returns the index used to refer to the task
+        // * task 'after' will only run once task 'before' is done
+        // * must not be called while the graph is running
+        uint AddTask(shared_ptr<Task> task);
+        void AddDependency(uint before,uint after);
+
+        uint GetTaskCount() const;
+
+        // Run
+        // * queues all tasks without inputs and returns
+        // * returns false if the graph is already running
+        // * throws TaskGraphCycleDetected if the tasks
+        //   can't all be run because of a cycle
+        bool Run(ThreadPool &thread_pool);
+
+        bool IsFinished() const;
+
+        // Wait for the current run to finish
+        WaitStatus Wait();
+        WaitStatus WaitFor(Milliseconds wait_ms);
+
+    private:
+        class NodeTask;
+
+        struct Node
+        {
+            shared_ptr<Task> task;
+            shared_ptr<NodeTask> node_task;
+            std::vector<uint> outputs;
+            uint input_count;
+        };
+
+        void prepare();
+        void runNode(uint index);
+
+        std::vector<Node> m_list_nodes;
+        unique_ptr<std::atomic<uint>[]> m_list_pending;
+        bool m_prepared;
+
+        ThreadPool* m_thread_pool;
+        std::atomic<uint> m_remaining;
+
+        mutable std::mutex m_mutex;
+        std::condition_variable m_wait_cond;
+        bool m_running;
+    };
+
+    // ============================================================= //
+}
+
+#endif // KS_TASK_GRAPH_HPP
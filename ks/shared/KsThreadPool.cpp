@@ -16,6 +16,16 @@
 
 #include <ks/shared/KsThreadPool.hpp>
 #include <ks/KsLog.hpp>
+#include <ks/shared/KsTraceRecorder.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#if defined(__linux__)
+#include <sched.h>
+#include <pthread.h>
+#endif
 
 namespace ks
 {
@@ -26,7 +36,14 @@ namespace ks
         m_running(false),
         m_canceled(false),
         m_finished(false),
-        m_future(m_promise.get_future())
+        m_ended(false),
+        m_tag(0),
+        m_queued(false),
+        m_tag_pool(nullptr),
+        m_tag_prev(nullptr),
+        m_tag_next(nullptr),
+        m_pending_count(0),
+        m_name("ThreadPool::Task")
     {
         // empty
     }
@@ -56,23 +73,38 @@ namespace ks
         return m_finished;
     }
 
+    void ThreadPool::Task::SetTag(u64 tag)
+    {
+        m_tag = tag;
+    }
+
+    u64 ThreadPool::Task::GetTag() const
+    {
+        return m_tag;
+    }
+
+    void ThreadPool::Task::SetName(char const * name)
+    {
+        m_name = name;
+    }
+
+    char const * ThreadPool::Task::GetName() const
+    {
+        return m_name;
+    }
+
     ThreadPool::Task::WaitStatus ThreadPool::Task::Wait()
     {
-        // We assume that m_future is valid since we set
-        // it during construction and never call get() on it
-        m_future.wait();
+        std::unique_lock<std::mutex> lock(m_wait_mutex);
+        m_wait_cond.wait(lock,[this](){ return m_ended; });
         return WaitStatus::Done;
     }
 
     ThreadPool::Task::WaitStatus
     ThreadPool::Task::WaitFor(Milliseconds wait_ms)
     {
-        // We assume that m_future is valid since we set
-        // it during construction and never call get() on it
-
-        auto fs = m_future.wait_for(wait_ms);
-
-        if(fs == std::future_status::ready) {
+        std::unique_lock<std::mutex> lock(m_wait_mutex);
+        if(m_wait_cond.wait_for(lock,wait_ms,[this](){ return m_ended; })) {
             return WaitStatus::Done;
         }
 
@@ -97,154 +129,1941 @@ namespace ks
 
     void ThreadPool::Task::onEnded()
     {
+        std::vector<Continuation> list_continuations;
+        end(list_continuations);
+        releaseContinuations(list_continuations);
+    }
+
+    void ThreadPool::Task::drop()
+    {
+        onCanceled();
+        onEnded();
+    }
+
+    void ThreadPool::Task::reset()
+    {
+        // Make sure the task isn't still linked in a tag
+        // list before it's pushed again
+        untrack();
+
+        m_started = false;
+        m_running = false;
+        m_canceled = false;
+        m_finished = false;
+        {
+            std::lock_guard<std::mutex> lock(m_wait_mutex);
+            m_ended = false;
+        }
+    }
+
+    void ThreadPool::Task::end(std::vector<Continuation> &list_continuations)
+    {
+        // Unlink before m_ended is set so the task can be
+        // pushed again as soon as a waiting thread sees it end
+        untrack();
+
         m_running = false;
-        m_promise.set_value();
+        {
+            std::lock_guard<std::mutex> lock(m_wait_mutex);
+            m_ended = true;
+            for(auto &continuation : m_list_continuations) {
+                list_continuations.push_back(std::move(continuation));
+            }
+            m_list_continuations.clear();
+        }
+        m_wait_cond.notify_all();
+    }
+
+    void ThreadPool::Task::untrack()
+    {
+        ThreadPool* tag_pool = m_tag_pool;
+        if(tag_pool) {
+            tag_pool->untrackTask(this);
+        }
+    }
+
+    void ThreadPool::Task::releaseContinuations(
+            std::vector<Continuation> &list_continuations)
+    {
+        for(auto &continuation : list_continuations) {
+            continuation.pool->releaseContinuation(continuation.task);
+        }
+    }
+
+    // ============================================================= //
+
+    namespace
+    {
+        // Identifies the pool and queue index of the
+        // worker running on the current thread, if any
+        thread_local ThreadPool const * tl_worker_pool = nullptr;
+        thread_local uint tl_worker_index = 0;
+
+        // Times a worker yields when tasks are counted but
+        // none could be taken, and how long it then waits
+        // before looking again
+        uint const k_take_retry_count = 64;
+        std::chrono::microseconds const k_take_backoff(100);
+
+        // Hint to the CPU that the calling thread is spinning
+        inline void CpuRelax()
+        {
+#if defined(__i386__) || defined(__x86_64__)
+            __builtin_ia32_pause();
+#elif defined(__arm__) || defined(__aarch64__)
+            __asm__ __volatile__("yield");
+#endif
+        }
+
+        // Parses a sysfs cpu list such as "0-3,8-11"
+        std::vector<uint> ParseCpuList(std::string const &cpulist)
+        {
+            std::vector<uint> list_cpus;
+            std::istringstream stream(cpulist);
+            std::string range;
+            while(std::getline(stream,range,',')) {
+                uint first=0;
+                uint last=0;
+                char dash=0;
+                std::istringstream range_stream(range);
+                if(!(range_stream >> first)) {
+                    continue;
+                }
+                last = first;
+                if(range_stream >> dash >> last) {
+                    if(dash != '-' || last < first) {
+                        continue;
+                    }
+                }
+                for(uint cpu=first; cpu <= last; cpu++) {
+                    list_cpus.push_back(cpu);
+                }
+            }
+            return list_cpus;
+        }
+
+        // Returns the cpus the process may run on grouped by
+        // NUMA node. Platforms without NUMA information report
+        // a single node
+        std::vector<std::vector<uint>> GetNodeCpuLists()
+        {
+            std::vector<std::vector<uint>> list_node_cpus;
+
+#if defined(__linux__)
+            cpu_set_t available;
+            CPU_ZERO(&available);
+            if(sched_getaffinity(0,sizeof(available),&available) != 0) {
+                return list_node_cpus;
+            }
+
+            // Node ids can have gaps, so check a fixed range
+            uint const k_max_node_count = 64;
+            for(uint node=0; node < k_max_node_count; node++) {
+                std::ifstream file("/sys/devices/system/node/node"+
+                                   std::to_string(node)+"/cpulist");
+                std::string cpulist;
+                if(!file || !std::getline(file,cpulist)) {
+                    continue;
+                }
+
+                std::vector<uint> list_cpus;
+                for(uint cpu : ParseCpuList(cpulist)) {
+                    if(cpu < CPU_SETSIZE && CPU_ISSET(cpu,&available)) {
+                        list_cpus.push_back(cpu);
+                    }
+                }
+                if(!list_cpus.empty()) {
+                    list_node_cpus.push_back(std::move(list_cpus));
+                }
+            }
+
+            if(list_node_cpus.empty()) {
+                std::vector<uint> list_cpus;
+                for(uint cpu=0; cpu < CPU_SETSIZE; cpu++) {
+                    if(CPU_ISSET(cpu,&available)) {
+                        list_cpus.push_back(cpu);
+                    }
+                }
+                if(!list_cpus.empty()) {
+                    list_node_cpus.push_back(std::move(list_cpus));
+                }
+            }
+#endif
+            return list_node_cpus;
+        }
+
+        ThreadPool::Options MakeOptions(ThreadPool::Scheduling scheduling)
+        {
+            ThreadPool::Options options;
+            options.scheduling = scheduling;
+            return options;
+        }
+
+        // ============================================================= //
+
+        // Task slots used by ThreadPool::TaskAllocator. Slots come
+        // in a few size classes so that tasks with larger captures
+        // are recycled too. Each thread keeps a free list of slots
+        // per class and exchanges batches of slots with a shared
+        // list so that slots freed on worker threads make their
+        // way back to submitting threads.
+        size_t const k_list_task_slot_sizes[] = { 256, 512, 1024 };
+        uint const k_task_slot_class_count = 3;
+        uint const k_task_slot_batch_size = 32;
+
+        // Returns k_task_slot_class_count if size is too
+        // large for any class
+        uint GetTaskSlotClass(size_t size)
+        {
+            uint slot_class=0;
+            while(slot_class < k_task_slot_class_count &&
+                  size > k_list_task_slot_sizes[slot_class]) {
+                slot_class++;
+            }
+            return slot_class;
+        }
+
+        struct TaskSlot
+        {
+            TaskSlot* next;
+        };
+
+        class TaskSlotList
+        {
+        public:
+            TaskSlotList() :
+                m_head(nullptr),
+                m_count(0)
+            {}
+
+            void Push(TaskSlot* slot)
+            {
+                slot->next = m_head;
+                m_head = slot;
+                m_count++;
+            }
+
+            TaskSlot* Pop()
+            {
+                TaskSlot* slot = m_head;
+                m_head = slot->next;
+                m_count--;
+                return slot;
+            }
+
+            // Moves up to count slots from this list to other
+            void Transfer(TaskSlotList &other,uint count)
+            {
+                while(m_head && count > 0) {
+                    other.Push(Pop());
+                    count--;
+                }
+            }
+
+            bool IsEmpty() const
+            {
+                return (m_head == nullptr);
+            }
+
+            uint GetCount() const
+            {
+                return m_count;
+            }
+
+        private:
+            TaskSlot* m_head;
+            uint m_count;
+        };
+
+        class SharedTaskSlotList
+        {
+        public:
+            ~SharedTaskSlotList()
+            {
+                for(auto &list_slots : m_list_slots) {
+                    while(!list_slots.IsEmpty()) {
+                        ::operator delete(list_slots.Pop());
+                    }
+                }
+            }
+
+            void Acquire(uint slot_class,TaskSlotList &list_slots)
+            {
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_list_slots[slot_class].Transfer(
+                                list_slots,k_task_slot_batch_size);
+                }
+
+                if(list_slots.IsEmpty()) {
+                    size_t const slot_size = k_list_task_slot_sizes[slot_class];
+                    for(uint i=0; i < k_task_slot_batch_size; i++) {
+                        list_slots.Push(static_cast<TaskSlot*>(
+                                            ::operator new(slot_size)));
+                    }
+                }
+            }
+
+            void Release(uint slot_class,TaskSlotList &list_slots,uint count)
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                list_slots.Transfer(m_list_slots[slot_class],count);
+            }
+
+        private:
+            std::mutex m_mutex;
+            TaskSlotList m_list_slots[k_task_slot_class_count];
+        };
+
+        SharedTaskSlotList& GetSharedTaskSlotList()
+        {
+            static SharedTaskSlotList shared_list_slots;
+            return shared_list_slots;
+        }
+
+        class LocalTaskSlotList
+        {
+        public:
+            LocalTaskSlotList() :
+                m_shared_list_slots(GetSharedTaskSlotList())
+            {}
+
+            ~LocalTaskSlotList()
+            {
+                // Return all slots when the thread exits
+                for(uint i=0; i < k_task_slot_class_count; i++) {
+                    m_shared_list_slots.Release(i,m_list_slots[i],
+                                                m_list_slots[i].GetCount());
+                }
+            }
+
+            void* Allocate(uint slot_class)
+            {
+                auto &list_slots = m_list_slots[slot_class];
+                if(list_slots.IsEmpty()) {
+                    m_shared_list_slots.Acquire(slot_class,list_slots);
+                }
+                return list_slots.Pop();
+            }
+
+            void Deallocate(uint slot_class,void* ptr)
+            {
+                auto &list_slots = m_list_slots[slot_class];
+                list_slots.Push(static_cast<TaskSlot*>(ptr));
+                if(list_slots.GetCount() > 2*k_task_slot_batch_size) {
+                    m_shared_list_slots.Release(slot_class,list_slots,
+                                                k_task_slot_batch_size);
+                }
+            }
+
+        private:
+            SharedTaskSlotList &m_shared_list_slots;
+            TaskSlotList m_list_slots[k_task_slot_class_count];
+        };
+
+        thread_local LocalTaskSlotList tl_list_task_slots;
     }
 
     // ============================================================= //
 
-    ThreadPool::ThreadPool(uint thread_count) :
+#if !defined(KS_THREAD_POOL_NO_METRICS)
+    // Counters are only written with relaxed atomic adds. Each
+    // worker has its own counters and threads that aren't workers
+    // share the last entry
+    struct ThreadPool::MetricsRecorder
+    {
+        using Histogram = ThreadPoolMetrics::Histogram;
+
+        struct Worker
+        {
+            std::atomic<u64> task_count;
+            std::atomic<u64> busy_ns;
+            std::atomic<u64> idle_ns;
+            std::atomic<u64> steal_count;
+            std::atomic<u64> contention_count;
+            std::atomic<u64> list_queue_wait[Histogram::k_bucket_count];
+            std::atomic<u64> list_run_time[Histogram::k_bucket_count];
+        };
+
+        MetricsRecorder(uint worker_count) :
+            worker_count(worker_count),
+            list_workers(new Worker[worker_count])
+        {
+            Reset();
+        }
+
+        void Reset()
+        {
+            start_ns = Clock::now().time_since_epoch().count();
+
+            for(uint i=0; i < worker_count; i++) {
+                auto &worker = list_workers[i];
+                worker.task_count = 0;
+                worker.busy_ns = 0;
+                worker.idle_ns = 0;
+                worker.steal_count = 0;
+                worker.contention_count = 0;
+                for(uint j=0; j < Histogram::k_bucket_count; j++) {
+                    worker.list_queue_wait[j] = 0;
+                    worker.list_run_time[j] = 0;
+                }
+            }
+        }
+
+        // Counters of the calling thread
+        Worker& GetWorker(ThreadPool const * thread_pool)
+        {
+            return list_workers[(tl_worker_pool == thread_pool) ?
+                                tl_worker_index : (worker_count-1)];
+        }
+
+        static void Add(std::atomic<u64> &counter,u64 value)
+        {
+            counter.fetch_add(value,std::memory_order_relaxed);
+        }
+
+        static u64 Get(std::atomic<u64> const &counter)
+        {
+            return counter.load(std::memory_order_relaxed);
+        }
+
+        std::atomic<Clock::rep> start_ns;
+        uint const worker_count;
+        unique_ptr<Worker[]> list_workers;
+    };
+#endif
+
+    // ============================================================= //
+
+    ThreadPool::ThreadPool(uint thread_count,
+                           Scheduling scheduling) :
+        ThreadPool(thread_count,MakeOptions(scheduling))
+    {
+        // empty
+    }
+
+    ThreadPool::ThreadPool(uint thread_count,
+                           Options const &options) :
         m_thread_count(thread_count),
-        m_running(false)
+        m_options(options),
+        m_scheduling(options.scheduling),
+        m_max_thread_count(std::max(options.max_thread_count,thread_count)),
+        m_list_threads(m_max_thread_count),
+        m_live_thread_count(0),
+        m_list_count(0),
+        m_next_worker(0),
+        m_lane_count(1),
+        m_lane_seq_front(-1),
+        m_lane_seq_back(0),
+        m_task_count(0),
+        m_canceled_count(0),
+        m_delay_seq(0),
+        m_delay_stopped(false),
+        m_node_count(1),
+        m_idle_count(0),
+        m_spin_count(0),
+        m_running(false),
+        m_closed(false)
     {
+        for(auto &slot : m_list_threads) {
+            slot.running = false;
+        }
+
+        // Assign thread slots to nodes and cpus
+        uint const slot_count = std::max(m_max_thread_count,1u);
+        m_list_slot_nodes.resize(slot_count,0);
+        m_list_slot_cpus.resize(slot_count);
+
+        if(m_options.affinity != Affinity::None) {
+            auto const list_node_cpus = GetNodeCpuLists();
+
+            if(m_options.affinity == Affinity::NumaNode &&
+               !list_node_cpus.empty()) {
+                m_node_count = list_node_cpus.size();
+                for(uint i=0; i < slot_count; i++) {
+                    m_list_slot_nodes[i] = i % m_node_count;
+                    m_list_slot_cpus[i] = list_node_cpus[i % m_node_count];
+                }
+            }
+            else if(m_options.affinity == Affinity::Cpu) {
+                std::vector<uint> list_cpus;
+                for(auto const &list_cpus_node : list_node_cpus) {
+                    list_cpus.insert(list_cpus.end(),
+                                     list_cpus_node.begin(),
+                                     list_cpus_node.end());
+                }
+                for(uint i=0; i < slot_count && !list_cpus.empty(); i++) {
+                    m_list_slot_cpus[i].push_back(
+                                list_cpus[i % list_cpus.size()]);
+                }
+            }
+        }
+
+#if !defined(KS_THREAD_POOL_NO_METRICS)
+        m_metrics.reset(new MetricsRecorder(slot_count+1));
+#endif
+
+        m_list_node_workers.resize(m_node_count);
+        for(uint i=0; i < std::max(m_thread_count,1u); i++) {
+            m_list_node_workers[m_list_slot_nodes[i]].push_back(i);
+        }
+
+        if(m_scheduling == Scheduling::WorkStealing) {
+            // Always create at least one queue so tasks can
+            // be pushed to and processed by a pool without
+            // any threads
+            for(uint i=0; i < slot_count; i++) {
+                m_list_workers.emplace_back(new Worker);
+            }
+
+            // Visit the other queues starting with the next one
+            // so that thieves spread out over their victims, and
+            // visit queues on the same node first
+            for(uint i=0; i < slot_count; i++) {
+                auto &list_victims = m_list_workers[i]->list_victims;
+                for(uint pass=0; pass < 2; pass++) {
+                    for(uint j=1; j < slot_count; j++) {
+                        uint const victim = (i+j) % slot_count;
+                        bool const same_node =
+                                (m_list_slot_nodes[victim] ==
+                                 m_list_slot_nodes[i]);
+
+                        if(same_node == (pass == 0)) {
+                            list_victims.push_back(victim);
+                        }
+                    }
+                }
+            }
+        }
+        else if(m_scheduling == Scheduling::Priority) {
+            m_lane_count = std::max(m_options.lane_count,1u);
+            m_list_lanes.reset(new Lane[m_lane_count]);
+            for(uint i=0; i < m_lane_count; i++) {
+                m_list_lanes[i].task_count = 0;
+            }
+        }
+        else if(m_options.queue_type == QueueType::BoundedRing) {
+            m_ring_tasks.reset(
+                        new BoundedMPMCQueue<shared_ptr<Task>>(
+                            m_options.queue_capacity));
+        }
+
         this->Resume();
     }
 
-    ThreadPool::~ThreadPool()
+    void* ThreadPool::allocateTaskSlot(size_t size)
     {
-        this->Stop();
-//        LOG.Trace() << "STOPPED ALL THREADS";
+        uint const slot_class = GetTaskSlotClass(size);
+        if(slot_class == k_task_slot_class_count) {
+            return ::operator new(size);
+        }
+        return tl_list_task_slots.Allocate(slot_class);
     }
 
-    uint ThreadPool::GetTaskCount() const
+    void ThreadPool::deallocateTaskSlot(void* ptr,size_t size)
     {
-        std::lock_guard<std::mutex> lock(m_mutex);
-        return static_cast<uint>(m_queue_tasks.size());
+        uint const slot_class = GetTaskSlotClass(size);
+        if(slot_class == k_task_slot_class_count) {
+            ::operator delete(ptr);
+            return;
+        }
+        tl_list_task_slots.Deallocate(slot_class,ptr);
     }
 
-    void ThreadPool::PushFront(shared_ptr<Task> task)
+    ThreadPool::~ThreadPool()
     {
-        std::lock_guard<std::mutex> lock(m_mutex);
-        // Add work to shared queue
-        m_queue_tasks.push_front(std::move(task));
+        // Stop the timer thread first since it pushes tasks
+        {
+            std::lock_guard<std::mutex> lock(m_delay_mutex);
+            m_delay_stopped = true;
+        }
+        m_delay_cond.notify_all();
+        if(m_delay_thread.joinable()) {
+            m_delay_thread.join();
+        }
 
-        // TODO (m_mutex can be unlockd before notifying)
+        this->Stop();
 
-        // Wake one thread from the pool
-        m_wait_cond.notify_one();
+        // Reject anything pushed from here on, ie. by coroutines
+        // that the dropped tasks below resume on this thread
+        m_closed = true;
+
+        // End the tasks that were still waiting so
+        // nothing waiting on them blocks forever
+        std::vector<DelayedTask> list_delayed_tasks;
+        {
+            std::lock_guard<std::mutex> lock(m_delay_mutex);
+            list_delayed_tasks.swap(m_heap_delayed_tasks);
+        }
+        for(auto &delayed_task : list_delayed_tasks) {
+            delayed_task.task->drop();
+        }
+
+        // Tagged tasks left in the queues may outlive the pool
+        {
+            std::lock_guard<std::mutex> lock(m_tag_mutex);
+            for(auto &tag_list : m_tag_lists) {
+                Task* task = tag_list.second;
+                while(task) {
+                    Task* next = task->m_tag_next;
+                    task->m_tag_prev = nullptr;
+                    task->m_tag_next = nullptr;
+                    task->m_tag_pool = nullptr;
+                    task = next;
+                }
+            }
+            m_tag_lists.clear();
+        }
+
+//        LOG.Trace() << "STOPPED ALL THREADS";
     }
 
-    void ThreadPool::PushBack(shared_ptr<Task> task)
+    uint ThreadPool::GetThreadCount() const
     {
-        std::lock_guard<std::mutex> lock(m_mutex);
-        // Add work to shared queue
-        m_queue_tasks.push_back(std::move(task));
+        if(m_max_thread_count > m_thread_count) {
+            return m_live_thread_count;
+        }
+        return m_thread_count;
+    }
 
-        // TODO (m_mutex can be unlockd before notifying)
+    uint ThreadPool::GetTaskCount() const
+    {
+        // Don't count canceled tasks that are still queued
+        uint const canceled_count = m_canceled_count;
+        uint const task_count = m_task_count;
+        return (task_count > canceled_count) ?
+                    (task_count-canceled_count) : 0;
+    }
 
-        // Wake one thread from the pool
-        m_wait_cond.notify_one();
+    uint ThreadPool::GetNodeCount() const
+    {
+        return m_node_count;
     }
 
-    void ThreadPool::PushFront(std::vector<shared_ptr<Task>> list_tasks)
+    uint ThreadPool::GetCurrentNode() const
     {
-        std::lock_guard<std::mutex> lock(m_mutex);
+        if(tl_worker_pool != this) {
+            return 0;
+        }
+        return m_list_slot_nodes[tl_worker_index];
+    }
 
-        // Add work to shared queue
-        m_queue_tasks.insert(
-                    m_queue_tasks.begin(),
-                    std::make_move_iterator(list_tasks.begin()),
-                    std::make_move_iterator(list_tasks.end()));
+    uint ThreadPool::GetLaneCount() const
+    {
+        return m_lane_count;
+    }
 
-        // TODO (m_mutex can be unlockd before notifying)
+    uint ThreadPool::GetLaneTaskCount(uint lane) const
+    {
+        if(m_scheduling == Scheduling::Priority) {
+            return (lane < m_lane_count) ?
+                        m_list_lanes[lane].task_count.load() : 0;
+        }
 
-        // Wake all threads
-        m_wait_cond.notify_all();
+        return (lane == 0) ? GetTaskCount() : 0;
     }
 
-    void ThreadPool::PushBack(std::vector<shared_ptr<Task>> list_tasks)
+    bool ThreadPool::PushFront(shared_ptr<Task> task)
     {
-        std::lock_guard<std::mutex> lock(m_mutex);
+        if(m_closed) {
+            return false;
+        }
+
+        if(!trackTask(task.get())) {
+            return false;
+        }
+        m_task_count++;
 
-        // Add work to shared queue
-        m_queue_tasks.insert(
-                    m_queue_tasks.end(),
-                    std::make_move_iterator(list_tasks.begin()),
-                    std::make_move_iterator(list_tasks.end()));
+        if(m_scheduling == Scheduling::WorkStealing) {
+            auto &worker = getPushWorker();
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            worker.queue_tasks.push_front(std::move(task));
+        }
+        else if(m_scheduling == Scheduling::Priority) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            pushLane(std::move(task),
+                     m_options.default_lane,
+                     TimePoint::max(),
+                     m_lane_seq_front--);
+        }
+        else {
+            // Add work to shared queue. The bounded ring
+            // can't push to the front so the list is used
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_queue_tasks.push_front(std::move(task));
+            m_list_count++;
+        }
 
-        // TODO (m_mutex can be unlockd before notifying)
+        // Wake one thread from the pool
+        notify(1);
 
-        // Wake all threads
-        m_wait_cond.notify_all();
+        return true;
     }
 
-    uint ThreadPool::ProcessTask()
+    bool ThreadPool::PushBack(shared_ptr<Task> task)
     {
-        shared_ptr<Task> task;
-        uint tasks_remaining = 0;
+        if(m_closed) {
+            return false;
+        }
 
-        {
+        if(!trackTask(task.get())) {
+            return false;
+        }
+        m_task_count++;
+
+        if(m_scheduling == Scheduling::WorkStealing) {
+            auto &worker = getPushWorker();
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            worker.queue_tasks.push_back(std::move(task));
+        }
+        else if(m_scheduling == Scheduling::Priority) {
             std::lock_guard<std::mutex> lock(m_mutex);
-            if(m_queue_tasks.empty()) {
-                return 0;
+            pushLane(std::move(task),
+                     m_options.default_lane,
+                     TimePoint::max(),
+                     m_lane_seq_back++);
+        }
+        else if(m_ring_tasks) {
+            if(!pushRing(task)) {
+                m_task_count--;
+                untrackRejectedTask(task.get());
+                return false;
             }
-
-            // Take a task to process
-            task = std::move(m_queue_tasks.front());
-            m_queue_tasks.pop_front();
-            tasks_remaining = m_queue_tasks.size();
+        }
+        else {
+            // Add work to shared queue
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_queue_tasks.push_back(std::move(task));
+            m_list_count++;
         }
 
-        task->process();
-        return tasks_remaining;
+        // Wake one thread from the pool
+        notify(1);
+
+        return true;
     }
 
-    void ThreadPool::Stop()
+    bool ThreadPool::PushToNode(shared_ptr<Task> task,uint node)
     {
-        if(m_running) {
-            m_running = false;
-            m_wait_cond.notify_all();
+        if(m_closed) {
+            return false;
+        }
 
-            for(auto & thread : m_list_threads) {
-                thread.join();
-            }
-            m_list_threads.clear();
+        if(m_scheduling != Scheduling::WorkStealing) {
+            return PushBack(std::move(task));
         }
-    }
 
-    void ThreadPool::Resume()
-    {
-        if(!m_running) {
-            m_running = true;
-            for(uint i=0; i < m_thread_count; i++) {
-                m_list_threads.emplace_back(&ThreadPool::loop,this);
-            }
+        auto const &list_workers = m_list_node_workers[node % m_node_count];
+        if(list_workers.empty()) {
+            // No always running workers on this node
+            return PushBack(std::move(task));
+        }
+
+        if(!trackTask(task.get())) {
+            return false;
+        }
+        m_task_count++;
+
+        // Workers on the node push to their own queue
+        uint index = tl_worker_index;
+        if(tl_worker_pool != this ||
+           m_list_slot_nodes[index] != (node % m_node_count)) {
+            index = list_workers[m_next_worker++ % list_workers.size()];
+        }
+
+        {
+            auto &worker = *(m_list_workers[index]);
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            worker.queue_tasks.push_back(std::move(task));
         }
+
+        notify(1);
+
+        return true;
     }
 
-    void ThreadPool::loop()
+    uint ThreadPool::PushFront(std::vector<shared_ptr<Task>> list_tasks)
     {
-        while(m_running)
-        {
-            // acquire lock
-            std::unique_lock<std::mutex> lock(m_mutex);
+        if(m_closed) {
+            return 0;
+        }
 
-            while(m_running && m_queue_tasks.empty()) {
-                // wait while there are no tasks to process
-                m_wait_cond.wait(lock);
-            }
-            // wake-up automatically reacquires lock
+        // Tagged tasks that haven't ended are skipped
+        list_tasks.erase(
+                    std::remove_if(
+                        list_tasks.begin(),
+                        list_tasks.end(),
+                        [this](shared_ptr<Task> const &task) {
+                            return !trackTask(task.get());
+                        }),
+                    list_tasks.end());
 
-            if(!m_running) {
-                return;
+        uint const task_count = list_tasks.size();
+        m_task_count += task_count;
+
+        if(m_scheduling == Scheduling::WorkStealing) {
+            // Idle workers will steal from this queue
+            auto &worker = getPushWorker();
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            worker.queue_tasks.insert(
+                        worker.queue_tasks.begin(),
+                        std::make_move_iterator(list_tasks.begin()),
+                        std::make_move_iterator(list_tasks.end()));
+        }
+        else if(m_scheduling == Scheduling::Priority) {
+            // Keep the order of the list ahead of
+            // previously queued tasks
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_lane_seq_front -= task_count;
+            for(uint i=0; i < task_count; i++) {
+                pushLane(std::move(list_tasks[i]),
+                         m_options.default_lane,
+                         TimePoint::max(),
+                         m_lane_seq_front+1+i);
             }
+        }
+        else {
+            // Add work to shared queue
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_queue_tasks.insert(
+                        m_queue_tasks.begin(),
+                        std::make_move_iterator(list_tasks.begin()),
+                        std::make_move_iterator(list_tasks.end()));
+            m_list_count += task_count;
+        }
 
-            shared_ptr<Task> task = std::move(m_queue_tasks.front());
-            m_queue_tasks.pop_front();
-            lock.unlock();
+        notify(task_count);
 
-            task->process();
+        return task_count;
+    }
+
+    uint ThreadPool::PushBack(std::vector<shared_ptr<Task>> list_tasks)
+    {
+        return PushBatch(list_tasks);
+    }
+
+    uint ThreadPool::PushBatch(std::vector<shared_ptr<Task>> &list_tasks)
+    {
+        if(m_closed) {
+            list_tasks.clear();
+            return 0;
+        }
+
+        // Tagged tasks that are still queued or running are skipped
+        list_tasks.erase(
+                    std::remove_if(
+                        list_tasks.begin(),
+                        list_tasks.end(),
+                        [this](shared_ptr<Task> const &task) {
+                            return !trackTask(task.get());
+                        }),
+                    list_tasks.end());
+
+        uint task_count = list_tasks.size();
+        m_task_count += task_count;
+
+        if(m_scheduling == Scheduling::WorkStealing) {
+            // Split the batch into contiguous runs, one per
+            // queue, so the tasks can be taken in parallel
+            uint const queue_count = std::max(m_thread_count,1u);
+            uint const run_count = std::min(task_count,queue_count);
+            uint const first_queue = (tl_worker_pool == this) ?
+                        tl_worker_index : m_next_worker.fetch_add(run_count);
+
+            for(uint i=0; i < run_count; i++) {
+                auto begin = list_tasks.begin()+(u64(task_count)*i/run_count);
+                auto end = list_tasks.begin()+(u64(task_count)*(i+1)/run_count);
+
+                auto &worker = *(m_list_workers[(first_queue+i) % queue_count]);
+                std::lock_guard<std::mutex> lock(worker.mutex);
+                worker.queue_tasks.insert(
+                            worker.queue_tasks.end(),
+                            std::make_move_iterator(begin),
+                            std::make_move_iterator(end));
+            }
+        }
+        else if(m_scheduling == Scheduling::Priority) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for(auto &task : list_tasks) {
+                pushLane(std::move(task),
+                         m_options.default_lane,
+                         TimePoint::max(),
+                         m_lane_seq_back++);
+            }
+        }
+        else if(m_ring_tasks) {
+            // Stop at the first rejected task so that
+            // the queued tasks are always a prefix
+            for(uint i=0; i < list_tasks.size(); i++) {
+                if(!pushRing(list_tasks[i])) {
+                    m_task_count -= (task_count-i);
+                    for(uint j=i; j < task_count; j++) {
+                        untrackRejectedTask(list_tasks[j].get());
+                    }
+                    task_count = i;
+                    break;
+                }
+            }
+        }
+        else {
+            // Add work to shared queue
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_queue_tasks.insert(
+                        m_queue_tasks.end(),
+                        std::make_move_iterator(list_tasks.begin()),
+                        std::make_move_iterator(list_tasks.end()));
+            m_list_count += task_count;
+        }
+
+        list_tasks.clear();
+
+        notify(task_count);
+
+        return task_count;
+    }
+
+    bool ThreadPool::Push(shared_ptr<Task> task,
+                          uint lane,
+                          TimePoint deadline)
+    {
+        if(m_closed) {
+            return false;
+        }
+
+        if(m_scheduling != Scheduling::Priority) {
+            return PushBack(std::move(task));
+        }
+
+        if(!trackTask(task.get())) {
+            return false;
+        }
+        m_task_count++;
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            pushLane(std::move(task),lane,deadline,m_lane_seq_back++);
+        }
+
+        // Wake one thread from the pool
+        notify(1);
+
+        return true;
+    }
+
+    void ThreadPool::PushAfter(shared_ptr<Task> task,Milliseconds delay)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_delay_mutex);
+            if(m_delay_stopped) {
+                // The pool is being destroyed
+                lock.unlock();
+                task->drop();
+                return;
+            }
+
+            if(!m_delay_thread.joinable()) {
+                m_delay_thread = std::thread(&ThreadPool::delayLoop,this);
+            }
+
+            m_heap_delayed_tasks.push_back(
+                        DelayedTask{Clock::now()+delay,m_delay_seq++,std::move(task)});
+            std::push_heap(m_heap_delayed_tasks.begin(),
+                           m_heap_delayed_tasks.end(),
+                           &ThreadPool::compareDelayedTasks);
+        }
+
+        m_delay_cond.notify_one();
+    }
+
+    uint ThreadPool::ProcessTask()
+    {
+        shared_ptr<Task> task;
+
+        // Threads that aren't workers of this pool
+        // start looking for tasks at a rotating index
+        uint const index = (tl_worker_pool == this) ?
+                    tl_worker_index : m_next_worker++;
+
+        if(!takeRunnableTask(index,task)) {
+            return 0;
+        }
+
+        uint const tasks_remaining = GetTaskCount();
+        runTask(task);
+        return tasks_remaining;
+    }
+
+    uint ThreadPool::CancelTag(u64 tag)
+    {
+        // Continuations of canceled tasks are released after
+        // m_tag_mutex is unlocked since pushing them may run
+        // tasks that need the lock
+        std::vector<Task::Continuation> list_continuations;
+        uint count=0;
+
+        {
+            std::lock_guard<std::mutex> lock(m_tag_mutex);
+
+            auto it = m_tag_lists.find(tag);
+            if(it == m_tag_lists.end()) {
+                return 0;
+            }
+
+            Task* task = it->second;
+            while(task) {
+                // cancelTrackedTask may unlink task
+                Task* next = task->m_tag_next;
+                cancelTrackedTask(task,list_continuations);
+                task = next;
+                count++;
+            }
+        }
+
+        Task::releaseContinuations(list_continuations);
+
+        return count;
+    }
+
+    uint ThreadPool::CancelIf(std::function<bool(Task const &)> pred)
+    {
+        std::vector<Task::Continuation> list_continuations;
+        uint count=0;
+
+        {
+            std::lock_guard<std::mutex> lock(m_tag_mutex);
+
+            // Collect the lists first since canceling
+            // tasks may erase entries from m_tag_lists
+            std::vector<Task*> list_heads;
+            list_heads.reserve(m_tag_lists.size());
+            for(auto const &tag_list : m_tag_lists) {
+                list_heads.push_back(tag_list.second);
+            }
+
+            for(Task* task : list_heads) {
+                while(task) {
+                    Task* next = task->m_tag_next;
+                    if(pred(*task)) {
+                        cancelTrackedTask(task,list_continuations);
+                        count++;
+                    }
+                    task = next;
+                }
+            }
+        }
+
+        Task::releaseContinuations(list_continuations);
+
+        return count;
+    }
+
+    ThreadPoolMetrics ThreadPool::GetMetrics() const
+    {
+        ThreadPoolMetrics metrics;
+
+#if !defined(KS_THREAD_POOL_NO_METRICS)
+        using Recorder = MetricsRecorder;
+        using Histogram = ThreadPoolMetrics::Histogram;
+
+        metrics.enabled = true;
+        metrics.duration = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    Clock::now().time_since_epoch()-
+                    Clock::duration(m_metrics->start_ns.load()));
+
+        for(uint i=0; i < m_metrics->worker_count; i++) {
+            auto const &src = m_metrics->list_workers[i];
+
+            ThreadPoolMetrics::Worker worker;
+            worker.task_count = Recorder::Get(src.task_count);
+            worker.busy_time =
+                    ThreadPoolMetrics::Nanoseconds(Recorder::Get(src.busy_ns));
+            worker.idle_time =
+                    ThreadPoolMetrics::Nanoseconds(Recorder::Get(src.idle_ns));
+            worker.steal_count = Recorder::Get(src.steal_count);
+            worker.contention_count = Recorder::Get(src.contention_count);
+            metrics.list_workers.push_back(worker);
+
+            metrics.task_count += worker.task_count;
+            metrics.steal_count += worker.steal_count;
+            metrics.contention_count += worker.contention_count;
+
+            for(uint j=0; j < Histogram::k_bucket_count; j++) {
+                metrics.queue_wait.list_counts[j] +=
+                        Recorder::Get(src.list_queue_wait[j]);
+                metrics.run_time.list_counts[j] +=
+                        Recorder::Get(src.list_run_time[j]);
+            }
         }
+
+        if(metrics.duration.count() > 0) {
+            metrics.tasks_per_second =
+                    metrics.task_count*1E9/metrics.duration.count();
+        }
+#endif
+
+        return metrics;
+    }
+
+    void ThreadPool::ResetMetrics()
+    {
+#if !defined(KS_THREAD_POOL_NO_METRICS)
+        m_metrics->Reset();
+#endif
+    }
+
+    void ThreadPool::Stop()
+    {
+        std::lock_guard<std::mutex> thread_lock(m_thread_mutex);
+
+        if(m_running) {
+            {
+                // Lock so that workers can't miss the
+                // notification between checking m_running
+                // and waiting
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_running = false;
+            }
+            m_wait_cond.notify_all();
+
+            // Also joins elastic threads that have already exited
+            for(auto &slot : m_list_threads) {
+                if(slot.thread.joinable()) {
+                    slot.thread.join();
+                }
+                slot.running = false;
+            }
+            m_live_thread_count = 0;
+        }
+    }
+
+    void ThreadPool::Resume()
+    {
+        std::lock_guard<std::mutex> thread_lock(m_thread_mutex);
+
+        if(!m_running) {
+            m_running = true;
+            for(uint i=0; i < m_thread_count; i++) {
+                m_list_threads[i].running = true;
+                startThread(i);
+            }
+        }
+    }
+
+    void ThreadPool::setupThread(uint index)
+    {
+        TraceRecorder::SetThreadName(
+                    (m_options.thread_name.empty() ?
+                         std::string("ThreadPool worker ") :
+                         m_options.thread_name)+std::to_string(index));
+
+#if defined(__linux__)
+        if(!m_options.thread_name.empty()) {
+            // Truncate the prefix so the index isn't cut off
+            std::string const suffix = std::to_string(index);
+            std::string const name =
+                    m_options.thread_name.substr(
+                        0,15-std::min<size_t>(suffix.size(),15))+suffix;
+
+            pthread_setname_np(pthread_self(),name.c_str());
+        }
+
+        auto const &list_cpus = m_list_slot_cpus[index];
+        if(!list_cpus.empty()) {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            for(uint cpu : list_cpus) {
+                CPU_SET(cpu,&cpus);
+            }
+            // pid 0 is the calling thread
+            if(sched_setaffinity(0,sizeof(cpus),&cpus) != 0) {
+                LOG.Warn() << "ThreadPool: Failed to set affinity "
+                              "for worker " << index;
+            }
+        }
+#else
+        (void)index;
+#endif
+    }
+
+    void ThreadPool::loop(uint index)
+    {
+        tl_worker_pool = this;
+        tl_worker_index = index;
+
+        setupThread(index);
+
+        shared_ptr<Task> task;
+        uint retry_count = 0;
+
+        while(m_running)
+        {
+            if(takeRunnableTask(index,task)) {
+                if(m_max_thread_count > m_thread_count) {
+                    // Pushes may have seen this worker as idle
+                    // before it woke up, so check for a backlog
+                    // here as well
+                    growThreadsIfBacklogged();
+                }
+                runTask(task);
+                task.reset();
+                retry_count = 0;
+                continue;
+            }
+
+            // Tasks are counted before they're queued and a
+            // victim's lock may be held, so let the other
+            // threads make progress before retrying. Tasks
+            // that stay out of reach are waited for instead
+            bool const backoff = (m_task_count > 0);
+            if(backoff && retry_count < k_take_retry_count) {
+                retry_count++;
+                std::this_thread::yield();
+                continue;
+            }
+            retry_count = 0;
+
+            TimePoint const idle_start = metricsNow();
+
+            if(!backoff && spin()) {
+                recordIdle(idle_start);
+                continue;
+            }
+
+            bool const keep_running = park(index,backoff);
+            recordIdle(idle_start);
+
+            if(!keep_running) {
+                // Retired elastic thread
+                break;
+            }
+        }
+
+        tl_worker_pool = nullptr;
+    }
+
+    bool ThreadPool::spin()
+    {
+        uint const spin_count = m_options.idle_spin_count;
+        if(spin_count == 0) {
+            return false;
+        }
+
+        // Pushing threads check m_spin_count after incrementing
+        // m_task_count, so a push that skips the wakeup because
+        // of this worker is seen here or in park()
+        m_spin_count++;
+
+        bool found = false;
+        for(uint i=0; i < spin_count; i++) {
+            if(m_task_count > 0 || !m_running) {
+                found = true;
+                break;
+            }
+            CpuRelax();
+        }
+
+        m_spin_count--;
+
+        return found;
+    }
+
+    bool ThreadPool::park(uint index,bool backoff)
+    {
+        // acquire lock
+        std::unique_lock<std::mutex> lock(m_mutex);
+
+        // m_idle_count is incremented before m_task_count is
+        // checked and pushing threads increment m_task_count
+        // before checking m_idle_count, so either this worker
+        // sees the new task or the pushing thread sees this
+        // worker as idle and notifies it
+        m_idle_count++;
+
+        if(backoff) {
+            // The counted tasks couldn't be taken; wait
+            // briefly unless a push wakes this worker first
+            if(m_running) {
+                m_wait_cond.wait_for(lock,k_take_backoff);
+            }
+            m_idle_count--;
+            return true;
+        }
+
+        bool const elastic = (index >= m_thread_count);
+        TimePoint const retire_time =
+                elastic ? (Clock::now()+m_options.idle_timeout) :
+                          TimePoint::max();
+
+        bool retire = false;
+        while(m_running && m_task_count == 0) {
+            // wait while there are no tasks to process
+            if(!elastic) {
+                m_wait_cond.wait(lock);
+            }
+            else if(m_wait_cond.wait_until(lock,retire_time) ==
+                    std::cv_status::timeout) {
+                retire = (m_running && m_task_count == 0);
+                break;
+            }
+        }
+        // wake-up automatically reacquires lock
+
+        m_idle_count--;
+
+        if(retire) {
+            // Deciding to retire with m_mutex held means a push
+            // either saw this worker as idle and notified another
+            // one or sees it as gone and may start a thread
+            m_list_threads[index].running = false;
+            m_live_thread_count--;
+        }
+
+        return !retire;
+    }
+
+    void ThreadPool::notify(uint task_count)
+    {
+        if(m_idle_count == 0) {
+            if(m_max_thread_count > m_thread_count) {
+                growThreadsIfBacklogged();
+            }
+            return;
+        }
+
+        // Spinning workers will each take a task
+        uint const spin_count = m_spin_count;
+        if(task_count <= spin_count) {
+            return;
+        }
+
+        {
+            // Acquire and release the lock so that a worker
+            // that is about to wait can't miss the notification
+            std::lock_guard<std::mutex> lock(m_mutex);
+        }
+
+        // Only wake as many workers as there are tasks; waking
+        // every worker for a small batch just has most of them
+        // contend for the queue and go back to sleep. Woken
+        // workers keep taking tasks until none are left, so
+        // waking fewer workers doesn't strand any tasks
+        uint const idle_count = m_idle_count;
+        uint const wake_count = task_count-spin_count;
+        if(wake_count >= idle_count) {
+            m_wait_cond.notify_all();
+        }
+        else {
+            for(uint i=0; i < wake_count; i++) {
+                m_wait_cond.notify_one();
+            }
+        }
+    }
+
+    void ThreadPool::startThread(uint index)
+    {
+        // m_thread_mutex must be locked by the caller
+        // and the slot must be marked as running
+        auto &slot = m_list_threads[index];
+        if(slot.thread.joinable()) {
+            // Retired thread that has finished or is about
+            // to finish exiting
+            slot.thread.join();
+        }
+
+        m_live_thread_count++;
+        slot.thread = std::thread(&ThreadPool::loop,this,index);
+    }
+
+    void ThreadPool::growThreadsIfBacklogged()
+    {
+        // Add a thread if tasks are backing up while every
+        // thread is busy
+        if(m_idle_count == 0 &&
+           m_spin_count == 0 &&
+           m_task_count > m_live_thread_count) {
+            growThreads();
+        }
+    }
+
+    void ThreadPool::growThreads()
+    {
+        // Best effort: don't wait on threads that are starting
+        // or stopping threads since this may be a worker that
+        // Stop is trying to join
+        std::unique_lock<std::mutex> thread_lock(m_thread_mutex,
+                                                 std::try_to_lock);
+        if(!thread_lock.owns_lock()) {
+            return;
+        }
+
+        uint index = m_max_thread_count;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if(!m_running || m_idle_count > 0) {
+                return;
+            }
+
+            for(uint i=m_thread_count; i < m_max_thread_count; i++) {
+                if(!m_list_threads[i].running) {
+                    m_list_threads[i].running = true;
+                    index = i;
+                    break;
+                }
+            }
+        }
+
+        if(index < m_max_thread_count) {
+            startThread(index);
+        }
+    }
+
+    bool ThreadPool::takeTask(uint index,shared_ptr<Task> &task)
+    {
+        if(m_task_count == 0) {
+            return false;
+        }
+
+        if(m_scheduling == Scheduling::WorkStealing) {
+            uint const worker_index = index % m_list_workers.size();
+            auto &worker = *(m_list_workers[worker_index]);
+            {
+                std::unique_lock<std::mutex> lock(worker.mutex,std::defer_lock);
+                lockCounted(lock);
+                if(!worker.queue_tasks.empty()) {
+                    // The owner takes its newest task, which is the
+                    // most likely to still be in its cache. Other
+                    // threads calling ProcessTask take the oldest
+                    // like thieves do
+                    if(tl_worker_pool == this && tl_worker_index == worker_index) {
+                        task = std::move(worker.queue_tasks.back());
+                        worker.queue_tasks.pop_back();
+                    }
+                    else {
+                        task = std::move(worker.queue_tasks.front());
+                        worker.queue_tasks.pop_front();
+                    }
+                    m_task_count--;
+                    return true;
+                }
+            }
+
+            return stealTask(index,task);
+        }
+
+        if(m_scheduling == Scheduling::Priority) {
+            return takeLaneTask(task);
+        }
+
+        if(m_list_count > 0) {
+            std::unique_lock<std::mutex> lock(m_mutex,std::defer_lock);
+            lockCounted(lock);
+            if(!m_queue_tasks.empty()) {
+                // Take a task to process
+                task = std::move(m_queue_tasks.front());
+                m_queue_tasks.pop_front();
+                m_list_count--;
+                m_task_count--;
+                return true;
+            }
+        }
+
+        if(m_ring_tasks && m_ring_tasks->TryPop(task)) {
+            m_task_count--;
+            return true;
+        }
+
+        return false;
+    }
+
+    bool ThreadPool::stealTask(uint index,shared_ptr<Task> &task)
+    {
+        auto const &list_victims =
+                m_list_workers[index % m_list_workers.size()]->list_victims;
+
+        for(uint victim_index : list_victims) {
+            auto &victim = *(m_list_workers[victim_index]);
+
+            std::unique_lock<std::mutex> lock(victim.mutex,std::try_to_lock);
+            if(!lock.owns_lock()) {
+                recordContention();
+                continue;
+            }
+
+            if(victim.queue_tasks.empty()) {
+                continue;
+            }
+
+            // Steal the oldest task, away from the end the
+            // owner takes from, so that tasks pushed with
+            // PushFront are taken first
+            task = std::move(victim.queue_tasks.front());
+            victim.queue_tasks.pop_front();
+            m_task_count--;
+            recordSteal();
+            return true;
+        }
+
+        // A victim may have been skipped because its lock was
+        // held; the caller will retry since m_task_count > 0
+
+        return false;
+    }
+
+    bool ThreadPool::pushRing(shared_ptr<Task> &task)
+    {
+        while(!m_ring_tasks->TryPush(task))
+        {
+            if(m_options.overflow_policy == OverflowPolicy::Reject) {
+                return false;
+            }
+
+            if(m_options.overflow_policy == OverflowPolicy::Grow) {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_queue_tasks.push_back(std::move(task));
+                m_list_count++;
+                return true;
+            }
+
+            // OverflowPolicy::Block: Waiting on a full queue
+            // deadlocks if nothing else can drain it, so workers
+            // and threads pushing to a pool with no running
+            // workers process a task instead
+            if(tl_worker_pool == this || !m_running || m_max_thread_count == 0) {
+                this->ProcessTask();
+            }
+            else {
+                // Tasks pushed earlier in a batch are only
+                // announced once the batch is queued, so wake
+                // idle workers to drain the full queue
+                notify(m_ring_tasks->GetCapacity());
+                std::this_thread::yield();
+            }
+        }
+
+        return true;
+    }
+
+    bool ThreadPool::takeRunnableTask(uint index,shared_ptr<Task> &task)
+    {
+        while(takeTask(index,task)) {
+            if(task->m_tag == 0 || task->m_queued.exchange(false)) {
+                return true;
+            }
+
+            // The task was canceled while queued and
+            // has already been ended; just drop it
+            m_canceled_count--;
+            task.reset();
+        }
+
+        return false;
+    }
+
+    void ThreadPool::runTask(shared_ptr<Task> &task)
+    {
+        TimePoint const start = metricsNow();
+        {
+            KS_TRACE_SCOPE(task->m_name,"ThreadPool");
+            task->process();
+        }
+        recordRun(task.get(),start,metricsNow());
+    }
+
+    void ThreadPool::then(shared_ptr<Task> const &task,shared_ptr<Task> const &next)
+    {
+        next->m_pending_count = 1;
+        addContinuation(task.get(),next);
+    }
+
+    void ThreadPool::addContinuation(Task* task,shared_ptr<Task> const &next)
+    {
+        // A null predecessor (ie. a rejected Submit) counts as ended
+        if(task) {
+            std::lock_guard<std::mutex> lock(task->m_wait_mutex);
+            if(!task->m_ended) {
+                task->m_list_continuations.push_back(
+                            Task::Continuation{this,next});
+                return;
+            }
+        }
+
+        releaseContinuation(next);
+    }
+
+    shared_ptr<ThreadPool::Task> ThreadPool::addContinuation(
+            std::vector<shared_ptr<Task>> const &list_tasks,
+            shared_ptr<Task> next,
+            uint pending_count)
+    {
+        if(list_tasks.empty()) {
+            next->m_pending_count = 1;
+            releaseContinuation(next);
+            return next;
+        }
+
+        next->m_pending_count = pending_count;
+        for(auto const &task : list_tasks) {
+            addContinuation(task.get(),next);
+        }
+
+        return next;
+    }
+
+    void ThreadPool::releaseContinuation(shared_ptr<Task> const &next)
+    {
+        // Only the release that takes the count from one to zero
+        // pushes the task. Releases after that (the remaining
+        // predecessors of WhenAny) wrap past zero and are ignored
+        if(next->m_pending_count.fetch_sub(1) != 1) {
+            return;
+        }
+
+        if(!PushBack(next)) {
+            next->drop();
+        }
+    }
+
+    bool ThreadPool::trackTask(Task* task)
+    {
+        // Called for every task before it's queued
+        if(task->m_tag == 0) {
+            recordPush(task);
+            return true;
+        }
+
+        std::lock_guard<std::mutex> lock(m_tag_mutex);
+
+        // A tagged task that hasn't ended (in any pool)
+        // is already linked; linking it again would
+        // corrupt the list, so the push is ignored
+        ThreadPool* tag_pool = nullptr;
+        if(!task->m_tag_pool.compare_exchange_strong(tag_pool,this)) {
+            return false;
+        }
+
+        recordPush(task);
+        task->m_queued = true;
+
+        Task* &head = m_tag_lists[task->m_tag];
+        task->m_tag_prev = nullptr;
+        task->m_tag_next = head;
+        if(head) {
+            head->m_tag_prev = task;
+        }
+        head = task;
+
+        return true;
+    }
+
+    void ThreadPool::untrackTask(Task* task)
+    {
+        if(task->m_tag == 0) {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(m_tag_mutex);
+        unlinkTask(task);
+    }
+
+    void ThreadPool::untrackRejectedTask(Task* task)
+    {
+        if(task->m_tag == 0) {
+            return;
+        }
+
+        if(task->m_queued.exchange(false)) {
+            std::lock_guard<std::mutex> lock(m_tag_mutex);
+            unlinkTask(task);
+        }
+        else {
+            // Canceled (and unlinked) before it was rejected, so
+            // it will never be dropped by a worker
+            m_canceled_count--;
+        }
+    }
+
+    void ThreadPool::unlinkTask(Task* task)
+    {
+        // m_tag_mutex must be locked by the caller
+        if(task->m_tag_pool != this) {
+            // not linked
+            return;
+        }
+
+        if(task->m_tag_prev) {
+            task->m_tag_prev->m_tag_next = task->m_tag_next;
+        }
+        else {
+            auto it = m_tag_lists.find(task->m_tag);
+            if(task->m_tag_next) {
+                it->second = task->m_tag_next;
+            }
+            else {
+                m_tag_lists.erase(it);
+            }
+        }
+
+        if(task->m_tag_next) {
+            task->m_tag_next->m_tag_prev = task->m_tag_prev;
+        }
+
+        task->m_tag_prev = nullptr;
+        task->m_tag_next = nullptr;
+        task->m_tag_pool = nullptr;
+    }
+
+    void ThreadPool::cancelTrackedTask(
+            Task* task,
+            std::vector<Task::Continuation> &list_continuations)
+    {
+        // m_tag_mutex must be locked by the caller.
+        // Count the task before clearing m_queued so that
+        // a worker dropping it can't decrement first
+        m_canceled_count++;
+
+        if(task->m_queued.exchange(false)) {
+            // Still queued: the task won't run, so end it now
+            unlinkTask(task);
+            task->onCanceled();
+            task->end(list_continuations);
+        }
+        else {
+            // Running; it's up to the task to stop early
+            m_canceled_count--;
+            task->onCanceled();
+        }
+    }
+
+    ThreadPool::TimePoint ThreadPool::metricsNow() const
+    {
+#if !defined(KS_THREAD_POOL_NO_METRICS)
+        return Clock::now();
+#else
+        return TimePoint();
+#endif
+    }
+
+    void ThreadPool::recordPush(Task* task)
+    {
+#if !defined(KS_THREAD_POOL_NO_METRICS)
+        task->m_push_time = Clock::now();
+#else
+        (void)task;
+#endif
+    }
+
+    void ThreadPool::recordRun(Task* task,TimePoint start,TimePoint end)
+    {
+#if !defined(KS_THREAD_POOL_NO_METRICS)
+        using Recorder = MetricsRecorder;
+        using Histogram = ThreadPoolMetrics::Histogram;
+
+        auto &worker = m_metrics->GetWorker(this);
+
+        // Tasks pushed directly to a TaskGraph node or run
+        // without being pushed have no push time
+        if(task->m_push_time != TimePoint()) {
+            Recorder::Add(worker.list_queue_wait[
+                              Histogram::GetBucket(start-task->m_push_time)],1);
+        }
+
+        std::chrono::nanoseconds const run_time = end-start;
+        Recorder::Add(worker.list_run_time[Histogram::GetBucket(run_time)],1);
+        Recorder::Add(worker.busy_ns,run_time.count());
+        Recorder::Add(worker.task_count,1);
+#else
+        (void)task;
+        (void)start;
+        (void)end;
+#endif
+    }
+
+    void ThreadPool::recordIdle(TimePoint start)
+    {
+#if !defined(KS_THREAD_POOL_NO_METRICS)
+        std::chrono::nanoseconds const idle_time = Clock::now()-start;
+        MetricsRecorder::Add(m_metrics->GetWorker(this).idle_ns,
+                             idle_time.count());
+#else
+        (void)start;
+#endif
+    }
+
+    void ThreadPool::recordSteal()
+    {
+#if !defined(KS_THREAD_POOL_NO_METRICS)
+        MetricsRecorder::Add(m_metrics->GetWorker(this).steal_count,1);
+#endif
+    }
+
+    void ThreadPool::recordContention()
+    {
+#if !defined(KS_THREAD_POOL_NO_METRICS)
+        MetricsRecorder::Add(m_metrics->GetWorker(this).contention_count,1);
+#endif
+    }
+
+    void ThreadPool::lockCounted(std::unique_lock<std::mutex> &lock)
+    {
+#if !defined(KS_THREAD_POOL_NO_METRICS)
+        if(lock.try_lock()) {
+            return;
+        }
+        recordContention();
+#endif
+        lock.lock();
+    }
+
+    bool ThreadPool::compareLaneEntries(LaneEntry const &a,
+                                        LaneEntry const &b)
+    {
+        // std heaps keep the greatest element at the front, so
+        // 'less' means a later deadline or sequence number
+        if(a.deadline != b.deadline) {
+            return (a.deadline > b.deadline);
+        }
+        return (a.seq > b.seq);
+    }
+
+    bool ThreadPool::compareDelayedTasks(DelayedTask const &a,
+                                         DelayedTask const &b)
+    {
+        // Earliest time first, then in the order they were added
+        if(a.time != b.time) {
+            return (a.time > b.time);
+        }
+        return (a.seq > b.seq);
+    }
+
+    void ThreadPool::delayLoop()
+    {
+        std::vector<shared_ptr<Task>> list_due_tasks;
+
+        std::unique_lock<std::mutex> lock(m_delay_mutex);
+        while(!m_delay_stopped)
+        {
+            if(m_heap_delayed_tasks.empty()) {
+                m_delay_cond.wait(lock);
+                continue;
+            }
+
+            TimePoint const now = Clock::now();
+            TimePoint const time = m_heap_delayed_tasks.front().time;
+            if(now < time) {
+                m_delay_cond.wait_until(lock,time);
+                continue;
+            }
+
+            while(!m_heap_delayed_tasks.empty() &&
+                  m_heap_delayed_tasks.front().time <= now) {
+                std::pop_heap(m_heap_delayed_tasks.begin(),
+                              m_heap_delayed_tasks.end(),
+                              &ThreadPool::compareDelayedTasks);
+                list_due_tasks.push_back(
+                            std::move(m_heap_delayed_tasks.back().task));
+                m_heap_delayed_tasks.pop_back();
+            }
+
+            // Push without the lock since a blocking bounded
+            // queue may have to wait for space
+            lock.unlock();
+            for(auto &task : list_due_tasks) {
+                if(!PushBack(task)) {
+                    task->drop();
+                }
+            }
+            list_due_tasks.clear();
+            lock.lock();
+        }
+    }
+
+    void ThreadPool::pushLane(shared_ptr<Task> task,
+                              uint lane,
+                              TimePoint deadline,
+                              s64 seq)
+    {
+        // m_mutex must be locked by the caller
+        auto &dst = m_list_lanes[std::min(lane,m_lane_count-1)];
+
+        if(dst.heap_tasks.empty()) {
+            // Start aging once the lane has something waiting
+            dst.last_taken = Clock::now();
+        }
+
+        dst.heap_tasks.push_back(LaneEntry{std::move(task),deadline,seq});
+        std::push_heap(dst.heap_tasks.begin(),
+                       dst.heap_tasks.end(),
+                       compareLaneEntries);
+        dst.task_count++;
+    }
+
+    bool ThreadPool::takeLaneTask(shared_ptr<Task> &task)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex,std::defer_lock);
+        lockCounted(lock);
+
+        // Pick the lane with the highest priority after aging
+        uint const k_invalid = m_lane_count;
+        uint lane = k_invalid;
+        s64 lane_priority = 0;
+
+        bool const aging = (m_options.aging_interval.count() > 0);
+        TimePoint now;
+        if(aging) {
+            now = Clock::now();
+        }
+
+        for(uint i=0; i < m_lane_count; i++) {
+            auto const &src = m_list_lanes[i];
+            if(src.heap_tasks.empty()) {
+                continue;
+            }
+
+            s64 priority = i;
+            if(aging) {
+                priority -= std::chrono::duration_cast<Milliseconds>(
+                            now-src.last_taken).count() /
+                        m_options.aging_interval.count();
+            }
+
+            if(lane == k_invalid || priority < lane_priority) {
+                lane = i;
+                lane_priority = priority;
+            }
+        }
+
+        if(lane == k_invalid) {
+            return false;
+        }
+
+        auto &src = m_list_lanes[lane];
+        std::pop_heap(src.heap_tasks.begin(),
+                      src.heap_tasks.end(),
+                      compareLaneEntries);
+
+        task = std::move(src.heap_tasks.back().task);
+        src.heap_tasks.pop_back();
+        src.task_count--;
+        if(aging) {
+            src.last_taken = now;
+        }
+        m_task_count--;
+
+        return true;
+    }
+
+    ThreadPool::Worker& ThreadPool::getPushWorker()
+    {
+        // Workers push to their own queue to keep related tasks
+        // local, other threads distribute tasks round robin
+        if(tl_worker_pool == this) {
+            return *(m_list_workers[tl_worker_index]);
+        }
+
+        // Elastic threads may exit, so only push to the
+        // queues of threads that are always running
+        uint const queue_count = std::max(m_thread_count,1u);
+        return *(m_list_workers[m_next_worker++ % queue_count]);
     }
 
     // ============================================================= //
@@ -17,25 +17,41 @@
 #ifndef KS_THREAD_POOL_HPP
 #define KS_THREAD_POOL_HPP
 
+#include <cstddef>
+#include <new>
 #include <vector>
 #include <list>
+#include <deque>
+#include <unordered_map>
+#include <functional>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
-#include <future>
+#include <atomic>
+#include <type_traits>
+#include <chrono>
+#include <string>
 
 #include <ks/KsGlobal.hpp>
+#include <ks/shared/KsBoundedMPMCQueue.hpp>
+#include <ks/shared/KsThreadPoolMetrics.hpp>
 
 namespace ks
 {
+    class TaskGraph;
+    class AwaitTask;
+
     // ============================================================= //
 
     class ThreadPool final
     {
+        friend class AwaitTask;
+
     public:
         class Task
         {
             friend class ThreadPool;
+            friend class TaskGraph;
 
         public:
             enum class WaitStatus : u8 {
@@ -57,6 +73,20 @@ namespace ks
 
             virtual void Cancel() = 0;
 
+            // Tags group tasks so they can be canceled together
+            // with ThreadPool::CancelTag or CancelIf. The tag must
+            // be set before the task is pushed; 0 means no tag.
+            // Pushing a tagged task again before it has ended
+            // is ignored and the push returns false
+            void SetTag(u64 tag);
+            u64 GetTag() const;
+
+            // Name used for the task's events when tracing is
+            // enabled (see TraceRecorder). The name isn't copied
+            // so it must be a string literal or interned string
+            void SetName(char const * name);
+            char const * GetName() const;
+
             // Wait on a task indefinitely.
             // NOTE: Do NOT use the WaitFor function that takes wait_ms
             // as an argument to try and wait indefinitely (ie. by setting
@@ -74,19 +104,348 @@ namespace ks
             void onEnded();
 
         private:
+            // A task to be pushed to pool once this task ends
+            struct Continuation
+            {
+                ThreadPool* pool;
+                shared_ptr<Task> task;
+            };
+
             virtual void process() = 0;
 
+            // Called instead of process() when a delayed task or a
+            // continuation is dropped without being queued, because
+            // a full bounded queue rejected it or the pool was
+            // destroyed first. Cancels and ends the task by default
+            virtual void drop();
+
+            // Clears the state of a task that has ended so it
+            // can be pushed again; used by TaskGraph, which runs
+            // the same tasks on every run
+            void reset();
+
+            // Marks the task as ended and moves its continuations
+            // to list_continuations so they can be released later
+            void end(std::vector<Continuation> &list_continuations);
+
+            // Unlinks the task from the tag list it's in, if any
+            void untrack();
+            static void releaseContinuations(
+                    std::vector<Continuation> &list_continuations);
+
             std::atomic<bool> m_started;
             std::atomic<bool> m_running;
             std::atomic<bool> m_canceled;
             std::atomic<bool> m_finished;
-            std::promise<void> m_promise;
-            std::future<void>  m_future;
+
+            // Signalled by onEnded. A mutex and condition variable
+            // are used instead of a promise/future pair since the
+            // latter allocates shared state for every task
+            std::mutex m_wait_mutex;
+            std::condition_variable m_wait_cond;
+            bool m_ended;
+
+            // Used by ThreadPool to track tagged tasks. m_queued is
+            // cleared by whichever of the taking worker or a cancel
+            // call gets to it first. m_tag_prev/next link tasks with
+            // the same tag until they end, in the lists of
+            // m_tag_pool (null if the task isn't linked)
+            u64 m_tag;
+            std::atomic<bool> m_queued;
+            std::atomic<ThreadPool*> m_tag_pool;
+            Task* m_tag_prev;
+            Task* m_tag_next;
+
+            // Tasks to push once this task ends (guarded by
+            // m_wait_mutex). For a continuation, m_pending_count
+            // is the number of predecessors that must end before
+            // it's pushed; see ThreadPool::releaseContinuation
+            std::vector<Continuation> m_list_continuations;
+            std::atomic<uint> m_pending_count;
+
+            char const * m_name;
+
+#if !defined(KS_THREAD_POOL_NO_METRICS)
+            // Set when the task is pushed to measure queue wait time
+            std::chrono::steady_clock::time_point m_push_time;
+#endif
+        };
+
+        // ============================================================= //
+
+        // Task that invokes a callable; created by Submit.
+        // If the callable takes a Task const & it's passed the
+        // task, so long running callables can check IsCanceled()
+        // and stop early after CancelTag or CancelIf
+        template<typename F>
+        class FunctionTask final : public Task
+        {
+        public:
+            template<typename Fn>
+            FunctionTask(Fn&& fn) :
+                m_fn(std::forward<Fn>(fn))
+            {}
+
+            void Cancel()
+            {
+                onCanceled();
+            }
+
+        private:
+            void process()
+            {
+                onStarted();
+                if(!IsCanceled()) {
+                    invoke(m_fn,*this,0);
+                    onFinished();
+                }
+                onEnded();
+            }
+
+            // The int overload is preferred and is only
+            // viable if fn can be called with the task
+            template<typename Fn>
+            static auto invoke(Fn &fn,Task const &task,int) ->
+                decltype(fn(task),void())
+            {
+                fn(task);
+            }
+
+            template<typename Fn>
+            static void invoke(Fn &fn,Task const &,long)
+            {
+                fn();
+            }
+
+            F m_fn;
+        };
+
+        // ============================================================= //
+
+        // Task that resumes a coroutine; created by Schedule,
+        // ScheduleAfter and AwaitTask. Handle is a std::coroutine_handle. If the
+        // task is dropped the coroutine is resumed right away on
+        // the dropping thread, since a coroutine that's never
+        // resumed is leaked along with anything awaiting it
+        template<typename Handle>
+        class ResumeTask final : public Task
+        {
+        public:
+            ResumeTask(Handle handle) :
+                m_handle(handle)
+            {}
+
+            void Cancel()
+            {
+                onCanceled();
+            }
+
+        private:
+            void process()
+            {
+                onStarted();
+                m_handle.resume();
+                onFinished();
+                onEnded();
+            }
+
+            void drop()
+            {
+                process();
+            }
+
+            Handle m_handle;
         };
 
         // ============================================================= //
 
-        ThreadPool(uint thread_count);
+        // Allocator used for tasks created by Submit and MakeTask.
+        // Tasks that fit in one of the slot size classes (256, 512
+        // or 1024 bytes including the shared_ptr control block) are
+        // recycled through per-thread free lists so that no heap
+        // allocations are made in steady state. Larger tasks fall
+        // back to the global operator new, and so do over-aligned
+        // tasks, which need C++17 aligned new.
+        template<typename T>
+        class TaskAllocator
+        {
+        public:
+            using value_type = T;
+
+            TaskAllocator() = default;
+
+            template<typename U>
+            TaskAllocator(TaskAllocator<U> const &) {}
+
+            T* allocate(size_t n)
+            {
+#if defined(__cpp_aligned_new)
+                if(alignof(T) > alignof(std::max_align_t)) {
+                    return static_cast<T*>(
+                                ::operator new(n*sizeof(T),
+                                               std::align_val_t(alignof(T))));
+                }
+#else
+                static_assert(alignof(T) <= alignof(std::max_align_t),
+                              "ThreadPool: over-aligned tasks require "
+                              "aligned new (C++17)");
+#endif
+                return static_cast<T*>(
+                            ThreadPool::allocateTaskSlot(n*sizeof(T)));
+            }
+
+            void deallocate(T* p,size_t n)
+            {
+#if defined(__cpp_aligned_new)
+                if(alignof(T) > alignof(std::max_align_t)) {
+                    ::operator delete(p,std::align_val_t(alignof(T)));
+                    return;
+                }
+#endif
+                ThreadPool::deallocateTaskSlot(p,n*sizeof(T));
+            }
+
+            template<typename U>
+            bool operator==(TaskAllocator<U> const &) const
+            {
+                return true;
+            }
+
+            template<typename U>
+            bool operator!=(TaskAllocator<U> const &) const
+            {
+                return false;
+            }
+        };
+
+        // ============================================================= //
+
+        // Scheduling
+        // * SharedQueue: all workers pull from a single queue
+        //   guarded by one mutex
+        // * WorkStealing: each worker owns a queue and steals
+        //   from the other workers when its own queue is empty.
+        //   A worker takes the newest task from its own queue
+        //   (LIFO) while thieves and other threads calling
+        //   ProcessTask take the oldest, so PushFront/PushBack
+        //   are only best-effort priority hints relative to the
+        //   queue the task lands in
+        // * Priority: tasks are pushed into one of several priority
+        //   lanes sharing one mutex; see Push(task,lane,deadline)
+        enum class Scheduling : u8 {
+            SharedQueue,
+            WorkStealing,
+            Priority
+        };
+
+        // QueueType (Scheduling::SharedQueue only)
+        // * List: unbounded list guarded by a mutex
+        // * BoundedRing: lock-free fixed capacity ring buffer;
+        //   pushing to the back doesn't allocate or lock.
+        //   PushFront and overflowing tasks use the list, which
+        //   is always checked before the ring
+        enum class QueueType : u8 {
+            List,
+            BoundedRing
+        };
+
+        // OverflowPolicy (QueueType::BoundedRing only)
+        // * Block: wait until there is space. Workers and pools
+        //   without threads process queued tasks while waiting
+        // * Reject: don't queue the task; Push* returns false
+        // * Grow: spill the task into the unbounded list
+        enum class OverflowPolicy : u8 {
+            Block,
+            Reject,
+            Grow
+        };
+
+        // Affinity
+        // * None: workers aren't pinned to any cpus
+        // * Cpu: each worker is pinned to one of the cpus the
+        //   process may run on, wrapping around if there are
+        //   more workers than cpus
+        // * NumaNode: workers are assigned to NUMA nodes round
+        //   robin and pinned to all cpus of their node. Work
+        //   stealing pools steal from workers on the same node
+        //   first, and PushToNode/SubmitToNode keep tasks on the
+        //   node that owns their data
+        // * pinning is only supported on Linux and is ignored
+        //   elsewhere
+        enum class Affinity : u8 {
+            None,
+            Cpu,
+            NumaNode
+        };
+
+        class Options
+        {
+        public:
+            Scheduling scheduling;
+            QueueType queue_type;
+            uint queue_capacity;
+            OverflowPolicy overflow_policy;
+
+            // Scheduling::Priority only
+            // * lane 0 has the highest priority
+            // * PushFront/PushBack/Submit use default_lane
+            // * a waiting lane is treated as one lane higher for
+            //   every aging_interval that passes without a task
+            //   being taken from it, so low priority work still
+            //   drains. Aging is disabled if aging_interval is 0
+            uint lane_count;
+            uint default_lane;
+            Milliseconds aging_interval;
+
+            // Elastic sizing
+            // * the pool always runs thread_count threads. If
+            //   max_thread_count is larger, threads are added while
+            //   tasks back up with no idle workers, and the added
+            //   threads exit after idling for idle_timeout
+            // * max_thread_count <= thread_count is a fixed size pool
+            uint max_thread_count;
+            Milliseconds idle_timeout;
+
+            // Idle policy
+            // * workers that run out of tasks poll for new ones
+            //   idle_spin_count times before waiting on the pool's
+            //   condition variable. Pushing to a pool with a spinning
+            //   worker skips the wakeup, trading CPU time for lower
+            //   wake latency. 0 waits right away
+            uint idle_spin_count;
+
+            // Placement
+            // * see Affinity
+            // * workers are named thread_name followed by their
+            //   index so they're easy to find in perf traces. Linux
+            //   truncates names to 15 characters. Workers aren't
+            //   named if thread_name is empty
+            Affinity affinity;
+            std::string thread_name;
+
+            Options() :
+                scheduling(Scheduling::SharedQueue),
+                queue_type(QueueType::List),
+                queue_capacity(1024),
+                overflow_policy(OverflowPolicy::Block),
+                lane_count(3),
+                default_lane(1),
+                aging_interval(100),
+                max_thread_count(0),
+                idle_timeout(1000),
+                idle_spin_count(0),
+                affinity(Affinity::None)
+            {}
+        };
+
+        using Clock = std::chrono::steady_clock;
+        using TimePoint = Clock::time_point;
+
+        ThreadPool(uint thread_count,
+                   Scheduling scheduling=Scheduling::SharedQueue);
+
+        ThreadPool(uint thread_count,
+                   Options const &options);
         ~ThreadPool();
 
         // No copying or moving allowed
@@ -96,25 +455,475 @@ namespace ks
         ThreadPool(ThreadPool&&) = delete;
         ThreadPool& operator=(ThreadPool&&) = delete;
 
+        // Number of worker threads; for elastic pools this
+        // is the number of threads currently running
+        uint GetThreadCount() const;
         uint GetTaskCount() const;
-        void PushFront(shared_ptr<Task> task);
-        void PushBack(shared_ptr<Task> task);
-        void PushFront(std::vector<shared_ptr<Task>> list_tasks);
-        void PushBack(std::vector<shared_ptr<Task>> list_tasks);
+
+        // Number of tasks queued in each priority lane. Pools that
+        // don't use Scheduling::Priority report a single lane
+        uint GetLaneCount() const;
+        uint GetLaneTaskCount(uint lane) const;
+
+        // Number of NUMA nodes the workers are grouped into; this
+        // is 1 unless Affinity::NumaNode is used
+        uint GetNodeCount() const;
+
+        // Node of the calling worker thread; 0 if the calling
+        // thread isn't a worker of this pool
+        uint GetCurrentNode() const;
+
+        // Push*
+        // * returns false (or the number of tasks that were
+        //   queued for lists) if OverflowPolicy::Reject is
+        //   used and the bounded queue is full, if the pool is
+        //   being destroyed, or if a tagged task is pushed again
+        //   before it has ended; always succeeds otherwise
+        bool PushFront(shared_ptr<Task> task);
+        bool PushBack(shared_ptr<Task> task);
+        uint PushFront(std::vector<shared_ptr<Task>> list_tasks);
+        uint PushBack(std::vector<shared_ptr<Task>> list_tasks);
+
+        // PushBatch
+        // * same as PushBack for a list of tasks, except that the
+        //   tasks are moved out of list_tasks, which is left empty
+        //   with its capacity kept so it can be reused
+        // * with Scheduling::WorkStealing the batch is split
+        //   across worker queues so workers don't contend for
+        //   the same queue when taking them
+        // * like other pushes, only wakes as many idle workers
+        //   as there are tasks
+        uint PushBatch(std::vector<shared_ptr<Task>> &list_tasks);
+
+        // Push
+        // * queues task in the given priority lane; within a lane
+        //   tasks with the earliest deadline are taken first and
+        //   tasks without a deadline are taken in FIFO order
+        //   after those that have one
+        // * deadlines are only used for ordering; tasks that
+        //   miss their deadline are still run
+        // * same as PushBack if Scheduling::Priority isn't used
+        bool Push(shared_ptr<Task> task,
+                  uint lane,
+                  TimePoint deadline=TimePoint::max());
+
+        // PushToNode
+        // * queues task on a worker of the given NUMA node (modulo
+        //   the node count) for Scheduling::WorkStealing; other
+        //   workers only run it once they run out of work
+        // * same as PushBack for other Scheduling types
+        bool PushToNode(shared_ptr<Task> task,uint node);
+
+        // MakeTask
+        // * creates a task of type T with its shared_ptr control
+        //   block in a recycled slot (see TaskAllocator); use this
+        //   instead of make_shared for tasks that are created often
+        template<typename T,typename... Args>
+        static shared_ptr<T> MakeTask(Args&&... args)
+        {
+            static_assert(std::is_base_of<Task,T>::value,
+                          "ThreadPool: MakeTask requires a Task type");
+
+            return std::allocate_shared<T>(
+                        TaskAllocator<T>(),
+                        std::forward<Args>(args)...);
+        }
+
+        // Submit
+        // * queues a callable to the back of the pool and
+        //   returns its task, which can be waited on or canceled
+        // * the callable takes either no arguments or the
+        //   task (Task const &) so it can check IsCanceled()
+        // * the task is allocated from recycled slots; with
+        //   QueueType::BoundedRing submitting a task doesn't
+        //   allocate at all in steady state
+        // * returns nullptr if the task was rejected
+        template<typename F>
+        shared_ptr<Task> Submit(F&& fn)
+        {
+            shared_ptr<Task> task = makeFunctionTask(std::forward<F>(fn));
+
+            if(!PushBack(task)) {
+                return nullptr;
+            }
+
+            return task;
+        }
+
+        // Same as Submit but sets the task's tag before it's queued
+        template<typename F>
+        shared_ptr<Task> Submit(u64 tag,F&& fn)
+        {
+            shared_ptr<Task> task = makeFunctionTask(std::forward<F>(fn));
+            task->SetTag(tag);
+
+            if(!PushBack(task)) {
+                return nullptr;
+            }
+
+            return task;
+        }
+
+        // Same as Submit but queues the task with PushToNode
+        template<typename F>
+        shared_ptr<Task> SubmitToNode(uint node,F&& fn)
+        {
+            shared_ptr<Task> task = makeFunctionTask(std::forward<F>(fn));
+
+            if(!PushToNode(task,node)) {
+                return nullptr;
+            }
+
+            return task;
+        }
+
+        // Awaitable returned by Schedule and ScheduleAfter
+        class ScheduleAwaiter final
+        {
+        public:
+            ScheduleAwaiter(ThreadPool* thread_pool,Milliseconds delay) :
+                m_thread_pool(thread_pool),
+                m_delay(delay)
+            {}
+
+            bool await_ready() const
+            {
+                return false;
+            }
+
+            // Handle is a std::coroutine_handle; taking it as a
+            // template parameter keeps this header C++11
+            template<typename Handle>
+            bool await_suspend(Handle handle)
+            {
+                // The coroutine may be resumed on a worker (and
+                // this awaiter destroyed) before the push returns,
+                // so members must not be used after the call
+                shared_ptr<Task> task = MakeTask<ResumeTask<Handle>>(handle);
+
+                // A delayed task that's dropped resumes the
+                // coroutine itself (see ResumeTask)
+                if(m_delay.count() > 0) {
+                    m_thread_pool->PushAfter(std::move(task),m_delay);
+                    return true;
+                }
+
+                // If the task is rejected the coroutine is resumed
+                // right away on the calling thread
+                return m_thread_pool->PushBack(std::move(task));
+            }
+
+            void await_resume() const
+            {
+                // empty
+            }
+
+        private:
+            ThreadPool* m_thread_pool;
+            Milliseconds m_delay;
+        };
+
+        // Schedule / ScheduleAfter
+        // * co_await Schedule() suspends the calling coroutine
+        //   and resumes it as a task on this pool, optionally
+        //   after a delay (see SubmitAfter); see KsAsyncTask.hpp
+        //   (C++20)
+        ScheduleAwaiter Schedule()
+        {
+            return ScheduleAwaiter(this,Milliseconds(0));
+        }
+
+        ScheduleAwaiter ScheduleAfter(Milliseconds delay)
+        {
+            return ScheduleAwaiter(this,delay);
+        }
+
+        // PushAfter / SubmitAfter
+        // * pushes a task to the back of the pool once delay has
+        //   passed. Waiting tasks are held by a timer thread that
+        //   is started the first time a delay is used, so no
+        //   worker is blocked while they wait
+        // * like continuations, a task rejected by a full bounded
+        //   queue when its delay passes is canceled and ended
+        // * tasks still waiting when the pool is destroyed, or
+        //   pushed while it's being destroyed, are canceled and
+        //   ended without being run. This happens after the
+        //   workers have been joined and the pool has stopped
+        //   accepting tasks, so a coroutine resumed this way
+        //   (see ScheduleAwaiter) finds Schedule resuming it
+        //   inline and Submit returning null
+        void PushAfter(shared_ptr<Task> task,Milliseconds delay);
+
+        template<typename F>
+        shared_ptr<Task> SubmitAfter(Milliseconds delay,F&& fn)
+        {
+            shared_ptr<Task> task = makeFunctionTask(std::forward<F>(fn));
+            PushAfter(task,delay);
+
+            return task;
+        }
+
+        // Then / WhenAll / WhenAny
+        // * returns a task that runs fn on this pool once task has
+        //   ended, all of list_tasks have ended, or the first of
+        //   list_tasks has ended respectively
+        // * the returned task is pushed to the back of the pool by
+        //   the thread that ends the last predecessor it needs (or
+        //   right away if those have already ended), so nothing
+        //   blocks waiting on predecessors
+        // * canceled and null predecessors also count as ended;
+        //   fn can check the predecessors it captured if it cares
+        // * if list_tasks is empty the task is pushed right away
+        // * if the continuation is rejected by a full bounded queue
+        //   it's dropped (see Task::drop), which cancels and ends
+        //   it instead of running it
+        // * the pool must outlive any continuations that haven't
+        //   been pushed yet
+        template<typename F>
+        shared_ptr<Task> Then(shared_ptr<Task> const &task,F&& fn)
+        {
+            shared_ptr<Task> next = makeFunctionTask(std::forward<F>(fn));
+            then(task,next);
+
+            return next;
+        }
+
+        template<typename F>
+        shared_ptr<Task> WhenAll(std::vector<shared_ptr<Task>> const &list_tasks,
+                                 F&& fn)
+        {
+            return addContinuation(list_tasks,
+                                   makeFunctionTask(std::forward<F>(fn)),
+                                   list_tasks.size());
+        }
+
+        template<typename F>
+        shared_ptr<Task> WhenAny(std::vector<shared_ptr<Task>> const &list_tasks,
+                                 F&& fn)
+        {
+            return addContinuation(list_tasks,
+                                   makeFunctionTask(std::forward<F>(fn)),
+                                   1);
+        }
+
+        // CancelTag / CancelIf
+        // * cancels queued and running tasks with the given tag, or
+        //   tagged tasks that pred returns true for
+        // * queued tasks are marked as canceled and ended right away
+        //   and are dropped without running once a worker reaches
+        //   them; this only touches the canceled tasks
+        // * running tasks are marked as canceled; long running tasks
+        //   should check IsCanceled() and stop early
+        // * pred is called with the pool's tag lock held and must
+        //   not push tasks to or cancel tasks in this pool
+        // * returns the number of tasks that were canceled
+        uint CancelTag(u64 tag);
+        uint CancelIf(std::function<bool(Task const &)> pred);
+
         uint ProcessTask();
         void Stop();
         void Resume();
 
+        // GetMetrics / ResetMetrics
+        // * returns a snapshot of worker times, task counts and
+        //   latency histograms; see ThreadPoolMetrics
+        // * counters are updated without locks so a snapshot
+        //   taken while tasks run may be slightly inconsistent
+        // * ResetMetrics zeroes the counters and starts a new
+        //   window for tasks_per_second
+        // * returns an empty snapshot if KS_THREAD_POOL_NO_METRICS
+        //   is defined
+        ThreadPoolMetrics GetMetrics() const;
+        void ResetMetrics();
+
     private:
-        void loop();
+        static void* allocateTaskSlot(size_t size);
+        static void deallocateTaskSlot(void* ptr,size_t size);
+
+        template<typename F>
+        static shared_ptr<Task> makeFunctionTask(F&& fn)
+        {
+            using FnTask = FunctionTask<typename std::decay<F>::type>;
+
+            return MakeTask<FnTask>(std::forward<F>(fn));
+        }
+
+        // Pushes next once task has ended; used by Then and
+        // by AwaitTask, which resumes a coroutine with next
+        void then(shared_ptr<Task> const &task,shared_ptr<Task> const &next);
+        void addContinuation(Task* task,shared_ptr<Task> const &next);
+        shared_ptr<Task> addContinuation(
+                std::vector<shared_ptr<Task>> const &list_tasks,
+                shared_ptr<Task> next,
+                uint pending_count);
+        void releaseContinuation(shared_ptr<Task> const &next);
+
+        // A worker thread; elastic slots are reused after
+        // their thread exits. running is guarded by m_mutex
+        struct ThreadSlot
+        {
+            std::thread thread;
+            bool running;
+        };
+
+        struct Worker
+        {
+            std::mutex mutex;
+            std::deque<shared_ptr<Task>> queue_tasks;
+
+            // Queues to steal from in order; workers on the
+            // same node come first
+            std::vector<uint> list_victims;
+        };
+
+        struct DelayedTask
+        {
+            TimePoint time;
+            u64 seq;
+            shared_ptr<Task> task;
+        };
+
+        struct LaneEntry
+        {
+            shared_ptr<Task> task;
+            TimePoint deadline;
+            s64 seq;
+        };
+
+        struct Lane
+        {
+            // binary heap; see compareLaneEntries
+            std::vector<LaneEntry> heap_tasks;
+            std::atomic<uint> task_count;
+            TimePoint last_taken;
+        };
+
+        // Metrics bookkeeping; these compile to nothing
+        // if KS_THREAD_POOL_NO_METRICS is defined
+        struct MetricsRecorder;
+        TimePoint metricsNow() const;
+        void recordPush(Task* task);
+        void recordRun(Task* task,TimePoint start,TimePoint end);
+        void recordIdle(TimePoint start);
+        void recordSteal();
+        void recordContention();
+        void lockCounted(std::unique_lock<std::mutex> &lock);
+
+        static bool compareLaneEntries(LaneEntry const &a,
+                                       LaneEntry const &b);
+        static bool compareDelayedTasks(DelayedTask const &a,
+                                        DelayedTask const &b);
+        void delayLoop();
+
+        void setupThread(uint index);
+        void loop(uint index);
+        bool spin();
+        bool park(uint index,bool backoff);
+        void notify(uint task_count);
+        void startThread(uint index);
+        void growThreadsIfBacklogged();
+        void growThreads();
+        bool takeTask(uint index,shared_ptr<Task> &task);
+        bool stealTask(uint index,shared_ptr<Task> &task);
+        bool pushRing(shared_ptr<Task> &task);
+        void pushLane(shared_ptr<Task> task,
+                      uint lane,
+                      TimePoint deadline,
+                      s64 seq);
+        bool takeLaneTask(shared_ptr<Task> &task);
+        bool takeRunnableTask(uint index,shared_ptr<Task> &task);
+        void runTask(shared_ptr<Task> &task);
+        bool trackTask(Task* task);
+        void untrackTask(Task* task);
+        void untrackRejectedTask(Task* task);
+        void unlinkTask(Task* task);
+        void cancelTrackedTask(Task* task,
+                               std::vector<Task::Continuation> &list_continuations);
+        Worker& getPushWorker();
 
         uint const m_thread_count;
-        std::vector<std::thread> m_list_threads;
+        Options const m_options;
+        Scheduling const m_scheduling;
+
+        // Slots [0,m_thread_count) run while the pool is running,
+        // the rest are started on demand. m_thread_mutex serializes
+        // starting and stopping threads
+        uint const m_max_thread_count;
+        std::vector<ThreadSlot> m_list_threads;
+        std::atomic<uint> m_live_thread_count;
+        std::mutex m_thread_mutex;
+
+        // Scheduling::SharedQueue (guarded by m_mutex)
         std::list<shared_ptr<Task>> m_queue_tasks;
 
+        // QueueType::BoundedRing. m_list_count tracks the number
+        // of tasks in m_queue_tasks so takers can skip the lock
+        unique_ptr<BoundedMPMCQueue<shared_ptr<Task>>> m_ring_tasks;
+        std::atomic<uint> m_list_count;
+
+        // Scheduling::WorkStealing. There is a queue for every thread
+        // slot but other threads only push to the queues of slots
+        // that are always running
+        std::vector<unique_ptr<Worker>> m_list_workers;
+        std::atomic<uint> m_next_worker;
+
+        // Scheduling::Priority (guarded by m_mutex). Tasks pushed
+        // to the front get decreasing sequence numbers and tasks
+        // pushed to the back get increasing ones
+        uint m_lane_count;
+        unique_ptr<Lane[]> m_list_lanes;
+        s64 m_lane_seq_front;
+        s64 m_lane_seq_back;
+
+        // Number of queued tasks across all queues. This is
+        // incremented before a task is queued and decremented
+        // after it is taken so it never underflows
+        std::atomic<uint> m_task_count;
+
+        // Tagged tasks that are queued or running, stored as
+        // the head of a list linked through the tasks
+        std::mutex m_tag_mutex;
+        std::unordered_map<u64,Task*> m_tag_lists;
+
+        // Number of canceled tasks that are still queued
+        std::atomic<uint> m_canceled_count;
+
+        // Tasks waiting to be pushed by PushAfter (guarded by
+        // m_delay_mutex). The timer thread is started on demand
+        // and joined before the rest of the pool is destroyed
+        std::mutex m_delay_mutex;
+        std::condition_variable m_delay_cond;
+        std::vector<DelayedTask> m_heap_delayed_tasks;
+        u64 m_delay_seq;
+        bool m_delay_stopped;
+        std::thread m_delay_thread;
+
+        // Placement. m_list_slot_cpus are the cpus each thread
+        // slot is pinned to (none if empty). m_list_node_workers
+        // are the always running slots of each node
+        uint m_node_count;
+        std::vector<uint> m_list_slot_nodes;
+        std::vector<std::vector<uint>> m_list_slot_cpus;
+        std::vector<std::vector<uint>> m_list_node_workers;
+
+        // Number of workers waiting on m_wait_cond
+        std::atomic<uint> m_idle_count;
+
+        // Number of workers polling for tasks before waiting
+        std::atomic<uint> m_spin_count;
+
         std::atomic<bool> m_running;
+
+        // Set once the workers have been joined while the pool is
+        // destroyed; tasks pushed after that are rejected
+        std::atomic<bool> m_closed;
+
         mutable std::mutex m_mutex;
         std::condition_variable m_wait_cond;
+
+#if !defined(KS_THREAD_POOL_NO_METRICS)
+        unique_ptr<MetricsRecorder> m_metrics;
+#endif
     };
 
     // ============================================================= //
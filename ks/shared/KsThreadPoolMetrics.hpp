@@ -0,0 +1,174 @@
+/*
+   Copyright (C) 2015 Preet Desai (preet.desai@gmail.com)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef KS_THREAD_POOL_METRICS_HPP
+#define KS_THREAD_POOL_METRICS_HPP
+
+#include <array>
+#include <algorithm>
+#include <vector>
+#include <chrono>
+
+#include <ks/KsGlobal.hpp>
+
+// ThreadPool records metrics unless KS_THREAD_POOL_NO_METRICS
+// is defined, in which case none of the bookkeeping is compiled
+// in and ThreadPool::GetMetrics returns an empty snapshot. The
+// define must be the same for every translation unit (qmake:
+// CONFIG += ks_thread_pool_no_metrics)
+
+namespace ks
+{
+    // ============================================================= //
+
+    // A snapshot of ThreadPool metrics; see ThreadPool::GetMetrics
+    class ThreadPoolMetrics final
+    {
+    public:
+        using Nanoseconds = std::chrono::nanoseconds;
+        using Microseconds = std::chrono::microseconds;
+
+        // Durations counted in power of two microsecond buckets:
+        // [0,1us), [1us,2us), [2us,4us) ... [2^22us,inf)
+        class Histogram final
+        {
+        public:
+            static uint const k_bucket_count = 24;
+
+            Histogram()
+            {
+                list_counts.fill(0);
+            }
+
+            static uint GetBucket(Nanoseconds duration)
+            {
+                u64 us = (duration.count() > 0) ?
+                            static_cast<u64>(duration.count()/1000) : 0;
+
+                uint bucket=0;
+                while(us > 0 && bucket+1 < k_bucket_count) {
+                    us >>= 1;
+                    bucket++;
+                }
+                return bucket;
+            }
+
+            static Microseconds GetBucketLowerBound(uint bucket)
+            {
+                return Microseconds((bucket == 0) ? 0 : (u64(1) << (bucket-1)));
+            }
+
+            u64 GetCount() const
+            {
+                u64 count=0;
+                for(u64 bucket_count : list_counts) {
+                    count += bucket_count;
+                }
+                return count;
+            }
+
+            // Upper bound of the bucket that contains the given
+            // percentile (0 to 1); the last bucket has no upper
+            // bound so its lower bound is returned
+            Microseconds GetPercentile(double percentile) const
+            {
+                u64 const count = GetCount();
+                if(count == 0) {
+                    return Microseconds(0);
+                }
+
+                u64 const target = std::min<u64>(
+                            count-1,static_cast<u64>(percentile*count));
+
+                u64 sum=0;
+                for(uint i=0; i+1 < k_bucket_count; i++) {
+                    sum += list_counts[i];
+                    if(sum > target) {
+                        return GetBucketLowerBound(i+1);
+                    }
+                }
+                return GetBucketLowerBound(k_bucket_count-1);
+            }
+
+            std::array<u64,k_bucket_count> list_counts;
+        };
+
+        struct Worker
+        {
+            u64 task_count;
+            Nanoseconds busy_time;
+
+            // Time spent spinning or waiting for tasks
+            Nanoseconds idle_time;
+
+            // Tasks taken from other workers' queues
+            u64 steal_count;
+
+            // Times a queue lock was already held when this
+            // worker tried to take a task
+            u64 contention_count;
+        };
+
+        ThreadPoolMetrics() :
+            enabled(false),
+            duration(0),
+            task_count(0),
+            tasks_per_second(0),
+            steal_count(0),
+            contention_count(0)
+        {}
+
+        // Fraction of worker time spent running tasks
+        double GetUtilization() const
+        {
+            Nanoseconds busy_time(0);
+            Nanoseconds total_time(0);
+            for(auto const &worker : list_workers) {
+                busy_time += worker.busy_time;
+                total_time += worker.busy_time+worker.idle_time;
+            }
+
+            return (total_time.count() > 0) ?
+                        double(busy_time.count())/total_time.count() : 0;
+        }
+
+        // False if metrics were compiled out
+        bool enabled;
+
+        // Time since the pool was created or ResetMetrics was
+        // called; the totals below cover this window
+        Nanoseconds duration;
+
+        u64 task_count;
+        double tasks_per_second;
+        u64 steal_count;
+        u64 contention_count;
+
+        // Time from a task being pushed to it starting to run, and
+        // the time it took to run. Canceled tasks that were dropped
+        // from the queue aren't counted
+        Histogram queue_wait;
+        Histogram run_time;
+
+        // One entry per thread slot followed by one for threads
+        // that aren't workers but call ThreadPool::ProcessTask
+        std::vector<Worker> list_workers;
+    };
+
+    // ============================================================= //
+}
+
+#endif // KS_THREAD_POOL_METRICS_HPP
@@ -0,0 +1,470 @@
+/*
+   Copyright (C) 2015 Preet Desai (preet.desai@gmail.com)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <ks/shared/KsTimerWheel.hpp>
+#include <ks/shared/KsTraceRecorder.hpp>
+
+namespace ks
+{
+    // ============================================================= //
+
+    namespace
+    {
+        // Index of the first set bit at or after pos, wrapping
+        // around; bits must not be zero
+        uint GetNextSetBit(u64 bits,uint pos)
+        {
+            u64 const rotated = (pos == 0) ? bits : ((bits >> pos) | (bits << (64-pos)));
+
+            uint index=0;
+            while((rotated & (u64(1) << index)) == 0) {
+                index++;
+            }
+            return index;
+        }
+    }
+
+    // ============================================================= //
+
+    uint const TimerWheel::k_level_count;
+    uint const TimerWheel::k_slot_bits;
+    uint const TimerWheel::k_slot_count;
+    uint const TimerWheel::k_slot_mask;
+    uint const TimerWheel::k_invalid;
+    u64 const TimerWheel::k_no_tick;
+
+    TimerWheel::TimerWheel(ks::Object::Key const &key,
+                           shared_ptr<EventLoop> const &evloop,
+                           Milliseconds resolution_ms) :
+        ks::Object(key,evloop),
+        m_timer(MakeObject<Timer>(evloop)),
+        m_resolution(std::max(resolution_ms,Milliseconds(1))),
+        m_start(Clock::now()),
+        m_tick(0),
+        m_target_tick(0),
+        m_wakeup_tick(k_no_tick),
+        m_advancing(false),
+        m_next_id(0),
+        m_active_count(0)
+    {
+        m_list_slot_heads.fill(k_invalid);
+        m_list_slot_tails.fill(k_invalid);
+        m_list_occupied.fill(0);
+    }
+
+    void TimerWheel::Init(ks::Object::Key const &,
+                          shared_ptr<TimerWheel> const &this_timer_wheel)
+    {
+        m_timer->signal_timeout.Connect(
+                    this_timer_wheel,
+                    &TimerWheel::onTimeout,
+                    ConnectionType::Direct);
+    }
+
+    TimerWheel::~TimerWheel()
+    {
+        m_timer->Stop();
+    }
+
+    Milliseconds TimerWheel::GetResolution() const
+    {
+        return std::chrono::duration_cast<Milliseconds>(m_resolution);
+    }
+
+    uint TimerWheel::GetTimerCount() const
+    {
+        return m_list_entries.GetCount();
+    }
+
+    uint TimerWheel::GetActiveCount() const
+    {
+        return m_active_count;
+    }
+
+    uint TimerWheel::Advance(TimePoint now)
+    {
+        if(m_advancing) {
+            return 0;
+        }
+        m_advancing = true;
+        m_target_tick = getTick(now);
+
+        // Jump straight to each tick that has timers to fire
+        // or a higher level slot to cascade
+        uint fired=0;
+        for(u64 tick = getNextEventTick();
+            tick <= m_target_tick;
+            tick = getNextEventTick())
+        {
+            processTick(tick,fired);
+        }
+        m_tick = std::max(m_tick,m_target_tick);
+
+        m_advancing = false;
+        scheduleWakeup(now);
+
+        return fired;
+    }
+
+    uint TimerWheel::createTimer(std::function<void()> callback)
+    {
+        Entry entry;
+        entry.id = m_next_id++;
+        entry.deadline_tick = 0;
+        entry.expiry_tick = 0;
+        entry.interval_ticks = 1;
+        entry.slack_ticks = 0;
+        entry.prev = k_invalid;
+        entry.next = k_invalid;
+        entry.slot = k_invalid;
+        entry.active = false;
+        entry.repeating = false;
+        entry.callback = std::move(callback);
+
+        return m_list_entries.Add(std::move(entry));
+    }
+
+    void TimerWheel::destroyTimer(uint index)
+    {
+        stopTimer(index);
+        m_list_entries.Remove(index);
+    }
+
+    void TimerWheel::startTimer(uint index,
+                                Milliseconds interval_ms,
+                                Milliseconds slack_ms,
+                                bool repeating)
+    {
+        TimePoint const now = Clock::now();
+
+        Entry &entry = m_list_entries[index];
+        if(entry.active) {
+            unlink(index);
+        }
+        else {
+            entry.active = true;
+            m_active_count++;
+        }
+
+        // Start from the wheel's time if it's been advanced past
+        // now and round up so the timer never fires early
+        TimePoint const start = std::max(now,getTickTime(m_tick));
+        u64 const deadline_tick = getTicksCeil((start-m_start)+interval_ms);
+
+        entry.repeating = repeating;
+        entry.interval_ticks = std::max<u64>(1,getTicksCeil(interval_ms));
+        entry.slack_ticks = static_cast<u64>(
+                    std::max(slack_ms,Milliseconds(0))/m_resolution);
+        entry.deadline_tick = std::max(deadline_tick,m_tick+1);
+        entry.expiry_tick = CoalesceDeadline(entry.deadline_tick,entry.slack_ticks);
+        insert(index);
+
+        // Advance schedules the next wakeup once it's done
+        if(!m_advancing && entry.expiry_tick < m_wakeup_tick) {
+            scheduleWakeup(now);
+        }
+    }
+
+    void TimerWheel::stopTimer(uint index)
+    {
+        Entry &entry = m_list_entries[index];
+        if(entry.active) {
+            unlink(index);
+            entry.active = false;
+            m_active_count--;
+        }
+    }
+
+    bool TimerWheel::getTimerActive(uint index) const
+    {
+        return m_list_entries[index].active;
+    }
+
+    void TimerWheel::onTimeout()
+    {
+        m_wakeup_tick = k_no_tick;
+        Advance(Clock::now());
+    }
+
+    u64 TimerWheel::getTick(TimePoint time) const
+    {
+        if(time <= m_start) {
+            return 0;
+        }
+        return static_cast<u64>((time-m_start)/m_resolution);
+    }
+
+    TimerWheel::TimePoint TimerWheel::getTickTime(u64 tick) const
+    {
+        return m_start + m_resolution*static_cast<Clock::rep>(tick);
+    }
+
+    u64 TimerWheel::getTicksCeil(Clock::duration duration) const
+    {
+        if(duration <= Clock::duration::zero()) {
+            return 0;
+        }
+        return static_cast<u64>((duration+m_resolution-Clock::duration(1))/m_resolution);
+    }
+
+    u64 TimerWheel::getNextEventTick() const
+    {
+        u64 next_tick = k_no_tick;
+
+        // Level 0 slots hold the timers expiring in the
+        // next k_slot_count ticks
+        if(m_list_occupied[0]) {
+            u64 const tick = m_tick+1;
+            next_tick = tick + GetNextSetBit(m_list_occupied[0],tick & k_slot_mask);
+        }
+
+        // Higher level slots are cascaded at the start of the
+        // block of ticks they cover
+        for(uint level=1; level < k_level_count; level++) {
+            if(m_list_occupied[level] == 0) {
+                continue;
+            }
+            uint const shift = level*k_slot_bits;
+            u64 const block = (m_tick >> shift)+1;
+            u64 const tick =
+                    (block + GetNextSetBit(m_list_occupied[level],
+                                           block & k_slot_mask)) << shift;
+
+            next_tick = std::min(next_tick,tick);
+        }
+
+        return next_tick;
+    }
+
+    void TimerWheel::processTick(u64 tick,uint &fired)
+    {
+        m_tick = tick;
+
+        for(uint level=k_level_count-1; level > 0; level--) {
+            u64 const mask = (u64(1) << (level*k_slot_bits))-1;
+            if((tick & mask) == 0) {
+                cascade(level,tick);
+            }
+        }
+
+        // Callbacks can't add timers to this slot since
+        // new deadlines are always after the current tick
+        uint const slot = tick & k_slot_mask;
+        while(m_list_slot_heads[slot] != k_invalid) {
+            fireEntry(m_list_slot_heads[slot],fired);
+        }
+    }
+
+    void TimerWheel::fireEntry(uint index,uint &fired)
+    {
+        Entry &entry = m_list_entries[index];
+        unlink(index);
+
+        // Reschedule before the callback so that it can stop
+        // or restart the timer
+        if(entry.repeating) {
+            // Skip intervals that have already passed rather
+            // than firing several times in a row to catch up
+            u64 next_tick = entry.deadline_tick + entry.interval_ticks;
+            if(next_tick <= m_target_tick) {
+                u64 const missed = (m_target_tick-next_tick)/entry.interval_ticks + 1;
+                next_tick += missed*entry.interval_ticks;
+            }
+            entry.deadline_tick = next_tick;
+            entry.expiry_tick = CoalesceDeadline(next_tick,entry.slack_ticks);
+            insert(index);
+        }
+        else {
+            entry.active = false;
+            m_active_count--;
+        }
+
+        fired++;
+
+        // The callback may destroy this timer or add timers that
+        // reallocate the entry list so it's moved out while it runs
+        u64 const id = entry.id;
+        std::function<void()> callback = std::move(entry.callback);
+        {
+            KS_TRACE_SCOPE("WheelTimer","Timer");
+            callback();
+        }
+
+        if(m_list_entries.GetValid(index) &&
+           m_list_entries[index].id == id)
+        {
+            m_list_entries[index].callback = std::move(callback);
+        }
+    }
+
+    void TimerWheel::cascade(uint level,u64 tick)
+    {
+        uint const slot = level*k_slot_count +
+                ((tick >> (level*k_slot_bits)) & k_slot_mask);
+
+        uint index = m_list_slot_heads[slot];
+        m_list_slot_heads[slot] = k_invalid;
+        m_list_slot_tails[slot] = k_invalid;
+        m_list_occupied[level] &= ~(u64(1) << (slot & k_slot_mask));
+
+        while(index != k_invalid) {
+            uint const next = m_list_entries[index].next;
+            insert(index);
+            index = next;
+        }
+    }
+
+    void TimerWheel::insert(uint index)
+    {
+        Entry &entry = m_list_entries[index];
+
+        // Pick the lowest level whose range covers the deadline
+        u64 const delta = entry.expiry_tick - m_tick;
+        uint level=0;
+        while(level < k_level_count-1 &&
+              delta >= (u64(1) << ((level+1)*k_slot_bits)))
+        {
+            level++;
+        }
+
+        // Deadlines beyond the top level are parked in its
+        // furthest slot and placed again when it's cascaded
+        u64 const max_delta = (u64(1) << (k_level_count*k_slot_bits))-1;
+        u64 const tick = (delta > max_delta) ?
+                    (m_tick + max_delta) : entry.expiry_tick;
+
+        uint const bit = (tick >> (level*k_slot_bits)) & k_slot_mask;
+        uint const slot = level*k_slot_count + bit;
+
+        entry.slot = slot;
+        entry.next = k_invalid;
+        entry.prev = m_list_slot_tails[slot];
+        if(entry.prev == k_invalid) {
+            m_list_slot_heads[slot] = index;
+        }
+        else {
+            m_list_entries[entry.prev].next = index;
+        }
+        m_list_slot_tails[slot] = index;
+        m_list_occupied[level] |= (u64(1) << bit);
+    }
+
+    void TimerWheel::unlink(uint index)
+    {
+        Entry &entry = m_list_entries[index];
+        uint const slot = entry.slot;
+
+        if(entry.prev == k_invalid) {
+            m_list_slot_heads[slot] = entry.next;
+        }
+        else {
+            m_list_entries[entry.prev].next = entry.next;
+        }
+
+        if(entry.next == k_invalid) {
+            m_list_slot_tails[slot] = entry.prev;
+        }
+        else {
+            m_list_entries[entry.next].prev = entry.prev;
+        }
+
+        if(m_list_slot_heads[slot] == k_invalid) {
+            m_list_occupied[slot/k_slot_count] &=
+                    ~(u64(1) << (slot & k_slot_mask));
+        }
+
+        entry.prev = k_invalid;
+        entry.next = k_invalid;
+        entry.slot = k_invalid;
+    }
+
+    void TimerWheel::scheduleWakeup(TimePoint now)
+    {
+        u64 const tick = getNextEventTick();
+        if(tick == k_no_tick) {
+            if(m_wakeup_tick != k_no_tick) {
+                m_timer->Stop();
+                m_wakeup_tick = k_no_tick;
+            }
+            return;
+        }
+
+        m_wakeup_tick = tick;
+
+        TimePoint const time = getTickTime(tick);
+        Milliseconds delay_ms(0);
+        if(time > now) {
+            auto const delay = time-now;
+            delay_ms = std::chrono::duration_cast<Milliseconds>(delay);
+            if(delay_ms < delay) {
+                delay_ms += Milliseconds(1);
+            }
+        }
+
+        m_timer->Start(delay_ms,false);
+    }
+
+    // ============================================================= //
+
+    WheelTimer::WheelTimer(shared_ptr<TimerWheel> const &timer_wheel,
+                           Milliseconds interval_ms,
+                           std::function<void()> callback) :
+        m_timer_wheel(timer_wheel),
+        m_index(timer_wheel->createTimer(std::move(callback))),
+        m_interval_ms(interval_ms),
+        m_slack_ms(0),
+        m_repeating(true)
+    {
+
+    }
+
+    WheelTimer::~WheelTimer()
+    {
+        m_timer_wheel->destroyTimer(m_index);
+    }
+
+    void WheelTimer::SetRepeating(bool repeating)
+    {
+        m_repeating = repeating;
+    }
+
+    void WheelTimer::SetInterval(Milliseconds interval_ms)
+    {
+        m_interval_ms = interval_ms;
+    }
+
+    void WheelTimer::SetSlack(Milliseconds slack_ms)
+    {
+        m_slack_ms = slack_ms;
+    }
+
+    void WheelTimer::Start()
+    {
+        m_timer_wheel->startTimer(m_index,m_interval_ms,m_slack_ms,m_repeating);
+    }
+
+    void WheelTimer::Stop()
+    {
+        m_timer_wheel->stopTimer(m_index);
+    }
+
+    bool WheelTimer::GetActive() const
+    {
+        return m_timer_wheel->getTimerActive(m_index);
+    }
+
+    // ============================================================= //
+}
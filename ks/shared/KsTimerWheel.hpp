@@ -0,0 +1,207 @@
+/*
+   Copyright (C) 2015 Preet Desai (preet.desai@gmail.com)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef KS_TIMER_WHEEL_HPP
+#define KS_TIMER_WHEEL_HPP
+
+#include <array>
+#include <chrono>
+#include <limits>
+#include <ks/KsTimer.hpp>
+#include <ks/shared/KsCallbackTimer.hpp>
+#include <ks/shared/KsRecycleIndexList.hpp>
+
+namespace ks
+{
+    // ============================================================= //
+
+    // TimerWheel
+    // * a hierarchical timing wheel that runs many WheelTimers
+    //   off of a single ks::Timer on its event loop
+    // * starting, stopping and firing a timer are O(1); the
+    //   wheel has four levels of 64 slots so deadlines up to
+    //   64^4 ticks away are placed directly and later ones are
+    //   placed again as they come into range
+    // * timers never fire early; they fire on the first tick
+    //   at or after their deadline, so they may be up to one
+    //   resolution late
+    // * timers that allow some slack are moved to the most
+    //   aligned tick within their slack so that timers with
+    //   nearby deadlines share a tick and a single wakeup
+    // * the ks::Timer only runs while timers are active and is
+    //   scheduled for the next tick that has work to do rather
+    //   than every tick
+    // * a TimerWheel and its WheelTimers must only be used from
+    //   the wheel's event loop thread
+    class TimerWheel final : public ks::Object
+    {
+        friend class WheelTimer;
+
+    public:
+        using Clock = std::chrono::steady_clock;
+        using TimePoint = Clock::time_point;
+
+        TimerWheel(ks::Object::Key const &key,
+                   shared_ptr<EventLoop> const &evloop,
+                   Milliseconds resolution_ms=Milliseconds(1));
+
+        void Init(ks::Object::Key const &,
+                  shared_ptr<TimerWheel> const &);
+
+        ~TimerWheel();
+
+        Milliseconds GetResolution() const;
+
+        // Number of WheelTimers that use this wheel
+        uint GetTimerCount() const;
+
+        // Number of WheelTimers that are currently started
+        uint GetActiveCount() const;
+
+        // Advance
+        // * fires every timer whose deadline is at or before
+        //   the given time and returns how many were fired
+        // * called by the wheel's ks::Timer; it may also be
+        //   called directly to drive the wheel by hand
+        // * calls made from within a timer callback are ignored
+        uint Advance(TimePoint now=Clock::now());
+
+    private:
+        static uint const k_level_count = 4;
+        static uint const k_slot_bits = 6;
+        static uint const k_slot_count = 1 << k_slot_bits;
+        static uint const k_slot_mask = k_slot_count-1;
+        static uint const k_invalid = std::numeric_limits<uint>::max();
+        static u64 const k_no_tick = std::numeric_limits<u64>::max();
+
+        // The wheel's slots are intrusive doubly linked lists
+        // of entries so a timer can be unlinked in O(1)
+        struct Entry
+        {
+            u64 id;
+            u64 deadline_tick; // without slack
+            u64 expiry_tick; // with slack
+            u64 interval_ticks;
+            u64 slack_ticks;
+            uint prev;
+            uint next;
+            uint slot;
+            bool active;
+            bool repeating;
+            std::function<void()> callback;
+        };
+
+        // Used by WheelTimer
+        uint createTimer(std::function<void()> callback);
+        void destroyTimer(uint index);
+        void startTimer(uint index,
+                        Milliseconds interval_ms,
+                        Milliseconds slack_ms,
+                        bool repeating);
+        void stopTimer(uint index);
+        bool getTimerActive(uint index) const;
+
+        void onTimeout();
+
+        u64 getTick(TimePoint time) const;
+        TimePoint getTickTime(u64 tick) const;
+        u64 getTicksCeil(Clock::duration duration) const;
+        u64 getNextEventTick() const;
+        void processTick(u64 tick,uint &fired);
+        void fireEntry(uint index,uint &fired);
+        void cascade(uint level,u64 tick);
+        void insert(uint index);
+        void unlink(uint index);
+        void scheduleWakeup(TimePoint now);
+
+        shared_ptr<Timer> const m_timer;
+        Clock::duration const m_resolution;
+        TimePoint const m_start;
+
+        // The last tick that was processed
+        u64 m_tick;
+
+        // The tick Advance is advancing to
+        u64 m_target_tick;
+
+        // The tick the ks::Timer is scheduled for
+        u64 m_wakeup_tick;
+
+        bool m_advancing;
+        u64 m_next_id;
+        uint m_active_count;
+
+        RecycleIndexList<Entry,uint,RecycleIndexListRemovalPolicy::None>
+                m_list_entries;
+
+        std::array<uint,k_level_count*k_slot_count> m_list_slot_heads;
+        std::array<uint,k_level_count*k_slot_count> m_list_slot_tails;
+
+        // A bit per slot that is set when the slot isn't empty
+        std::array<u64,k_level_count> m_list_occupied;
+    };
+
+    // ============================================================= //
+
+    // WheelTimer
+    // * a lightweight timer run by a TimerWheel with the same
+    //   interface as CallbackTimer; it isn't a ks::Object and
+    //   doesn't own a ks::Timer or a signal connection
+    // * repeating by default; the interval, slack and repeating
+    //   flag take effect on the next call to Start
+    // * callbacks are invoked on the wheel's event loop thread
+    //   and may start, stop or destroy any timer, including
+    //   the one being fired
+    class WheelTimer final
+    {
+    public:
+        WheelTimer(shared_ptr<TimerWheel> const &timer_wheel,
+                   Milliseconds interval_ms,
+                   std::function<void()> callback);
+
+        ~WheelTimer();
+
+        WheelTimer(WheelTimer const &) = delete;
+        WheelTimer & operator=(WheelTimer const &) = delete;
+
+        void SetRepeating(bool repeating);
+        void SetInterval(Milliseconds interval_ms);
+
+        // SetSlack
+        // * lets the timer fire up to slack_ms after its deadline
+        //   so that it can be coalesced with other timers
+        // * repeating timers keep their phase; slack is applied
+        //   to each deadline separately and doesn't accumulate
+        void SetSlack(Milliseconds slack_ms);
+
+        void Start();
+        void Stop();
+
+        bool GetActive() const;
+
+    private:
+        shared_ptr<TimerWheel> const m_timer_wheel;
+        uint const m_index;
+
+        Milliseconds m_interval_ms;
+        Milliseconds m_slack_ms;
+        bool m_repeating;
+    };
+
+    // ============================================================= //
+}
+
+#endif // KS_TIMER_WHEEL_HPP
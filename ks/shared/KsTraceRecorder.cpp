@@ -0,0 +1,414 @@
+/*
+   Copyright (C) 2015 Preet Desai (preet.desai@gmail.com)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <ks/shared/KsTraceRecorder.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <unordered_set>
+#include <vector>
+
+namespace ks
+{
+    // ============================================================= //
+
+    namespace trace_detail
+    {
+        std::atomic<bool> g_enabled(false);
+    }
+
+#if !defined(KS_NO_TRACE)
+    namespace
+    {
+        using Clock = std::chrono::steady_clock;
+
+        s64 GetTimeNs()
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        Clock::now().time_since_epoch()).count();
+        }
+
+        // Fields are relaxed atomics so that dumping while
+        // events are recorded is well defined; the dump checks
+        // the claimed index again to drop overwritten events
+        struct TraceEvent
+        {
+            std::atomic<s64> time_ns;
+            std::atomic<char const *> name;
+            std::atomic<char const *> category;
+            std::atomic<char> phase;
+        };
+
+        uint const k_buffer_mask = TraceRecorder::k_buffer_capacity-1;
+
+        static_assert((TraceRecorder::k_buffer_capacity &
+                       (TraceRecorder::k_buffer_capacity-1)) == 0,
+                      "TraceRecorder: capacity must be a power of two");
+
+        // The events in a buffer recorded by one thread,
+        // starting at begin_index
+        struct TraceThread
+        {
+            u64 begin_index;
+            uint tid;
+            std::string thread_name;
+        };
+
+        // A single writer ring buffer. The writer claims an index
+        // before writing its event and publishes it afterwards so
+        // a reader can tell which events were overwritten while
+        // it was copying them
+        struct TraceBuffer
+        {
+            TraceBuffer() :
+                list_events(new TraceEvent[TraceRecorder::k_buffer_capacity]),
+                claim_index(0),
+                publish_index(0),
+                in_use(true)
+            {}
+
+            std::unique_ptr<TraceEvent[]> list_events;
+            std::atomic<u64> claim_index;
+            std::atomic<u64> publish_index;
+            std::atomic<bool> in_use;
+
+            // Threads that have used this buffer, oldest first;
+            // guarded by TraceRegistry::mutex
+            std::vector<TraceThread> list_threads;
+        };
+
+        struct TraceRegistry
+        {
+            TraceRegistry() :
+                next_tid(0),
+                start_ns(GetTimeNs()),
+                clear_ns(0)
+            {}
+
+            TraceBuffer* Acquire(std::string thread_name)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+
+                // Reuse the buffer of a thread that has exited. Its
+                // events stay in the buffer until overwritten, so
+                // the new thread gets its own id from the next index
+                for(auto &buffer : list_buffers) {
+                    if(!buffer->in_use) {
+                        buffer->in_use = true;
+
+                        u64 const begin_index = buffer->publish_index;
+                        auto &list_threads = buffer->list_threads;
+
+                        // Forget threads whose events have
+                        // all been overwritten
+                        while(list_threads.size() > 1 &&
+                              list_threads[1].begin_index+
+                              TraceRecorder::k_buffer_capacity <= begin_index)
+                        {
+                            list_threads.erase(list_threads.begin());
+                        }
+
+                        list_threads.push_back(
+                                    TraceThread{begin_index,next_tid++,std::move(thread_name)});
+                        return buffer.get();
+                    }
+                }
+
+                list_buffers.emplace_back(new TraceBuffer);
+                list_buffers.back()->list_threads.push_back(
+                            TraceThread{0,next_tid++,std::move(thread_name)});
+                return list_buffers.back().get();
+            }
+
+            std::mutex mutex;
+            std::vector<std::unique_ptr<TraceBuffer>> list_buffers;
+            uint next_tid;
+            std::unordered_set<std::string> set_names;
+            s64 const start_ns;
+            std::atomic<s64> clear_ns;
+        };
+
+        // Never destroyed so that threads that exit during
+        // static destruction can still release their buffer
+        TraceRegistry& GetTraceRegistry()
+        {
+            static TraceRegistry* registry = new TraceRegistry;
+            return *registry;
+        }
+
+        struct ThreadTraceBuffer
+        {
+            ThreadTraceBuffer() :
+                buffer(nullptr)
+            {}
+
+            ~ThreadTraceBuffer()
+            {
+                if(buffer) {
+                    buffer->in_use = false;
+                }
+            }
+
+            // Buffers are only acquired once the thread records
+            // an event so threads that are never traced don't
+            // use any memory
+            TraceBuffer* Get()
+            {
+                if(!buffer) {
+                    buffer = GetTraceRegistry().Acquire(std::move(thread_name));
+                }
+                return buffer;
+            }
+
+            TraceBuffer* buffer;
+
+            // Name to give the buffer once it's acquired
+            std::string thread_name;
+        };
+
+        thread_local ThreadTraceBuffer tl_trace_buffer;
+
+        void WriteJsonString(std::ostream &stream,char const * str)
+        {
+            stream << '"';
+            for(; str && *str; str++) {
+                char const c = *str;
+                if(c == '"' || c == '\\') {
+                    stream << '\\' << c;
+                }
+                else if(static_cast<unsigned char>(c) < 0x20) {
+                    char escaped[8];
+                    std::snprintf(escaped,sizeof(escaped),"\\u%04x",c);
+                    stream << escaped;
+                }
+                else {
+                    stream << c;
+                }
+            }
+            stream << '"';
+        }
+    }
+
+    // ============================================================= //
+
+    void TraceRecorder::SetEnabled(bool enabled)
+    {
+        // Make sure the registry's start time is set first
+        GetTraceRegistry();
+        trace_detail::g_enabled = enabled;
+    }
+
+    void TraceRecorder::SetThreadName(std::string name)
+    {
+        TraceBuffer* buffer = tl_trace_buffer.buffer;
+        if(!buffer) {
+            tl_trace_buffer.thread_name = std::move(name);
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(GetTraceRegistry().mutex);
+        buffer->list_threads.back().thread_name = std::move(name);
+    }
+
+    char const * TraceRecorder::Intern(std::string const &name)
+    {
+        auto &registry = GetTraceRegistry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+
+        // Elements of unordered_set aren't moved on rehash
+        auto it = registry.set_names.find(name);
+        if(it != registry.set_names.end()) {
+            return it->c_str();
+        }
+
+        if(registry.set_names.size() >= k_max_interned_names) {
+            return "(too many names)";
+        }
+
+        return registry.set_names.insert(name).first->c_str();
+    }
+
+    void TraceRecorder::Clear()
+    {
+        GetTraceRegistry().clear_ns = GetTimeNs();
+    }
+
+    void TraceRecorder::WriteChromeTrace(std::ostream &stream)
+    {
+        auto &registry = GetTraceRegistry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+
+        s64 const clear_ns = registry.clear_ns;
+
+        stream << "{\"traceEvents\":[";
+        bool first = true;
+
+        for(auto const &buffer : registry.list_buffers)
+        {
+            auto const &list_threads = buffer->list_threads;
+            for(auto const &thread : list_threads) {
+                if(thread.thread_name.empty()) {
+                    continue;
+                }
+                stream << (first ? "" : ",")
+                       << "{\"name\":\"thread_name\",\"ph\":\"M\","
+                          "\"pid\":1,\"tid\":" << thread.tid
+                       << ",\"args\":{\"name\":";
+                WriteJsonString(stream,thread.thread_name.c_str());
+                stream << "}}";
+                first = false;
+            }
+
+            u64 const end = buffer->publish_index.load(std::memory_order_acquire);
+            u64 const begin = (end > k_buffer_capacity) ?
+                        (end-k_buffer_capacity) : 0;
+
+            // Copy the events, then drop any that the writer
+            // may have overwritten while they were copied
+            struct Event
+            {
+                u64 index;
+                s64 time_ns;
+                char const * name;
+                char const * category;
+                char phase;
+            };
+
+            std::vector<Event> list_events;
+            list_events.reserve(end-begin);
+            for(u64 i=begin; i < end; i++) {
+                auto const &src = buffer->list_events[i & k_buffer_mask];
+                list_events.push_back(Event{
+                    i,
+                    src.time_ns.load(std::memory_order_relaxed),
+                    src.name.load(std::memory_order_relaxed),
+                    src.category.load(std::memory_order_relaxed),
+                    src.phase.load(std::memory_order_relaxed)});
+            }
+
+            // An event was overwritten if the writer has claimed
+            // the index that reuses its slot
+            std::atomic_thread_fence(std::memory_order_acquire);
+            u64 const claimed =
+                    buffer->claim_index.load(std::memory_order_relaxed);
+
+            // Events are in index order, so the thread that
+            // recorded each one is found by walking forward
+            uint thread_index = 0;
+
+            for(auto const &event : list_events) {
+                if(event.index+k_buffer_capacity < claimed ||
+                   event.time_ns < clear_ns) {
+                    continue;
+                }
+
+                while(thread_index+1 < list_threads.size() &&
+                      list_threads[thread_index+1].begin_index <= event.index) {
+                    thread_index++;
+                }
+
+                // Chrome expects microseconds
+                char ts_us[32];
+                std::snprintf(ts_us,sizeof(ts_us),"%.3f",
+                              (event.time_ns-registry.start_ns)/1000.0);
+
+                stream << (first ? "" : ",") << "{\"name\":";
+                WriteJsonString(stream,event.name);
+                stream << ",\"cat\":";
+                WriteJsonString(stream,event.category);
+                stream << ",\"ph\":\"" << event.phase << "\""
+                       << ",\"ts\":" << ts_us
+                       << ",\"pid\":1,\"tid\":" << list_threads[thread_index].tid << "}";
+                first = false;
+            }
+        }
+
+        stream << "],\"displayTimeUnit\":\"ns\"}";
+    }
+
+    std::string TraceRecorder::GetChromeTrace()
+    {
+        std::ostringstream stream;
+        WriteChromeTrace(stream);
+        return stream.str();
+    }
+
+    void TraceRecorder::record(char phase,
+                               char const * name,
+                               char const * category)
+    {
+        TraceBuffer* buffer = tl_trace_buffer.Get();
+
+        // Only this thread writes to its buffer
+        u64 const index = buffer->publish_index.load(std::memory_order_relaxed);
+        buffer->claim_index.store(index+1,std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        auto &event = buffer->list_events[index & k_buffer_mask];
+        event.time_ns.store(GetTimeNs(),std::memory_order_relaxed);
+        event.name.store(name,std::memory_order_relaxed);
+        event.category.store(category,std::memory_order_relaxed);
+        event.phase.store(phase,std::memory_order_relaxed);
+
+        buffer->publish_index.store(index+1,std::memory_order_release);
+    }
+
+#else // KS_NO_TRACE
+
+    void TraceRecorder::SetEnabled(bool)
+    {
+        // empty
+    }
+
+    void TraceRecorder::SetThreadName(std::string)
+    {
+        // empty
+    }
+
+    char const * TraceRecorder::Intern(std::string const &)
+    {
+        return "";
+    }
+
+    void TraceRecorder::Clear()
+    {
+        // empty
+    }
+
+    void TraceRecorder::WriteChromeTrace(std::ostream &stream)
+    {
+        stream << "{\"traceEvents\":[],\"displayTimeUnit\":\"ns\"}";
+    }
+
+    std::string TraceRecorder::GetChromeTrace()
+    {
+        std::ostringstream stream;
+        WriteChromeTrace(stream);
+        return stream.str();
+    }
+
+    void TraceRecorder::record(char,char const *,char const *)
+    {
+        // empty
+    }
+
+#endif // KS_NO_TRACE
+
+    // ============================================================= //
+}
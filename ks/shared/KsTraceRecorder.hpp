@@ -0,0 +1,158 @@
+/*
+   Copyright (C) 2015 Preet Desai (preet.desai@gmail.com)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef KS_TRACE_RECORDER_HPP
+#define KS_TRACE_RECORDER_HPP
+
+#include <atomic>
+#include <string>
+#include <ostream>
+
+#include <ks/KsGlobal.hpp>
+
+// Tracing is compiled in unless KS_NO_TRACE is defined (qmake:
+// CONFIG += ks_no_trace), in which case the KS_TRACE_* macros
+// expand to nothing and TraceRecorder doesn't record anything.
+// When compiled in, tracing is off until TraceRecorder::SetEnabled
+// is called and each trace point only costs a relaxed load.
+
+#define KS_TRACE_CONCAT_IMPL(a,b) a##b
+#define KS_TRACE_CONCAT(a,b) KS_TRACE_CONCAT_IMPL(a,b)
+
+#if !defined(KS_NO_TRACE)
+    // Records begin and end events for the enclosing scope
+    #define KS_TRACE_SCOPE(name,category) \
+        ks::TraceScope const KS_TRACE_CONCAT(ks_trace_scope_,__LINE__)(name,category)
+
+    #define KS_TRACE_BEGIN(name,category) \
+        ks::TraceRecorder::Begin(name,category)
+
+    #define KS_TRACE_END(name,category) \
+        ks::TraceRecorder::End(name,category)
+#else
+    #define KS_TRACE_SCOPE(name,category)
+    #define KS_TRACE_BEGIN(name,category)
+    #define KS_TRACE_END(name,category)
+#endif
+
+namespace ks
+{
+    // ============================================================= //
+
+    namespace trace_detail
+    {
+        extern std::atomic<bool> g_enabled;
+    }
+
+    // TraceRecorder
+    // * records begin/end events into a fixed size ring buffer
+    //   owned by each thread; recording doesn't lock or allocate
+    //   and once a buffer is full the oldest events are replaced
+    // * names and categories are stored as pointers and must
+    //   outlive the trace; use string literals or Intern
+    // * WriteChromeTrace dumps every thread's events as Chrome
+    //   trace JSON (chrome://tracing, ui.perfetto.dev). Events
+    //   written while dumping may be left out
+    // * buffers of threads that exit are kept (and reused by
+    //   new threads) so their events can still be dumped; events
+    //   keep the id and name of the thread that recorded them
+    class TraceRecorder final
+    {
+    public:
+        // Events kept per thread
+        static uint const k_buffer_capacity = 16384;
+
+        // Maximum number of names Intern keeps
+        static uint const k_max_interned_names = 4096;
+
+        static void SetEnabled(bool enabled);
+
+        static bool IsEnabled()
+        {
+#if !defined(KS_NO_TRACE)
+            return trace_detail::g_enabled.load(std::memory_order_relaxed);
+#else
+            return false;
+#endif
+        }
+
+        static void Begin(char const * name,char const * category)
+        {
+            if(IsEnabled()) {
+                record('B',name,category);
+            }
+        }
+
+        static void End(char const * name,char const * category)
+        {
+            if(IsEnabled()) {
+                record('E',name,category);
+            }
+        }
+
+        // Names the calling thread in dumped traces
+        static void SetThreadName(std::string name);
+
+        // Returns a pointer to a copy of name that lives as
+        // long as the program; repeated calls with the same
+        // name return the same pointer. This locks, so callers
+        // should cache the result
+        // * interned names are never freed, so once there are
+        //   k_max_interned_names of them new names are traced
+        //   as "(too many names)"
+        static char const * Intern(std::string const &name);
+
+        // Drops all events recorded so far
+        static void Clear();
+
+        static void WriteChromeTrace(std::ostream &stream);
+        static std::string GetChromeTrace();
+
+    private:
+        static void record(char phase,
+                           char const * name,
+                           char const * category);
+    };
+
+    // ============================================================= //
+
+    class TraceScope final
+    {
+    public:
+        TraceScope(char const * name,char const * category) :
+            m_name(name),
+            m_category(category)
+        {
+            TraceRecorder::Begin(m_name,m_category);
+        }
+
+        ~TraceScope()
+        {
+            TraceRecorder::End(m_name,m_category);
+        }
+
+        TraceScope(TraceScope const &) = delete;
+        TraceScope & operator=(TraceScope const &) = delete;
+
+    private:
+        char const * const m_name;
+        char const * const m_category;
+    };
+
+    // ============================================================= //
+}
+
+#endif // KS_TRACE_RECORDER_HPP
@@ -0,0 +1,247 @@
+/*
+   Copyright (C) 2015 Preet Desai (preet.desai@gmail.com)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <catch/catch.hpp>
+#include <memory>
+#include <stdexcept>
+#include <ks/KsLog.hpp>
+#include <ks/shared/KsAsyncTask.hpp>
+
+// Only built with C++20 coroutine support
+#if defined(KS_ASYNC_TASK_AVAILABLE)
+
+namespace
+{
+    using namespace ks;
+
+    AsyncTask<uint> AddOnPool(ThreadPool &thread_pool,
+                              uint a,
+                              uint b,
+                              std::thread::id* thread_id)
+    {
+        co_await thread_pool.Schedule();
+        *thread_id = std::this_thread::get_id();
+        co_return a+b;
+    }
+
+    AsyncTask<uint> Pipeline(ThreadPool &thread_pool,
+                             std::atomic<uint>* stage)
+    {
+        std::thread::id thread_id;
+        uint sum = co_await AddOnPool(thread_pool,1,2,&thread_id);
+        (*stage)++;
+
+        co_await thread_pool.ScheduleAfter(Milliseconds(1));
+        (*stage)++;
+
+        std::atomic<uint> value(0);
+        auto task = thread_pool.Submit([&value](){ value = 4; });
+        co_await AwaitTask(thread_pool,task);
+        (*stage)++;
+
+        co_return sum+value;
+    }
+
+    AsyncTask<void> Throw(ThreadPool &thread_pool)
+    {
+        co_await thread_pool.Schedule();
+        throw std::runtime_error("AsyncTask test");
+    }
+
+    AsyncTask<bool> CatchThrown(ThreadPool &thread_pool)
+    {
+        try {
+            co_await Throw(thread_pool);
+        }
+        catch(std::runtime_error const &) {
+            co_return true;
+        }
+        co_return false;
+    }
+
+    AsyncTask<uint> Delayed(ThreadPool &thread_pool,Milliseconds delay)
+    {
+        co_await thread_pool.ScheduleAfter(delay);
+        co_return 1;
+    }
+
+    AsyncTask<bool> DelayedSubmit(ThreadPool &thread_pool,Milliseconds delay)
+    {
+        co_await thread_pool.ScheduleAfter(delay);
+        co_await thread_pool.Schedule();
+        co_return (thread_pool.Submit([](){}) != nullptr);
+    }
+
+    AsyncTask<uint> Await(ThreadPool &thread_pool,
+                          shared_ptr<ThreadPool::Task> task)
+    {
+        co_await AwaitTask(thread_pool,task);
+        co_return 1;
+    }
+
+    AsyncTask<void> Count(ThreadPool &thread_pool,std::atomic<uint>* count)
+    {
+        co_await thread_pool.Schedule();
+        (*count)++;
+    }
+}
+
+TEST_CASE("AsyncTask","[asynctask]")
+{
+    using namespace ks;
+
+    SECTION("Coroutines are resumed on workers")
+    {
+        ThreadPool thread_pool(2);
+
+        std::thread::id thread_id;
+        auto task = AddOnPool(thread_pool,1,2,&thread_id);
+        REQUIRE(task.Get() == 3);
+        REQUIRE(task.IsDone());
+        REQUIRE(thread_id != std::this_thread::get_id());
+    }
+
+    SECTION("Coroutines run until their first suspension")
+    {
+        ThreadPool thread_pool(0);
+
+        std::thread::id thread_id;
+        auto task = AddOnPool(thread_pool,1,2,&thread_id);
+        REQUIRE_FALSE(task.IsDone());
+        REQUIRE(thread_pool.GetTaskCount() == 1);
+
+        // Resumed by whichever thread runs the task
+        thread_pool.ProcessTask();
+        REQUIRE(task.IsDone());
+        REQUIRE(task.Get() == 3);
+        REQUIRE(thread_id == std::this_thread::get_id());
+    }
+
+    SECTION("Awaiting coroutines, delays and tasks")
+    {
+        for(uint thread_count : { 1u, 4u })
+        {
+            ThreadPool thread_pool(thread_count);
+            std::atomic<uint> stage(0);
+
+            auto const start = ThreadPool::Clock::now();
+            auto task = Pipeline(thread_pool,&stage);
+            REQUIRE(task.Get() == 7);
+            REQUIRE(stage.load() == 3);
+            bool const delayed =
+                    (ThreadPool::Clock::now()-start >= Milliseconds(1));
+            REQUIRE(delayed);
+        }
+    }
+
+    SECTION("Exceptions are rethrown")
+    {
+        ThreadPool thread_pool(2);
+
+        auto task = Throw(thread_pool);
+        REQUIRE_THROWS(task.Get());
+
+        REQUIRE(CatchThrown(thread_pool).Get());
+    }
+
+    SECTION("Dropped delays resume right away")
+    {
+        // The pool is destroyed while the coroutine waits
+        auto thread_pool = std::make_unique<ThreadPool>(1);
+        auto task = Delayed(*thread_pool,Milliseconds(60000));
+        REQUIRE_FALSE(task.IsDone());
+        thread_pool.reset();
+        REQUIRE(task.IsDone());
+        REQUIRE(task.Get() == 1);
+
+        // The resumption is rejected by a full queue
+        ThreadPool::Options options;
+        options.queue_type = ThreadPool::QueueType::BoundedRing;
+        options.queue_capacity = 1;
+        options.overflow_policy = ThreadPool::OverflowPolicy::Reject;
+        ThreadPool full_thread_pool(0,options);
+        while(full_thread_pool.Submit([](){}) != nullptr) {}
+        uint const task_count = full_thread_pool.GetTaskCount();
+
+        auto rejected_task = Delayed(full_thread_pool,Milliseconds(1));
+        REQUIRE(rejected_task.Get() == 1);
+        REQUIRE(full_thread_pool.GetTaskCount() == task_count);
+    }
+
+    SECTION("Coroutines resumed while the pool is destroyed")
+    {
+        // The workers are stopped and the pool rejects new
+        // tasks before dropped delays are resumed
+        auto thread_pool = std::make_unique<ThreadPool>(2);
+        auto task = DelayedSubmit(*thread_pool,Milliseconds(60000));
+        REQUIRE_FALSE(task.IsDone());
+        thread_pool.reset();
+        REQUIRE(task.IsDone());
+        REQUIRE_FALSE(task.Get());
+    }
+
+    SECTION("Awaiting tasks on a full pool")
+    {
+        ThreadPool::Options options;
+        options.queue_type = ThreadPool::QueueType::BoundedRing;
+        options.queue_capacity = 1;
+        options.overflow_policy = ThreadPool::OverflowPolicy::Reject;
+        ThreadPool full_thread_pool(0,options);
+        while(full_thread_pool.Submit([](){}) != nullptr) {}
+        uint const task_count = full_thread_pool.GetTaskCount();
+
+        // The resumption is rejected when the awaited task
+        // ends, so the coroutine is resumed by that thread
+        ThreadPool thread_pool(0);
+        auto awaited_task = thread_pool.Submit([](){});
+        auto task = Await(full_thread_pool,awaited_task);
+        REQUIRE_FALSE(task.IsDone());
+        thread_pool.ProcessTask();
+        REQUIRE(task.IsDone());
+        REQUIRE(task.Get() == 1);
+
+        // The awaited task has already ended
+        REQUIRE(Await(full_thread_pool,awaited_task).Get() == 1);
+        REQUIRE(full_thread_pool.GetTaskCount() == task_count);
+    }
+
+    SECTION("Many coroutines")
+    {
+        ThreadPool thread_pool(4);
+        std::atomic<uint> count(0);
+
+        std::vector<AsyncTask<void>> list_tasks;
+        for(uint i=0; i < 1000; i++) {
+            list_tasks.push_back(Count(thread_pool,&count));
+        }
+
+        // Dropped tasks still run to completion
+        for(uint i=0; i < 1000; i++) {
+            Count(thread_pool,&count);
+        }
+
+        for(auto &task : list_tasks) {
+            task.Wait();
+        }
+
+        while(count < 2000) {
+            std::this_thread::yield();
+        }
+        REQUIRE(count.load() == 2000);
+    }
+}
+
+#endif // KS_ASYNC_TASK_AVAILABLE
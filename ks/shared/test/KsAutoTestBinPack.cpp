@@ -0,0 +1,625 @@
+/*
+   Copyright (C) 2015 Preet Desai (preet.desai@gmail.com)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <catch/catch.hpp>
+#include <random>
+#include <ks/shared/KsBinPackShelf.hpp>
+#include <ks/shared/KsBinPackBatch.hpp>
+#include <ks/shared/KsBinPackAtlas.hpp>
+#include <ks/shared/KsBinPackDynamic.hpp>
+#include <ks/shared/KsBinPackMaxRects.hpp>
+#include <ks/shared/KsBinPackSkyline.hpp>
+
+namespace
+{
+    using namespace ks;
+
+    // Checks that every rectangle and its padding is inside
+    // the bin and that the rectangles are at least spacing
+    // apart, plus the padding of each
+    bool CheckPlacement(std::vector<BinPackRectangle> const &list_rects,
+                        uint bin_width,
+                        uint bin_height,
+                        uint spacing)
+    {
+        for(size_t i=0; i < list_rects.size(); i++) {
+            auto const &a = list_rects[i];
+            if(a.x < spacing+a.padding || a.y < spacing+a.padding ||
+               a.x+a.width+a.padding > bin_width ||
+               a.y+a.height+a.padding > bin_height)
+            {
+                return false;
+            }
+
+            for(size_t j=i+1; j < list_rects.size(); j++) {
+                auto const &b = list_rects[j];
+                uint const gap = a.padding+spacing+b.padding;
+                bool const apart =
+                        (a.x+a.width+gap <= b.x) ||
+                        (b.x+b.width+gap <= a.x) ||
+                        (a.y+a.height+gap <= b.y) ||
+                        (b.y+b.height+gap <= a.y);
+                if(!apart) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    template<typename BinPack>
+    std::vector<BinPackRectangle> FillBin(BinPack &bin,
+                                          uint seed,
+                                          uint &fail_count,
+                                          uint max_padding=0)
+    {
+        std::mt19937 rng(seed);
+        std::uniform_int_distribution<uint> dist_size(1,40);
+        std::uniform_int_distribution<uint> dist_padding(0,max_padding);
+
+        std::vector<BinPackRectangle> list_rects;
+        fail_count=0;
+        for(uint i=0; i < 2000; i++) {
+            BinPackRectangle rect;
+            rect.width = dist_size(rng);
+            rect.height = dist_size(rng);
+            rect.padding = dist_padding(rng);
+            if(bin.AddRectangle(rect)) {
+                list_rects.push_back(rect);
+            }
+            else {
+                fail_count++;
+            }
+        }
+        return list_rects;
+    }
+
+    template<typename BinPack>
+    void TestBinPack()
+    {
+        SECTION("Exact fit")
+        {
+            // Four quarters fill the bin with no spacing
+            BinPack bin(64,64,0);
+            std::vector<BinPackRectangle> list_rects(4);
+            for(auto &rect : list_rects) {
+                rect.width = 32;
+                rect.height = 32;
+                REQUIRE(bin.AddRectangle(rect));
+            }
+            REQUIRE(CheckPlacement(list_rects,64,64,0));
+
+            BinPackRectangle rect;
+            rect.width = 1;
+            rect.height = 1;
+            REQUIRE_FALSE(bin.AddRectangle(rect));
+        }
+
+        SECTION("Too large")
+        {
+            BinPack bin(64,64,1);
+            BinPackRectangle rect;
+            rect.width = 64;
+            rect.height = 8;
+            REQUIRE_FALSE(bin.AddRectangle(rect));
+
+            rect.width = 63;
+            REQUIRE(bin.AddRectangle(rect));
+            REQUIRE(rect.x == 1);
+            REQUIRE(rect.y == 1);
+        }
+
+        SECTION("Random rectangles")
+        {
+            for(uint spacing : { 0u, 1u, 3u }) {
+                BinPack bin(512,512,spacing);
+                uint fail_count;
+                auto const list_rects = FillBin(bin,spacing+1,fail_count);
+                REQUIRE(fail_count > 0);
+                REQUIRE(CheckPlacement(list_rects,512,512,spacing));
+            }
+        }
+
+        SECTION("Padding")
+        {
+            BinPack bin(64,64,1);
+            BinPackRectangle rect;
+            rect.width = 8;
+            rect.height = 8;
+            rect.padding = 2;
+            REQUIRE(bin.AddRectangle(rect));
+            REQUIRE(rect.x == 3);
+            REQUIRE(rect.y == 3);
+
+            // Fills the bin up to the padding on the right
+            rect.width = 64-1-2*2;
+            rect.height = 4;
+            REQUIRE(bin.AddRectangle(rect));
+            uint const right = rect.x+rect.width+rect.padding;
+            REQUIRE(right == 64);
+
+            for(uint spacing : { 0u, 1u }) {
+                BinPack random_bin(512,512,spacing);
+                uint fail_count;
+                auto const list_rects =
+                        FillBin(random_bin,spacing+7,fail_count,3);
+                REQUIRE(fail_count > 0);
+                REQUIRE(CheckPlacement(list_rects,512,512,spacing));
+            }
+        }
+    }
+}
+
+TEST_CASE("BinPackShelf","[binpack]")
+{
+    SECTION("Shelves")
+    {
+        BinPackShelf bin(64,64,1);
+        uint const list_sizes[4][2] = {
+            {20,10}, {20,15}, {30,5}, {10,10}
+        };
+        uint const list_expected[4][2] = {
+            {1,1}, {22,1}, {1,17}, {32,17}
+        };
+
+        for(uint i=0; i < 4; i++) {
+            BinPackRectangle rect;
+            rect.width = list_sizes[i][0];
+            rect.height = list_sizes[i][1];
+            REQUIRE(bin.AddRectangle(rect));
+            REQUIRE(rect.x == list_expected[i][0]);
+            REQUIRE(rect.y == list_expected[i][1]);
+            REQUIRE_FALSE(rect.rotated);
+        }
+
+        // Too wide for the bin; doesn't affect later rectangles
+        BinPackRectangle rect;
+        rect.width = 63;
+        rect.height = 1;
+        REQUIRE_FALSE(bin.AddRectangle(rect));
+
+        rect.width = 10;
+        rect.height = 10;
+        REQUIRE(bin.AddRectangle(rect));
+        REQUIRE(rect.x == 43);
+        REQUIRE(rect.y == 17);
+    }
+
+    SECTION("Rotation")
+    {
+        BinPackShelf bin(64,32,0);
+        BinPackRectangle rect;
+        rect.width = 10;
+        rect.height = 40;
+        REQUIRE_FALSE(bin.AddRectangle(rect));
+
+        bin.SetAllowRotation(true);
+        REQUIRE(bin.AddRectangle(rect));
+        REQUIRE(rect.rotated);
+        REQUIRE(rect.width == 40);
+        REQUIRE(rect.height == 10);
+
+        // Turned to fit under the current shelf height
+        BinPackRectangle other;
+        other.width = 8;
+        other.height = 12;
+        REQUIRE(bin.AddRectangle(other));
+        REQUIRE(other.rotated);
+        REQUIRE(other.x == 40);
+        REQUIRE(other.y == 0);
+
+        // Squares are never rotated
+        BinPackRectangle square;
+        square.width = 5;
+        square.height = 5;
+        REQUIRE(bin.AddRectangle(square));
+        REQUIRE_FALSE(square.rotated);
+    }
+
+    SECTION("Padding and alignment")
+    {
+        std::mt19937 rng(3);
+        std::uniform_int_distribution<uint> dist_size(1,40);
+        std::uniform_int_distribution<uint> dist_padding(0,3);
+
+        BinPackShelf bin(512,512,1);
+        bin.SetAllowRotation(true);
+        bin.SetAlignment(4);
+
+        std::vector<BinPackRectangle> list_rects;
+        for(uint i=0; i < 1000; i++) {
+            BinPackRectangle rect;
+            rect.width = dist_size(rng);
+            rect.height = dist_size(rng);
+            rect.padding = dist_padding(rng);
+            if(bin.AddRectangle(rect)) {
+                list_rects.push_back(rect);
+            }
+        }
+        REQUIRE(list_rects.size() < 1000);
+
+        for(size_t i=0; i < list_rects.size(); i++) {
+            auto const &a = list_rects[i];
+            bool const aligned = (a.x % 4 == 0) && (a.y % 4 == 0);
+            REQUIRE(aligned);
+
+            bool const inside =
+                    (a.x >= 1+a.padding) && (a.y >= 1+a.padding) &&
+                    (a.x+a.width+a.padding < 512) &&
+                    (a.y+a.height+a.padding < 512);
+            REQUIRE(inside);
+
+            // Each side's padding and the spacing between
+            for(size_t j=i+1; j < list_rects.size(); j++) {
+                auto const &b = list_rects[j];
+                uint const gap = a.padding+1+b.padding;
+                bool const apart =
+                        (a.x+a.width+gap <= b.x) ||
+                        (b.x+b.width+gap <= a.x) ||
+                        (a.y+a.height+gap <= b.y) ||
+                        (b.y+b.height+gap <= a.y);
+                REQUIRE(apart);
+            }
+        }
+    }
+}
+
+TEST_CASE("BinPackMaxRects","[binpack]")
+{
+    TestBinPack<BinPackMaxRects>();
+}
+
+TEST_CASE("BinPackSkyline","[binpack]")
+{
+    TestBinPack<BinPackSkyline>();
+}
+
+TEST_CASE("BinPack density","[binpack]")
+{
+    // Both packers should place more of the same rectangles
+    // than the shelf packer does
+    uint fail_count;
+
+    BinPackShelf shelf(512,512,1);
+    auto const shelf_count = FillBin(shelf,7,fail_count).size();
+
+    BinPackMaxRects max_rects(512,512,1);
+    auto const max_rects_count = FillBin(max_rects,7,fail_count).size();
+
+    BinPackSkyline skyline(512,512,1);
+    auto const skyline_count = FillBin(skyline,7,fail_count).size();
+
+    REQUIRE(max_rects_count > shelf_count);
+    REQUIRE(skyline_count > shelf_count);
+}
+
+TEST_CASE("BinPackBatch","[binpack]")
+{
+    std::mt19937 rng(99);
+    std::uniform_int_distribution<uint> dist_size(1,40);
+
+    std::vector<BinPackRectangle> list_rects(1000);
+    for(auto &rect : list_rects) {
+        rect.width = dist_size(rng);
+        rect.height = dist_size(rng);
+    }
+
+    // Too large for any bin
+    list_rects[10].width = 300;
+
+    auto const list_original = list_rects;
+
+    BinPackBatch batch(256,256,1);
+    auto const result = batch.Pack(list_rects);
+
+    REQUIRE(result.bin_count > 1);
+    REQUIRE(result.list_bins.size() == list_rects.size());
+    REQUIRE(result.list_bin_sorts.size() == result.bin_count);
+    REQUIRE(result.list_bin_methods.size() == result.bin_count);
+    REQUIRE(result.list_bins[10] == BinPackBatch::k_no_bin);
+
+    // Every bin is valid and the spill list holds exactly
+    // the rectangles past the first bin
+    std::vector<std::vector<BinPackRectangle>> list_bin_rects(result.bin_count);
+    uint spilled=0;
+    for(uint i=0; i < list_rects.size(); i++) {
+        uint const bin = result.list_bins[i];
+        if(bin != 0) {
+            REQUIRE(result.list_spilled[spilled] == i);
+            spilled++;
+        }
+        if(bin != BinPackBatch::k_no_bin) {
+            REQUIRE(bin < result.bin_count);
+            list_bin_rects[bin].push_back(list_rects[i]);
+        }
+    }
+    REQUIRE(spilled == result.list_spilled.size());
+
+    for(auto const &bin_rects : list_bin_rects) {
+        REQUIRE_FALSE(bin_rects.empty());
+        REQUIRE(CheckPlacement(bin_rects,256,256,1));
+    }
+
+    // The first bin is at least as full as packing the
+    // rectangles online in their original order
+    u64 batch_area=0;
+    for(auto const &rect : list_bin_rects[0]) {
+        batch_area += rect.width*rect.height;
+    }
+
+    BinPackMaxRects online(256,256,1);
+    u64 online_area=0;
+    for(auto rect : list_original) {
+        if(online.AddRectangle(rect)) {
+            online_area += rect.width*rect.height;
+        }
+    }
+    REQUIRE(batch_area >= online_area);
+}
+
+TEST_CASE("BinPackBatch with padding","[binpack]")
+{
+    std::mt19937 rng(17);
+    std::uniform_int_distribution<uint> dist_size(1,40);
+    std::uniform_int_distribution<uint> dist_padding(1,3);
+
+    std::vector<BinPackRectangle> list_rects(1000);
+    for(auto &rect : list_rects) {
+        rect.width = dist_size(rng);
+        rect.height = dist_size(rng);
+        rect.padding = dist_padding(rng);
+    }
+
+    BinPackBatch batch(256,256,1);
+    auto const result = batch.Pack(list_rects);
+    REQUIRE(result.bin_count > 1);
+
+    // Whichever method won each bin, the padding
+    // around every rectangle is kept clear
+    std::vector<std::vector<BinPackRectangle>> list_bin_rects(result.bin_count);
+    for(uint i=0; i < list_rects.size(); i++) {
+        uint const bin = result.list_bins[i];
+        REQUIRE(bin < result.bin_count);
+        list_bin_rects[bin].push_back(list_rects[i]);
+    }
+
+    for(auto const &bin_rects : list_bin_rects) {
+        REQUIRE(CheckPlacement(bin_rects,256,256,1));
+    }
+}
+
+TEST_CASE("BinPackAtlas","[binpack]")
+{
+    SECTION("Pages are opened on demand")
+    {
+        std::mt19937 rng(5);
+        std::uniform_int_distribution<uint> dist_size(1,40);
+
+        std::uniform_int_distribution<uint> dist_padding(0,2);
+
+        BinPackAtlas atlas(128,128,1);
+        std::vector<std::vector<BinPackRectangle>> list_page_rects;
+
+        for(uint i=0; i < 1000; i++) {
+            BinPackRectangle rect;
+            rect.width = dist_size(rng);
+            rect.height = dist_size(rng);
+            rect.padding = dist_padding(rng);
+
+            uint const page_count = atlas.GetPageCount();
+            uint page;
+            REQUIRE(atlas.AddRectangle(rect,page));
+            REQUIRE(page <= page_count);
+            if(page == page_count) {
+                REQUIRE(atlas.GetPageCount() == page_count+1);
+                list_page_rects.emplace_back();
+            }
+            list_page_rects[page].push_back(rect);
+        }
+
+        REQUIRE(atlas.GetPageCount() > 1);
+        for(auto const &page_rects : list_page_rects) {
+            REQUIRE(CheckPlacement(page_rects,128,128,1));
+        }
+
+        // Later rectangles still go in earlier pages with room
+        BinPackRectangle rect;
+        rect.width = 1;
+        rect.height = 1;
+        uint page;
+        REQUIRE(atlas.AddRectangle(rect,page));
+        REQUIRE(page < atlas.GetPageCount()-1);
+    }
+
+    SECTION("Best fitting page")
+    {
+        BinPackAtlas atlas(64,64,0);
+        uint page;
+
+        // Leaves a 64x32 space in page 0
+        BinPackRectangle rect;
+        rect.width = 64;
+        rect.height = 32;
+        REQUIRE(atlas.AddRectangle(rect,page));
+        REQUIRE(page == 0);
+
+        // Doesn't fit in page 0, leaves 64x16 in page 1
+        rect.width = 64;
+        rect.height = 48;
+        REQUIRE(atlas.AddRectangle(rect,page));
+        REQUIRE(page == 1);
+
+        // Fits both pages but fits page 1 exactly
+        rect.width = 64;
+        rect.height = 16;
+        REQUIRE(atlas.AddRectangle(rect,page));
+        REQUIRE(page == 1);
+        REQUIRE(rect.y == 48);
+    }
+
+    SECTION("Limits")
+    {
+        BinPackAtlas atlas(64,64,0,2);
+        uint page;
+
+        BinPackRectangle rect;
+        rect.width = 65;
+        rect.height = 1;
+        REQUIRE_FALSE(atlas.AddRectangle(rect,page));
+        REQUIRE(atlas.GetPageCount() == 0);
+
+        rect.width = 64;
+        rect.height = 64;
+        REQUIRE(atlas.AddRectangle(rect,page));
+        REQUIRE(atlas.AddRectangle(rect,page));
+        REQUIRE_FALSE(atlas.AddRectangle(rect,page));
+        REQUIRE(atlas.GetPageCount() == 2);
+    }
+}
+
+TEST_CASE("BinPackDynamic","[binpack]")
+{
+    std::mt19937 rng(11);
+    std::uniform_int_distribution<uint> dist_size(1,40);
+
+    uint const k_size = 256;
+    uint const k_spacing = 1;
+
+    auto get_max_bottom = [](std::vector<BinPackRectangle> const &list_rects) {
+        uint max_bottom=0;
+        for(auto const &rect : list_rects) {
+            max_bottom = std::max(max_bottom,rect.y+rect.height+rect.padding);
+        }
+        return max_bottom;
+    };
+
+    BinPackDynamic bin(k_size,k_size,k_spacing);
+    std::vector<BinPackRectangle> list_rects;
+
+    SECTION("Removed space is reused")
+    {
+        for(uint round=0; round < 20; round++) {
+            // Fill up, then remove about half of the rectangles
+            for(uint i=0; i < 500; i++) {
+                BinPackRectangle rect;
+                rect.width = dist_size(rng);
+                rect.height = dist_size(rng);
+                if(bin.AddRectangle(rect)) {
+                    list_rects.push_back(rect);
+                }
+            }
+            REQUIRE(bin.GetRectangleCount() == list_rects.size());
+            REQUIRE(CheckPlacement(list_rects,k_size,k_size,k_spacing));
+
+            for(uint i=0; i < list_rects.size(); i++) {
+                if(rng() % 2) {
+                    REQUIRE(bin.RemoveRectangle(list_rects[i]));
+                    list_rects[i] = list_rects.back();
+                    list_rects.pop_back();
+                }
+            }
+            REQUIRE(bin.GetRectangleCount() == list_rects.size());
+        }
+
+        BinPackRectangle missing;
+        missing.x = k_size;
+        REQUIRE_FALSE(bin.RemoveRectangle(missing));
+
+        // Only the position matches
+        if(!list_rects.empty()) {
+            BinPackRectangle resized = list_rects.front();
+            resized.width++;
+            REQUIRE_FALSE(bin.RemoveRectangle(resized));
+            resized = list_rects.front();
+            resized.height++;
+            REQUIRE_FALSE(bin.RemoveRectangle(resized));
+            REQUIRE(bin.GetRectangleCount() == list_rects.size());
+        }
+
+        // Removing everything frees the whole bin
+        for(auto const &rect : list_rects) {
+            REQUIRE(bin.RemoveRectangle(rect));
+        }
+        REQUIRE(bin.GetFreeArea() == k_size*k_size);
+
+        BinPackRectangle rect;
+        rect.width = k_size-k_spacing;
+        rect.height = k_size-k_spacing;
+        REQUIRE(bin.AddRectangle(rect));
+    }
+
+    SECTION("Defragment")
+    {
+        std::uniform_int_distribution<uint> dist_padding(0,2);
+
+        for(uint i=0; i < 500; i++) {
+            BinPackRectangle rect;
+            rect.width = dist_size(rng);
+            rect.height = dist_size(rng);
+            rect.padding = dist_padding(rng);
+            if(bin.AddRectangle(rect)) {
+                list_rects.push_back(rect);
+            }
+        }
+        for(uint i=0; i < list_rects.size(); i++) {
+            if(rng() % 2) {
+                bin.RemoveRectangle(list_rects[i]);
+                list_rects[i] = list_rects.back();
+                list_rects.pop_back();
+            }
+        }
+
+        uint const max_bottom_before = get_max_bottom(list_rects);
+        u64 const free_area = bin.GetFreeArea();
+
+        // A few moves at a time until nothing moves
+        uint move_count=0;
+        while(true) {
+            auto const list_moves = bin.Defragment(8);
+            REQUIRE(list_moves.size() <= 8);
+            if(list_moves.empty()) {
+                break;
+            }
+            move_count += list_moves.size();
+
+            for(auto const &move : list_moves) {
+                auto it = std::find_if(
+                            list_rects.begin(),
+                            list_rects.end(),
+                            [&](BinPackRectangle const &rect) {
+                                return (rect.x == move.from.x &&
+                                        rect.y == move.from.y);
+                            });
+                REQUIRE(it != list_rects.end());
+                REQUIRE(move.to.width == it->width);
+                REQUIRE(move.to.height == it->height);
+                *it = move.to;
+            }
+            REQUIRE(CheckPlacement(list_rects,k_size,k_size,k_spacing));
+        }
+
+        REQUIRE(move_count > 0);
+        REQUIRE(bin.GetRectangleCount() == list_rects.size());
+        REQUIRE(bin.GetFreeArea() == free_area);
+        REQUIRE(get_max_bottom(list_rects) < max_bottom_before);
+
+        // The free space at the bottom can be used
+        BinPackRectangle rect;
+        rect.width = k_size-k_spacing;
+        rect.height = k_size-get_max_bottom(list_rects)-k_spacing;
+        REQUIRE(bin.AddRectangle(rect));
+    }
+}
@@ -0,0 +1,114 @@
+/*
+   Copyright (C) 2015 Preet Desai (preet.desai@gmail.com)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <catch/catch.hpp>
+#include <thread>
+#include <vector>
+#include <ks/KsLog.hpp>
+#include <ks/shared/KsBoundedMPMCQueue.hpp>
+
+TEST_CASE("BoundedMPMCQueue","[boundedmpmcqueue]")
+{
+    using namespace ks;
+
+    SECTION("Capacity")
+    {
+        BoundedMPMCQueue<uint> queue0(100);
+        REQUIRE(queue0.GetCapacity() == 128);
+
+        BoundedMPMCQueue<uint> queue1(64);
+        REQUIRE(queue1.GetCapacity() == 64);
+    }
+
+    SECTION("Push and Pop")
+    {
+        BoundedMPMCQueue<uint> queue(4);
+
+        uint value=0;
+        REQUIRE_FALSE(queue.TryPop(value));
+
+        for(uint i=0; i < 4; i++) {
+            value = i;
+            REQUIRE(queue.TryPush(value));
+        }
+        REQUIRE(queue.GetSizeApprox() == 4);
+
+        // full; value shouldn't be consumed
+        value = 4;
+        REQUIRE_FALSE(queue.TryPush(value));
+        REQUIRE(value == 4);
+
+        // FIFO order, wrapping around the ring
+        for(uint lap=0; lap < 3; lap++) {
+            for(uint i=0; i < 4; i++) {
+                REQUIRE(queue.TryPop(value));
+                REQUIRE(value == i);
+                REQUIRE(queue.TryPush(value));
+            }
+        }
+
+        for(uint i=0; i < 4; i++) {
+            REQUIRE(queue.TryPop(value));
+        }
+        REQUIRE_FALSE(queue.TryPop(value));
+        REQUIRE(queue.GetSizeApprox() == 0);
+    }
+
+    SECTION("Multiple producers and consumers")
+    {
+        uint const k_thread_count = 4;
+        uint const k_count_per_thread = 20000;
+
+        BoundedMPMCQueue<uint> queue(64);
+        std::atomic<uint> pop_count(0);
+        std::atomic<u64> pop_sum(0);
+
+        std::vector<std::thread> list_threads;
+        for(uint t=0; t < k_thread_count; t++) {
+            // producer
+            list_threads.emplace_back([&,t](){
+                for(uint i=0; i < k_count_per_thread; i++) {
+                    uint value = t*k_count_per_thread + i + 1;
+                    while(!queue.TryPush(value)) {
+                        std::this_thread::yield();
+                    }
+                }
+            });
+
+            // consumer
+            list_threads.emplace_back([&](){
+                uint value;
+                while(pop_count < k_thread_count*k_count_per_thread) {
+                    if(queue.TryPop(value)) {
+                        pop_sum += value;
+                        pop_count++;
+                    }
+                    else {
+                        std::this_thread::yield();
+                    }
+                }
+            });
+        }
+
+        for(auto &thread : list_threads) {
+            thread.join();
+        }
+
+        u64 const n = k_thread_count*k_count_per_thread;
+        REQUIRE(pop_count.load() == n);
+        REQUIRE(pop_sum.load() == (n*(n+1))/2);
+    }
+}
@@ -0,0 +1,353 @@
+/*
+   Copyright (C) 2015 Preet Desai (preet.desai@gmail.com)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <catch/catch.hpp>
+#include <fstream>
+#include <future>
+#include <string>
+#include <thread>
+#include <ks/KsLog.hpp>
+#include <ks/shared/KsCallbackTimer.hpp>
+
+namespace
+{
+    // Runs an EventLoop in its own thread for the lifetime
+    // of this object, so the thread is stopped and joined
+    // even when a failed assertion leaves the test early
+    class EventLoopThread
+    {
+    public:
+        EventLoopThread() :
+            m_evloop(ks::make_shared<ks::EventLoop>()),
+            m_thread(ks::EventLoop::LaunchInThread(m_evloop))
+        {}
+
+        ~EventLoopThread()
+        {
+            ks::EventLoop::RemoveFromThread(m_evloop,m_thread,true);
+        }
+
+        ks::shared_ptr<ks::EventLoop> const & Get() const
+        {
+            return m_evloop;
+        }
+
+    private:
+        ks::shared_ptr<ks::EventLoop> m_evloop;
+        std::thread m_thread;
+    };
+
+#if defined(__linux__)
+    // Number of threads in this process
+    ks::uint GetProcessThreadCount()
+    {
+        std::ifstream status("/proc/self/status");
+        std::string line;
+        while(std::getline(status,line)) {
+            if(line.compare(0,8,"Threads:") == 0) {
+                return std::stoul(line.substr(8));
+            }
+        }
+        return 0;
+    }
+#endif
+}
+
+TEST_CASE("CallbackTimer","[callbacktimer]")
+{
+    using namespace ks;
+    using Clock = std::chrono::steady_clock;
+
+    EventLoopThread evloop_thread;
+    shared_ptr<EventLoop> const evloop = evloop_thread.Get();
+
+    SECTION("Precise timers follow a fixed phase")
+    {
+        std::chrono::microseconds const k_interval(2500);
+        uint const k_tick_count = 40;
+
+        // Each tick's index counts the ticks that were missed
+        std::vector<std::pair<u64,Clock::time_point>> list_ticks;
+        Clock::time_point start;
+        std::promise<void> done;
+
+        shared_ptr<CallbackTimer> timer;
+        timer = MakeObject<CallbackTimer>(
+                    evloop,
+                    Milliseconds(0),
+                    [&](){
+                        u64 const index =
+                                list_ticks.size()+1+timer->GetMissedTicks();
+                        list_ticks.emplace_back(index,Clock::now());
+                        if(list_ticks.size() == k_tick_count) {
+                            timer->Stop();
+                            done.set_value();
+                        }
+                    });
+
+        evloop->PostCallback([&](){
+            timer->SetPreciseInterval(k_interval);
+            start = Clock::now();
+            timer->Start();
+        });
+        done.get_future().wait();
+
+        // Callbacks are never early and being late doesn't
+        // push later deadlines back
+        for(auto const &tick : list_ticks) {
+            bool const not_early = (tick.second >= start+k_interval*tick.first);
+            REQUIRE(not_early);
+        }
+
+        auto const &last = list_ticks.back();
+        bool const no_drift =
+                (last.second-(start+k_interval*last.first) < Milliseconds(10));
+        REQUIRE(no_drift);
+    }
+
+    SECTION("Single shot precise timers fire once")
+    {
+        std::atomic<uint> count(0);
+
+        auto timer = MakeObject<CallbackTimer>(
+                    evloop,Milliseconds(0),[&](){ count++; });
+
+        evloop->PostCallback([&](){
+            timer->SetPreciseInterval(std::chrono::microseconds(500));
+            timer->SetRepeating(false);
+            timer->Start();
+        });
+
+        std::this_thread::sleep_for(Milliseconds(20));
+        REQUIRE(count.load() == 1);
+    }
+
+    SECTION("Invalid intervals are rejected")
+    {
+        auto timer = MakeObject<CallbackTimer>(
+                    evloop,Milliseconds(0),[](){});
+
+        REQUIRE_THROWS_AS(timer->SetPreciseInterval(std::chrono::nanoseconds(0)),
+                          CallbackTimerInvalidInterval const&);
+        REQUIRE_THROWS_AS(timer->SetPreciseInterval(Milliseconds(-1)),
+                          CallbackTimerInvalidInterval const&);
+        REQUIRE_THROWS_AS(timer->SetInterval(Milliseconds(-1)),
+                          CallbackTimerInvalidInterval const&);
+        REQUIRE_NOTHROW(timer->SetInterval(Milliseconds(0)));
+        REQUIRE_NOTHROW(timer->SetPreciseInterval(std::chrono::nanoseconds(1)));
+    }
+
+    SECTION("Stopped precise timers don't fire")
+    {
+        std::atomic<uint> count(0);
+
+        auto timer = MakeObject<CallbackTimer>(
+                    evloop,Milliseconds(0),[&](){ count++; });
+
+        evloop->PostCallback([&](){
+            timer->SetPreciseInterval(std::chrono::microseconds(2000));
+            timer->Start();
+            timer->Stop();
+        });
+
+        std::this_thread::sleep_for(Milliseconds(20));
+        REQUIRE(count.load() == 0);
+    }
+
+#if defined(__linux__)
+    SECTION("The precise timer thread is joined with the last timer")
+    {
+        uint const thread_count = GetProcessThreadCount();
+
+        auto timer = MakeObject<CallbackTimer>(
+                    evloop,Milliseconds(0),[](){});
+
+        std::promise<void> started;
+        evloop->PostCallback([&](){
+            timer->SetPreciseInterval(Milliseconds(1));
+            timer->Start();
+            started.set_value();
+        });
+        started.get_future().wait();
+        REQUIRE(GetProcessThreadCount() == thread_count+1);
+
+        // A callback being posted on the event loop may briefly
+        // hold the last reference, so allow for that
+        timer.reset();
+        auto const timeout = Clock::now()+std::chrono::seconds(5);
+        while(GetProcessThreadCount() != thread_count &&
+              Clock::now() < timeout) {
+            std::this_thread::sleep_for(Milliseconds(1));
+        }
+        REQUIRE(GetProcessThreadCount() == thread_count);
+    }
+#endif
+
+    SECTION("Stats")
+    {
+        uint const k_tick_count = 10;
+        uint count=0;
+        std::promise<void> done;
+
+        // Callbacks take longer than the interval so every
+        // one of them overruns and ticks are missed
+        shared_ptr<CallbackTimer> timer;
+        timer = MakeObject<CallbackTimer>(
+                    evloop,
+                    Milliseconds(0),
+                    [&](){
+                        std::this_thread::sleep_for(Milliseconds(3));
+                        if(++count == k_tick_count) {
+                            timer->Stop();
+                            done.set_value();
+                        }
+                    });
+
+        evloop->PostCallback([&](){
+            timer->SetPreciseInterval(Milliseconds(2));
+            timer->Start();
+        });
+        done.get_future().wait();
+
+        // The last run is recorded after its callback returns,
+        // which can be after done is set
+        auto const timeout = Clock::now()+std::chrono::seconds(5);
+        while(timer->GetStats().run_count < k_tick_count &&
+              Clock::now() < timeout)
+        {
+            std::this_thread::sleep_for(Milliseconds(1));
+        }
+
+        CallbackTimerStats stats = timer->GetStats();
+        REQUIRE(stats.fire_count == k_tick_count);
+        REQUIRE(stats.run_count == k_tick_count);
+        REQUIRE(stats.overrun_count == k_tick_count);
+        REQUIRE(stats.missed_ticks > 0);
+        REQUIRE(stats.missed_ticks == timer->GetMissedTicks());
+        REQUIRE(stats.skipped_count == 0);
+        REQUIRE(stats.lateness.GetCount() == k_tick_count);
+        REQUIRE(stats.run_time.GetCount() == k_tick_count);
+        REQUIRE(stats.start_delay.GetCount() == 0);
+        REQUIRE(stats.max_run_time >= Milliseconds(3));
+
+        timer->ResetStats();
+        stats = timer->GetStats();
+        REQUIRE(stats.fire_count == 0);
+        REQUIRE(stats.run_time.GetCount() == 0);
+        REQUIRE(timer->GetMissedTicks() == 0);
+    }
+
+    SECTION("Callbacks dispatched to a ThreadPool")
+    {
+        ThreadPool thread_pool(4);
+
+        for(auto overlap : { CallbackTimer::Overlap::Skip,
+                             CallbackTimer::Overlap::Queue,
+                             CallbackTimer::Overlap::Concurrent })
+        {
+            std::atomic<uint> count(0);
+            std::atomic<uint> running(0);
+            std::atomic<uint> max_running(0);
+            std::atomic<bool> on_evloop_thread(false);
+            std::thread::id evloop_thread_id;
+
+            // Each callback takes longer than the interval
+            auto timer = MakeObject<CallbackTimer>(
+                        evloop,
+                        Milliseconds(0),
+                        [&](){
+                            uint const now_running = ++running;
+                            uint prev_max = max_running;
+                            while(now_running > prev_max &&
+                                  !max_running.compare_exchange_weak(
+                                      prev_max,now_running))
+                            {
+                                // retry
+                            }
+                            if(std::this_thread::get_id() == evloop_thread_id) {
+                                on_evloop_thread = true;
+                            }
+                            std::this_thread::sleep_for(Milliseconds(5));
+                            count++;
+                            running--;
+                        });
+
+            std::promise<void> started;
+            evloop->PostCallback([&](){
+                evloop_thread_id = std::this_thread::get_id();
+                timer->SetPreciseInterval(Milliseconds(1));
+                timer->SetThreadPool(&thread_pool,overlap);
+                timer->Start();
+                started.set_value();
+            });
+            started.get_future().wait();
+            std::this_thread::sleep_for(Milliseconds(40));
+
+            std::promise<uint> stopped;
+            evloop->PostCallback([&](){
+                timer->Stop();
+                stopped.set_value(count);
+            });
+            uint const count_at_stop = stopped.get_future().get();
+
+            // Wait for callbacks that are still queued or running
+            uint prev_count = count;
+            while(true) {
+                std::this_thread::sleep_for(Milliseconds(20));
+                if(count == prev_count && running == 0) {
+                    break;
+                }
+                prev_count = count;
+            }
+
+            // Runs are recorded after their callbacks return
+            auto const timeout = Clock::now()+std::chrono::seconds(5);
+            while(timer->GetStats().run_count < count.load() &&
+                  Clock::now() < timeout)
+            {
+                std::this_thread::sleep_for(Milliseconds(1));
+            }
+
+            REQUIRE_FALSE(on_evloop_thread.load());
+            REQUIRE(count.load() > 0);
+
+            CallbackTimerStats const stats = timer->GetStats();
+            REQUIRE(stats.run_count == count.load());
+            REQUIRE(stats.run_count == stats.overrun_count);
+            REQUIRE(stats.start_delay.GetCount() > 0);
+
+            if(overlap == CallbackTimer::Overlap::Skip) {
+                REQUIRE(max_running.load() == 1);
+                bool const skipped = (count.load() < 40);
+                REQUIRE(skipped);
+                REQUIRE(stats.skipped_count > 0);
+                REQUIRE(stats.fire_count == stats.run_count+stats.skipped_count);
+            }
+            else if(overlap == CallbackTimer::Overlap::Queue) {
+                // Queued invocations run after the timer is stopped
+                REQUIRE(max_running.load() == 1);
+                REQUIRE(count.load() > count_at_stop);
+                REQUIRE(stats.skipped_count == 0);
+                REQUIRE(stats.fire_count == stats.run_count);
+            }
+            else {
+                REQUIRE(max_running.load() > 1);
+                REQUIRE(stats.skipped_count == 0);
+                REQUIRE(stats.fire_count == stats.run_count);
+            }
+        }
+    }
+}
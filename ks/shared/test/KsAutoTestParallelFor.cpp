@@ -0,0 +1,116 @@
+/*
+   Copyright (C) 2015 Preet Desai (preet.desai@gmail.com)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <catch/catch.hpp>
+#include <ks/KsLog.hpp>
+#include <ks/shared/KsParallelFor.hpp>
+
+TEST_CASE("ParallelFor","[parallelfor]")
+{
+    using namespace ks;
+
+    ThreadPool thread_pool(4);
+
+    SECTION("Every index visited once")
+    {
+        uint const k_count = 100000;
+
+        for(uint grain : { 0u, 1u, 64u, k_count*2 })
+        {
+            std::vector<std::atomic<uint>> list_visits(k_count);
+            for(auto &visits : list_visits) {
+                visits = 0;
+            }
+
+            std::atomic<uint> max_range(0);
+
+            ParallelFor(thread_pool,0u,k_count,grain,
+                        [&](uint begin,uint end) {
+                            uint range = end-begin;
+                            uint prev = max_range;
+                            while(prev < range &&
+                                  !max_range.compare_exchange_weak(prev,range)) {}
+
+                            for(uint i=begin; i < end; i++) {
+                                list_visits[i]++;
+                            }
+                        });
+
+            bool ok = true;
+            for(auto &visits : list_visits) {
+                ok = ok && (visits == 1);
+            }
+            REQUIRE(ok);
+
+            if(grain > 0) {
+                REQUIRE(max_range.load() <= grain);
+            }
+        }
+    }
+
+    SECTION("Empty range")
+    {
+        uint calls=0;
+        ParallelFor(thread_pool,5,5,0,[&](int,int){ calls++; });
+        ParallelFor(thread_pool,5,2,0,[&](int,int){ calls++; });
+        REQUIRE(calls == 0);
+    }
+
+    SECTION("Nested")
+    {
+        std::atomic<uint> count(0);
+        ParallelFor(thread_pool,0,16,1,[&](int,int) {
+            ParallelFor(thread_pool,0,1000,0,[&](int begin,int end) {
+                count += (end-begin);
+            });
+        });
+        REQUIRE(count.load() == 16000);
+    }
+
+    SECTION("ParallelReduce")
+    {
+        u64 const sum =
+                ParallelReduce(thread_pool,u64(1),u64(100001),u64(0),u64(0),
+                               [](u64 begin,u64 end) {
+                                    u64 partial=0;
+                                    for(u64 i=begin; i < end; i++) {
+                                        partial += i;
+                                    }
+                                    return partial;
+                               },
+                               [](u64 a,u64 b) {
+                                    return a+b;
+                               });
+
+        REQUIRE(sum == u64(100000)*100001/2);
+
+        // order of partials is preserved
+        std::string const str =
+                ParallelReduce(thread_pool,0,26,1,std::string(),
+                               [](int begin,int end) {
+                                    std::string partial;
+                                    for(int i=begin; i < end; i++) {
+                                        partial.push_back('a'+i);
+                                    }
+                                    return partial;
+                               },
+                               [](std::string a,std::string b) {
+                                    return a+b;
+                               });
+
+        REQUIRE(str == "abcdefghijklmnopqrstuvwxyz");
+    }
+}
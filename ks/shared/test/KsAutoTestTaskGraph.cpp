@@ -0,0 +1,221 @@
+/*
+   Copyright (C) 2015 Preet Desai (preet.desai@gmail.com)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <catch/catch.hpp>
+#include <ks/KsLog.hpp>
+#include <ks/shared/KsTaskGraph.hpp>
+
+namespace
+{
+    // Records the order in which it was run
+    class OrderTask : public ks::ThreadPool::Task
+    {
+    public:
+        OrderTask(std::atomic<ks::uint> &counter) :
+            m_counter(counter),
+            m_order(0)
+        {}
+
+        void Cancel()
+        {
+            onCanceled();
+        }
+
+        ks::uint GetOrder() const
+        {
+            return m_order;
+        }
+
+    private:
+        void process()
+        {
+            onStarted();
+            m_order = ++m_counter;
+            onFinished();
+            onEnded();
+        }
+
+        std::atomic<ks::uint> &m_counter;
+        std::atomic<ks::uint> m_order;
+    };
+}
+
+TEST_CASE("TaskGraph","[taskgraph]")
+{
+    using namespace ks;
+
+    ThreadPool thread_pool(4);
+    std::atomic<uint> counter(0);
+
+    SECTION("Dependencies are respected")
+    {
+        // Layered DAG where every task depends on
+        // all tasks in the previous layer
+        uint const k_layer_count = 8;
+        uint const k_layer_size = 16;
+
+        TaskGraph task_graph;
+        std::vector<std::vector<shared_ptr<OrderTask>>> list_layers;
+
+        for(uint l=0; l < k_layer_count; l++) {
+            list_layers.emplace_back();
+            for(uint i=0; i < k_layer_size; i++) {
+                list_layers.back().push_back(make_shared<OrderTask>(counter));
+                uint index = task_graph.AddTask(list_layers.back().back());
+
+                if(l > 0) {
+                    for(uint j=0; j < k_layer_size; j++) {
+                        task_graph.AddDependency((l-1)*k_layer_size+j,index);
+                    }
+                }
+            }
+        }
+
+        for(uint run=0; run < 3; run++) {
+            counter = 0;
+            REQUIRE(task_graph.Run(thread_pool));
+            REQUIRE(task_graph.Wait() == TaskGraph::WaitStatus::Done);
+            REQUIRE(task_graph.IsFinished());
+            REQUIRE(counter.load() == k_layer_count*k_layer_size);
+
+            bool ok = true;
+            for(uint l=1; l < k_layer_count; l++) {
+                for(auto &prev : list_layers[l-1]) {
+                    for(auto &task : list_layers[l]) {
+                        ok = ok && (prev->GetOrder() < task->GetOrder());
+                    }
+                }
+            }
+            REQUIRE(ok);
+        }
+    }
+
+    SECTION("Run again right after finishing")
+    {
+        // Workers may still be ending the previous run's
+        // node tasks when the next run starts
+        TaskGraph task_graph;
+        uint const root = task_graph.AddTask(make_shared<OrderTask>(counter));
+        for(uint i=0; i < 8; i++) {
+            task_graph.AddDependency(
+                        root,task_graph.AddTask(make_shared<OrderTask>(counter)));
+        }
+
+        for(uint run=0; run < 1000; run++) {
+            counter = 0;
+            REQUIRE(task_graph.Run(thread_pool));
+            task_graph.Wait();
+            REQUIRE(counter.load() == 9);
+        }
+    }
+
+    SECTION("Rejected tasks")
+    {
+        // A thread pool that rejects tasks once its small
+        // queue is full; rejected tasks are run inline
+        ThreadPool::Options options;
+        options.queue_type = ThreadPool::QueueType::BoundedRing;
+        options.queue_capacity = 2;
+        options.overflow_policy = ThreadPool::OverflowPolicy::Reject;
+        ThreadPool reject_thread_pool(2,options);
+
+        // Wide fan out and fan in: a -> [64 tasks] -> b,
+        // with 16 independent roots alongside
+        TaskGraph task_graph;
+        std::vector<shared_ptr<OrderTask>> list_tasks;
+
+        list_tasks.push_back(make_shared<OrderTask>(counter));
+        uint const ia = task_graph.AddTask(list_tasks.back());
+        list_tasks.push_back(make_shared<OrderTask>(counter));
+        uint const ib = task_graph.AddTask(list_tasks.back());
+
+        for(uint i=0; i < 64; i++) {
+            list_tasks.push_back(make_shared<OrderTask>(counter));
+            uint const index = task_graph.AddTask(list_tasks.back());
+            task_graph.AddDependency(ia,index);
+            task_graph.AddDependency(index,ib);
+        }
+
+        for(uint i=0; i < 16; i++) {
+            list_tasks.push_back(make_shared<OrderTask>(counter));
+            task_graph.AddTask(list_tasks.back());
+        }
+
+        for(uint run=0; run < 3; run++) {
+            counter = 0;
+            REQUIRE(task_graph.Run(reject_thread_pool));
+            REQUIRE(task_graph.WaitFor(Milliseconds(5000)) == TaskGraph::WaitStatus::Done);
+            REQUIRE(counter.load() == list_tasks.size());
+
+            bool ok = true;
+            for(uint i=2; i < 66; i++) {
+                ok = ok &&
+                        (list_tasks[0]->GetOrder() < list_tasks[i]->GetOrder()) &&
+                        (list_tasks[i]->GetOrder() < list_tasks[1]->GetOrder());
+            }
+            REQUIRE(ok);
+        }
+    }
+
+    SECTION("From Graph")
+    {
+        // a -> b -> d
+        // a -> c -> d
+        Graph<shared_ptr<ThreadPool::Task>> graph;
+        auto a = make_shared<OrderTask>(counter);
+        auto b = make_shared<OrderTask>(counter);
+        auto c = make_shared<OrderTask>(counter);
+        auto d = make_shared<OrderTask>(counter);
+        auto e = make_shared<OrderTask>(counter);
+
+        auto ia = graph.AddNode(a);
+        auto ie = graph.AddNode(e);
+        auto ib = graph.AddNode(b);
+        auto ic = graph.AddNode(c);
+        auto id = graph.AddNode(d);
+        graph.AddEdge(ia,ib);
+        graph.AddEdge(ia,ic);
+        graph.AddEdge(ib,id);
+        graph.AddEdge(ic,id);
+        graph.AddEdge(ia,ie);
+        graph.RemoveNode(ie,false);
+
+        TaskGraph task_graph(graph);
+        REQUIRE(task_graph.GetTaskCount() == 4);
+
+        task_graph.Run(thread_pool);
+        task_graph.Wait();
+
+        REQUIRE(counter.load() == 4);
+        REQUIRE(a->GetOrder() == 1);
+        REQUIRE(d->GetOrder() == 4);
+        REQUIRE(e->GetOrder() == 0);
+    }
+
+    SECTION("Cycle")
+    {
+        TaskGraph task_graph;
+        auto i0 = task_graph.AddTask(make_shared<OrderTask>(counter));
+        auto i1 = task_graph.AddTask(make_shared<OrderTask>(counter));
+        auto i2 = task_graph.AddTask(make_shared<OrderTask>(counter));
+        task_graph.AddDependency(i0,i1);
+        task_graph.AddDependency(i1,i2);
+        task_graph.AddDependency(i2,i1);
+
+        REQUIRE_THROWS_AS(task_graph.Run(thread_pool),TaskGraphCycleDetected const&);
+        REQUIRE(task_graph.IsFinished());
+    }
+}
@@ -0,0 +1,924 @@
+/*
+   Copyright (C) 2015 Preet Desai (preet.desai@gmail.com)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <catch/catch.hpp>
+#include <array>
+#include <cstdint>
+#include <ks/KsLog.hpp>
+#include <ks/shared/KsThreadPool.hpp>
+
+namespace
+{
+    class CountTask : public ks::ThreadPool::Task
+    {
+    public:
+        CountTask(std::atomic<ks::uint> &count,
+                  std::vector<ks::uint>* list_order=nullptr,
+                  ks::uint id=0) :
+            m_count(count),
+            m_list_order(list_order),
+            m_id(id)
+        {}
+
+        void Cancel()
+        {
+            onCanceled();
+        }
+
+    private:
+        void process()
+        {
+            onStarted();
+            m_count++;
+            if(m_list_order) {
+                m_list_order->push_back(m_id);
+            }
+            onFinished();
+            onEnded();
+        }
+
+        std::atomic<ks::uint> &m_count;
+        std::vector<ks::uint>* m_list_order;
+        ks::uint m_id;
+    };
+
+    // Runs until it's canceled
+    class SpinUntilCanceledTask : public ks::ThreadPool::Task
+    {
+    public:
+        void Cancel()
+        {
+            onCanceled();
+        }
+
+    private:
+        void process()
+        {
+            onStarted();
+            while(!IsCanceled()) {
+                std::this_thread::yield();
+            }
+            onEnded();
+        }
+    };
+
+    std::vector<ks::ThreadPool::Options> GetOptionsList()
+    {
+        using namespace ks;
+
+        std::vector<ThreadPool::Options> list_options(6);
+        list_options[1].scheduling = ThreadPool::Scheduling::WorkStealing;
+
+        list_options[2].queue_type = ThreadPool::QueueType::BoundedRing;
+        list_options[2].queue_capacity = 16;
+        list_options[2].overflow_policy = ThreadPool::OverflowPolicy::Block;
+
+        list_options[3].queue_type = ThreadPool::QueueType::BoundedRing;
+        list_options[3].queue_capacity = 16;
+        list_options[3].overflow_policy = ThreadPool::OverflowPolicy::Grow;
+
+        list_options[4].scheduling = ThreadPool::Scheduling::Priority;
+
+        list_options[5].scheduling = ThreadPool::Scheduling::WorkStealing;
+        list_options[5].max_thread_count = 8;
+        list_options[5].idle_timeout = Milliseconds(10);
+        list_options[5].idle_spin_count = 1000;
+        list_options[5].affinity = ThreadPool::Affinity::NumaNode;
+        list_options[5].thread_name = "ks_test_worker";
+
+        return list_options;
+    }
+}
+
+TEST_CASE("ThreadPool","[threadpool]")
+{
+    using namespace ks;
+
+    SECTION("Run all tasks")
+    {
+        for(auto const &options : GetOptionsList())
+        {
+            ThreadPool thread_pool(4,options);
+            std::atomic<uint> count(0);
+            std::vector<shared_ptr<ThreadPool::Task>> list_tasks;
+
+            for(uint i=0; i < 1000; i++) {
+                list_tasks.push_back(make_shared<CountTask>(count));
+                if(i%2) {
+                    thread_pool.PushBack(list_tasks.back());
+                }
+                else {
+                    thread_pool.PushFront(list_tasks.back());
+                }
+            }
+
+            std::vector<shared_ptr<ThreadPool::Task>> list_batch;
+            for(uint i=0; i < 1000; i++) {
+                list_batch.push_back(make_shared<CountTask>(count));
+            }
+            list_tasks.insert(list_tasks.end(),list_batch.begin(),list_batch.end());
+            thread_pool.PushBack(std::move(list_batch));
+
+            for(auto &task : list_tasks) {
+                task->Wait();
+            }
+
+            REQUIRE(count.load() == 2000);
+            REQUIRE(thread_pool.GetTaskCount() == 0);
+        }
+    }
+
+    SECTION("Batch push")
+    {
+        for(auto const &options : GetOptionsList())
+        {
+            ThreadPool thread_pool(4,options);
+            std::atomic<uint> count(0);
+            std::vector<shared_ptr<ThreadPool::Task>> list_tasks;
+            std::vector<shared_ptr<ThreadPool::Task>> list_batch;
+
+            uint expected_count = 0;
+            for(uint batch_size : { 1u, 3u, 4u, 5u, 64u, 1000u })
+            {
+                for(uint i=0; i < batch_size; i++) {
+                    list_batch.push_back(make_shared<CountTask>(count));
+                }
+                list_tasks.insert(list_tasks.end(),list_batch.begin(),list_batch.end());
+
+                // The batch is moved out and the list's
+                // capacity is kept for the next batch
+                size_t const capacity = list_batch.capacity();
+                REQUIRE(thread_pool.PushBatch(list_batch) == batch_size);
+                REQUIRE(list_batch.empty());
+                REQUIRE(list_batch.capacity() == capacity);
+
+                expected_count += batch_size;
+            }
+
+            for(auto &task : list_tasks) {
+                task->Wait();
+            }
+
+            REQUIRE(count.load() == expected_count);
+            REQUIRE(thread_pool.GetTaskCount() == 0);
+        }
+    }
+
+    SECTION("PushFront and PushBack ordering")
+    {
+        for(auto options : GetOptionsList())
+        {
+            // No worker threads; tasks are only run
+            // by calling ProcessTask
+            options.max_thread_count = 0;
+            ThreadPool thread_pool(0,options);
+            std::atomic<uint> count(0);
+            std::vector<uint> list_order;
+
+            thread_pool.PushBack(make_shared<CountTask>(count,&list_order,1));
+            thread_pool.PushBack(make_shared<CountTask>(count,&list_order,2));
+            thread_pool.PushFront(make_shared<CountTask>(count,&list_order,0));
+            REQUIRE(thread_pool.GetTaskCount() == 3);
+
+            REQUIRE(thread_pool.ProcessTask() == 2);
+            REQUIRE(thread_pool.ProcessTask() == 1);
+            REQUIRE(thread_pool.ProcessTask() == 0);
+            REQUIRE(thread_pool.ProcessTask() == 0);
+
+            REQUIRE(list_order == std::vector<uint>({0,1,2}));
+        }
+    }
+
+    SECTION("Work stealing order")
+    {
+        ThreadPool::Options options;
+        options.scheduling = ThreadPool::Scheduling::WorkStealing;
+        ThreadPool thread_pool(1,options);
+        std::atomic<uint> count(0);
+        std::atomic<bool> pushed(false);
+        std::atomic<bool> release(false);
+        std::vector<uint> list_order;
+
+        std::vector<shared_ptr<ThreadPool::Task>> list_tasks;
+        for(uint i=0; i < 3; i++) {
+            list_tasks.push_back(make_shared<CountTask>(count,&list_order,i));
+        }
+
+        // The worker pushes to its own queue
+        thread_pool.Submit([&](){
+            for(auto &task : list_tasks) {
+                thread_pool.PushBack(task);
+            }
+            pushed = true;
+            while(!release) {
+                std::this_thread::yield();
+            }
+        });
+
+        while(!pushed) {
+            std::this_thread::yield();
+        }
+
+        // Other threads take the oldest task and the
+        // owner takes the rest newest first
+        REQUIRE(thread_pool.ProcessTask() == 2);
+        release = true;
+
+        for(auto &task : list_tasks) {
+            task->Wait();
+        }
+        REQUIRE(list_order == std::vector<uint>({0,2,1}));
+    }
+
+    SECTION("Stop and Resume")
+    {
+        for(auto const &options : GetOptionsList())
+        {
+            ThreadPool thread_pool(2,options);
+            thread_pool.Stop();
+
+            std::atomic<uint> count(0);
+            auto task = make_shared<CountTask>(count);
+            thread_pool.PushBack(task);
+
+            REQUIRE(task->WaitFor(Milliseconds(50)) ==
+                    ThreadPool::Task::WaitStatus::Timeout);
+
+            thread_pool.Resume();
+            task->Wait();
+            REQUIRE(count.load() == 1);
+        }
+    }
+
+    SECTION("Bounded queue overflow")
+    {
+        ThreadPool::Options options;
+        options.queue_type = ThreadPool::QueueType::BoundedRing;
+        options.queue_capacity = 4;
+        options.overflow_policy = ThreadPool::OverflowPolicy::Reject;
+
+        ThreadPool thread_pool(0,options);
+        std::atomic<uint> count(0);
+
+        for(uint i=0; i < 4; i++) {
+            REQUIRE(thread_pool.PushBack(make_shared<CountTask>(count)));
+        }
+        REQUIRE_FALSE(thread_pool.PushBack(make_shared<CountTask>(count)));
+        REQUIRE(thread_pool.GetTaskCount() == 4);
+
+        REQUIRE(thread_pool.ProcessTask() == 3);
+
+        std::vector<shared_ptr<ThreadPool::Task>> list_tasks;
+        for(uint i=0; i < 3; i++) {
+            list_tasks.push_back(make_shared<CountTask>(count));
+        }
+        REQUIRE(thread_pool.PushBack(list_tasks) == 1);
+        REQUIRE(thread_pool.GetTaskCount() == 4);
+
+        while(thread_pool.ProcessTask() > 0) {}
+        REQUIRE(count.load() == 5);
+    }
+
+    SECTION("Submit")
+    {
+        for(auto const &options : GetOptionsList())
+        {
+            ThreadPool thread_pool(4,options);
+            std::atomic<uint> count(0);
+            std::vector<shared_ptr<ThreadPool::Task>> list_tasks;
+
+            for(uint i=0; i < 1000; i++) {
+                list_tasks.push_back(
+                            thread_pool.Submit([&count](){ count++; }));
+            }
+
+            // callables that need larger task slots
+            std::array<u64,64> list_values;
+            list_values.fill(1);
+            list_tasks.push_back(
+                        thread_pool.Submit([&count,list_values](){
+                            count += list_values.back();
+                        }));
+
+            std::array<u64,100> list_more_values;
+            list_more_values.fill(1);
+            list_tasks.push_back(
+                        thread_pool.Submit([&count,list_more_values](){
+                            count += list_more_values.back();
+                        }));
+
+            // callable larger than any task slot
+            std::array<u64,512> list_many_values;
+            list_many_values.fill(1);
+            list_tasks.push_back(
+                        thread_pool.Submit([&count,list_many_values](){
+                            count += list_many_values.back();
+                        }));
+
+            // custom task types
+            for(uint i=0; i < 100; i++) {
+                auto task = ThreadPool::MakeTask<CountTask>(count);
+                REQUIRE(thread_pool.PushBack(task));
+                list_tasks.push_back(task);
+            }
+
+            uint expected_count = 1103;
+
+#if defined(__cpp_aligned_new)
+            // over-aligned captures aren't put in task slots
+            struct alignas(128) AlignedValue { u64 value; };
+            AlignedValue aligned_value{1};
+            auto aligned_task = thread_pool.Submit([&count,aligned_value](){
+                count += aligned_value.value;
+            });
+            bool const aligned =
+                    (reinterpret_cast<std::uintptr_t>(aligned_task.get()) % 128 == 0);
+            REQUIRE(aligned);
+            list_tasks.push_back(aligned_task);
+            expected_count++;
+#endif
+
+            for(auto &task : list_tasks) {
+                REQUIRE(task->Wait() == ThreadPool::Task::WaitStatus::Done);
+                REQUIRE(task->IsFinished());
+            }
+
+            REQUIRE(count.load() == expected_count);
+        }
+    }
+
+    SECTION("Delayed tasks")
+    {
+        for(auto const &options : GetOptionsList())
+        {
+            ThreadPool thread_pool(2,options);
+            std::mutex order_mutex;
+            std::vector<uint> list_order;
+
+            auto const start = ThreadPool::Clock::now();
+            std::vector<shared_ptr<ThreadPool::Task>> list_tasks;
+            for(uint i : { 3u, 1u, 2u }) {
+                list_tasks.push_back(
+                            thread_pool.SubmitAfter(
+                                Milliseconds(i*10),
+                                [&order_mutex,&list_order,i](){
+                                    std::lock_guard<std::mutex> lock(order_mutex);
+                                    list_order.push_back(i);
+                                }));
+            }
+
+            for(auto &task : list_tasks) {
+                REQUIRE(task->Wait() == ThreadPool::Task::WaitStatus::Done);
+            }
+
+            bool const delayed =
+                    (ThreadPool::Clock::now()-start >= Milliseconds(30));
+            REQUIRE(delayed);
+
+            // Tasks far enough apart are pushed in time order
+            REQUIRE(list_order == std::vector<uint>({1,2,3}));
+        }
+
+        // Waiting tasks are canceled and ended when
+        // the pool is destroyed
+        std::atomic<uint> count(0);
+        shared_ptr<ThreadPool::Task> task;
+        {
+            ThreadPool thread_pool(1);
+            task = thread_pool.SubmitAfter(Milliseconds(60000),
+                                           [&count](){ count++; });
+        }
+        REQUIRE(task->WaitFor(Milliseconds(5000)) == ThreadPool::Task::WaitStatus::Done);
+        REQUIRE(task->IsCanceled());
+        REQUIRE_FALSE(task->IsStarted());
+        REQUIRE(count.load() == 0);
+
+        // Tasks rejected by a full queue when their
+        // delay passes are canceled and ended
+        {
+            ThreadPool::Options options;
+            options.queue_type = ThreadPool::QueueType::BoundedRing;
+            options.queue_capacity = 1;
+            options.overflow_policy = ThreadPool::OverflowPolicy::Reject;
+            ThreadPool thread_pool(0,options);
+
+            // Fill the queue
+            uint queued_count=0;
+            while(thread_pool.Submit([&count](){ count++; }) != nullptr) {
+                queued_count++;
+            }
+
+            task = thread_pool.SubmitAfter(Milliseconds(1),
+                                           [&count](){ count++; });
+
+            REQUIRE(task->WaitFor(Milliseconds(5000)) == ThreadPool::Task::WaitStatus::Done);
+            REQUIRE(task->IsCanceled());
+
+            while(thread_pool.ProcessTask() > 0) {}
+            REQUIRE(count.load() == queued_count);
+        }
+    }
+
+    SECTION("Submit and cancel")
+    {
+        ThreadPool thread_pool(0);
+        std::atomic<uint> count(0);
+
+        auto task0 = thread_pool.Submit([&count](){ count++; });
+        auto task1 = thread_pool.Submit([&count](){ count++; });
+        task0->Cancel();
+
+        while(thread_pool.ProcessTask() > 0) {}
+        thread_pool.ProcessTask();
+
+        REQUIRE(task0->Wait() == ThreadPool::Task::WaitStatus::Done);
+        REQUIRE(task0->IsCanceled());
+        REQUIRE_FALSE(task0->IsFinished());
+        REQUIRE(task1->IsFinished());
+        REQUIRE(count.load() == 1);
+    }
+
+    SECTION("Priority lanes")
+    {
+        ThreadPool::Options options;
+        options.scheduling = ThreadPool::Scheduling::Priority;
+        options.lane_count = 3;
+        options.default_lane = 1;
+        options.aging_interval = Milliseconds(0);
+
+        ThreadPool thread_pool(0,options);
+        std::atomic<uint> count(0);
+        std::vector<uint> list_order;
+
+        auto const now = ThreadPool::Clock::now();
+
+        thread_pool.Push(make_shared<CountTask>(count,&list_order,7),2);
+        thread_pool.PushBack(make_shared<CountTask>(count,&list_order,5));
+        thread_pool.PushFront(make_shared<CountTask>(count,&list_order,4));
+        thread_pool.Push(make_shared<CountTask>(count,&list_order,3),1,
+                         now+Milliseconds(20));
+        thread_pool.Push(make_shared<CountTask>(count,&list_order,2),1,
+                         now+Milliseconds(10));
+        thread_pool.Push(make_shared<CountTask>(count,&list_order,0),0);
+        thread_pool.Push(make_shared<CountTask>(count,&list_order,1),0);
+        thread_pool.Push(make_shared<CountTask>(count,&list_order,6),1);
+
+        // out of range lanes use the lowest priority lane
+        thread_pool.Push(make_shared<CountTask>(count,&list_order,8),10);
+
+        REQUIRE(thread_pool.GetLaneCount() == 3);
+        REQUIRE(thread_pool.GetLaneTaskCount(0) == 2);
+        REQUIRE(thread_pool.GetLaneTaskCount(1) == 5);
+        REQUIRE(thread_pool.GetLaneTaskCount(2) == 2);
+        REQUIRE(thread_pool.GetLaneTaskCount(3) == 0);
+
+        while(thread_pool.ProcessTask() > 0) {}
+
+        REQUIRE(list_order == std::vector<uint>({0,1,2,3,4,5,6,7,8}));
+        REQUIRE(thread_pool.GetLaneTaskCount(1) == 0);
+    }
+
+    SECTION("Priority lane aging")
+    {
+        ThreadPool::Options options;
+        options.scheduling = ThreadPool::Scheduling::Priority;
+        options.lane_count = 3;
+        options.aging_interval = Milliseconds(1);
+
+        ThreadPool thread_pool(0,options);
+        std::atomic<uint> count(0);
+        std::vector<uint> list_order;
+
+        thread_pool.Push(make_shared<CountTask>(count,&list_order,1),2);
+        std::this_thread::sleep_for(Milliseconds(10));
+        thread_pool.Push(make_shared<CountTask>(count,&list_order,0),0);
+
+        // The low priority lane has waited for long
+        // enough to be taken first
+        while(thread_pool.ProcessTask() > 0) {}
+        REQUIRE(list_order == std::vector<uint>({1,0}));
+    }
+
+    SECTION("Cancel queued tasks")
+    {
+        for(auto options : GetOptionsList())
+        {
+            options.max_thread_count = 0;
+            ThreadPool thread_pool(0,options);
+            std::atomic<uint> count(0);
+            std::vector<shared_ptr<ThreadPool::Task>> list_tasks;
+
+            for(uint i=0; i < 8; i++) {
+                list_tasks.push_back(make_shared<CountTask>(count));
+                list_tasks.back()->SetTag((i%2) ? 1 : 2);
+                thread_pool.PushBack(list_tasks.back());
+            }
+            list_tasks.push_back(thread_pool.Submit(3,[&count](){ count++; }));
+            list_tasks.push_back(thread_pool.Submit([&count](){ count++; }));
+
+            REQUIRE(thread_pool.CancelTag(1) == 4);
+            REQUIRE(thread_pool.CancelTag(1) == 0);
+            REQUIRE(thread_pool.GetTaskCount() == 6);
+
+            REQUIRE(thread_pool.CancelIf([](ThreadPool::Task const &task) {
+                return (task.GetTag() == 3);
+            }) == 1);
+            REQUIRE(thread_pool.GetTaskCount() == 5);
+
+            // canceled tasks are ended right away
+            for(uint i=0; i < 8; i += 2) {
+                REQUIRE(list_tasks[i+1]->Wait() == ThreadPool::Task::WaitStatus::Done);
+                REQUIRE(list_tasks[i+1]->IsCanceled());
+                REQUIRE_FALSE(list_tasks[i+1]->IsStarted());
+            }
+
+            while(thread_pool.ProcessTask() > 0) {}
+            thread_pool.ProcessTask();
+
+            REQUIRE(count.load() == 5);
+            REQUIRE(thread_pool.GetTaskCount() == 0);
+            REQUIRE(list_tasks[8]->IsCanceled());
+            REQUIRE(list_tasks[9]->IsFinished());
+        }
+    }
+
+    SECTION("Push tagged tasks twice")
+    {
+        for(auto options : GetOptionsList())
+        {
+            options.max_thread_count = 0;
+            ThreadPool thread_pool(0,options);
+            std::atomic<uint> count(0);
+
+            auto task = make_shared<CountTask>(count);
+            task->SetTag(1);
+            auto other_task = make_shared<CountTask>(count);
+            other_task->SetTag(1);
+
+            // Pushing again before the task has ended is ignored
+            REQUIRE(thread_pool.PushBack(task));
+            REQUIRE(thread_pool.PushBack(other_task));
+            REQUIRE_FALSE(thread_pool.PushBack(task));
+            REQUIRE_FALSE(thread_pool.PushFront(task));
+            std::vector<shared_ptr<ThreadPool::Task>> list_batch{ task };
+            REQUIRE(thread_pool.PushBatch(list_batch) == 0);
+            REQUIRE(thread_pool.GetTaskCount() == 2);
+
+            thread_pool.ProcessTask();
+            REQUIRE(thread_pool.GetTaskCount() == 1);
+            REQUIRE(task->IsFinished());
+
+            // Once ended it can be pushed again
+            REQUIRE(thread_pool.PushBack(task));
+            REQUIRE(thread_pool.CancelTag(1) == 2);
+            REQUIRE(thread_pool.GetTaskCount() == 0);
+
+            while(thread_pool.ProcessTask() > 0) {}
+            thread_pool.ProcessTask();
+            REQUIRE(count.load() == 1);
+        }
+    }
+
+    SECTION("Cancel running task")
+    {
+        ThreadPool thread_pool(1);
+
+        auto task = make_shared<SpinUntilCanceledTask>();
+        task->SetTag(7);
+        thread_pool.PushBack(task);
+
+        while(!task->IsStarted()) {
+            std::this_thread::yield();
+        }
+
+        REQUIRE(thread_pool.CancelTag(7) == 1);
+        REQUIRE(task->Wait() == ThreadPool::Task::WaitStatus::Done);
+        REQUIRE(task->IsCanceled());
+        REQUIRE_FALSE(task->IsFinished());
+    }
+
+    SECTION("Cancel running callable")
+    {
+        ThreadPool thread_pool(1);
+        std::atomic<bool> started(false);
+        std::atomic<bool> stopped_early(false);
+
+        // Spins until canceled, or for much longer than
+        // the test waits if it never sees the cancel
+        auto task = thread_pool.Submit(
+                    9,[&](ThreadPool::Task const &this_task) {
+                        started = true;
+                        auto const timeout =
+                                std::chrono::steady_clock::now()+
+                                std::chrono::seconds(30);
+                        while(std::chrono::steady_clock::now() < timeout) {
+                            if(this_task.IsCanceled()) {
+                                stopped_early = true;
+                                return;
+                            }
+                            std::this_thread::yield();
+                        }
+                    });
+
+        while(!started) {
+            std::this_thread::yield();
+        }
+
+        REQUIRE(thread_pool.CancelTag(9) == 1);
+        REQUIRE(task->WaitFor(Milliseconds(5000)) == ThreadPool::Task::WaitStatus::Done);
+        REQUIRE(task->IsCanceled());
+        REQUIRE(stopped_early.load());
+    }
+
+    SECTION("Continuations")
+    {
+        for(auto const &options : GetOptionsList())
+        {
+            ThreadPool thread_pool(4,options);
+
+            // Then chain: each step sees the previous one's result
+            std::atomic<uint> value(0);
+            auto task = thread_pool.Submit([&value](){ value = 1; });
+            for(uint i=0; i < 100; i++) {
+                task = thread_pool.Then(task,[&value,i](){
+                    if(value == i+1) {
+                        value++;
+                    }
+                });
+            }
+            REQUIRE(task->Wait() == ThreadPool::Task::WaitStatus::Done);
+            REQUIRE(task->IsFinished());
+            REQUIRE(value.load() == 101);
+
+            // Then on a task that has already ended
+            bool ran = false;
+            auto task_after = thread_pool.Then(task,[&ran](){ ran = true; });
+            task_after->Wait();
+            REQUIRE(ran);
+
+            // WhenAll runs after every predecessor
+            std::atomic<uint> count(0);
+            std::vector<shared_ptr<ThreadPool::Task>> list_tasks;
+            for(uint i=0; i < 100; i++) {
+                list_tasks.push_back(
+                            thread_pool.Submit([&count](){ count++; }));
+            }
+
+            uint count_seen = 0;
+            auto task_all = thread_pool.WhenAll(list_tasks,[&](){
+                count_seen = count;
+            });
+            task_all->Wait();
+            REQUIRE(count_seen == 100);
+
+            // WhenAny runs exactly once
+            std::atomic<uint> any_count(0);
+            auto task_any = thread_pool.WhenAny(list_tasks,[&any_count](){
+                any_count++;
+            });
+            task_any->Wait();
+            REQUIRE(any_count.load() == 1);
+
+            // Empty lists are released right away
+            auto task_empty = thread_pool.WhenAll({},[](){});
+            REQUIRE(task_empty->Wait() == ThreadPool::Task::WaitStatus::Done);
+        }
+    }
+
+    SECTION("Continuations of canceled tasks")
+    {
+        ThreadPool thread_pool(1);
+
+        // Keep the only worker busy so the tasks stay queued
+        auto task_block = make_shared<SpinUntilCanceledTask>();
+        task_block->SetTag(1);
+        thread_pool.PushBack(task_block);
+
+        auto task = thread_pool.Submit(2,[](){});
+        bool canceled = false;
+        auto task_next = thread_pool.Then(task,[task,&canceled](){
+            canceled = task->IsCanceled();
+        });
+        auto task_any = thread_pool.WhenAny({task,task_block},[](){});
+
+        REQUIRE(thread_pool.CancelTag(2) == 1);
+        REQUIRE(thread_pool.CancelTag(1) == 1);
+
+        task_next->Wait();
+        task_any->Wait();
+        REQUIRE(canceled);
+        REQUIRE(task_next->IsFinished());
+        REQUIRE(task_any->IsFinished());
+    }
+
+    SECTION("Rejected continuations")
+    {
+        ThreadPool::Options options;
+        options.queue_type = ThreadPool::QueueType::BoundedRing;
+        options.queue_capacity = 1;
+        options.overflow_policy = ThreadPool::OverflowPolicy::Reject;
+        ThreadPool thread_pool(0,options);
+
+        std::atomic<uint> count(0);
+        uint queued_count=0;
+        while(thread_pool.Submit([&count](){ count++; }) != nullptr) {
+            queued_count++;
+        }
+
+        // The predecessor has already ended (a rejected Submit),
+        // so the continuation is pushed right away and rejected
+        auto task_next = thread_pool.Then(nullptr,[&count](){ count++; });
+        REQUIRE(task_next->WaitFor(Milliseconds(5000)) == ThreadPool::Task::WaitStatus::Done);
+        REQUIRE(task_next->IsCanceled());
+        REQUIRE_FALSE(task_next->IsStarted());
+
+        while(thread_pool.ProcessTask() > 0) {}
+        REQUIRE(count.load() == queued_count);
+    }
+
+    SECTION("Elastic thread count")
+    {
+        for(auto scheduling : { ThreadPool::Scheduling::SharedQueue,
+                                ThreadPool::Scheduling::WorkStealing })
+        {
+            ThreadPool::Options options;
+            options.scheduling = scheduling;
+            options.max_thread_count = 4;
+            options.idle_timeout = Milliseconds(20);
+            options.idle_spin_count = 100;
+
+            ThreadPool thread_pool(1,options);
+            REQUIRE(thread_pool.GetThreadCount() == 1);
+
+            // Blocked tasks back up the queue so threads are added
+            std::atomic<bool> release(false);
+            std::atomic<uint> count(0);
+            std::vector<shared_ptr<ThreadPool::Task>> list_tasks;
+            for(uint i=0; i < 8; i++) {
+                list_tasks.push_back(thread_pool.Submit([&](){
+                    while(!release) {
+                        std::this_thread::yield();
+                    }
+                    count++;
+                }));
+            }
+
+            auto timeout =
+                    std::chrono::steady_clock::now()+std::chrono::seconds(5);
+
+            while(thread_pool.GetThreadCount() < 4 &&
+                  std::chrono::steady_clock::now() < timeout) {
+                std::this_thread::yield();
+            }
+            REQUIRE(thread_pool.GetThreadCount() == 4);
+
+            release = true;
+            for(auto &task : list_tasks) {
+                task->Wait();
+            }
+            REQUIRE(count.load() == 8);
+
+            // Added threads exit once they've been idle
+            while(thread_pool.GetThreadCount() > 1 &&
+                  std::chrono::steady_clock::now() < timeout) {
+                std::this_thread::sleep_for(Milliseconds(5));
+            }
+            REQUIRE(thread_pool.GetThreadCount() == 1);
+
+            // and are added again when needed
+            timeout = std::chrono::steady_clock::now()+std::chrono::seconds(5);
+            release = false;
+            list_tasks.clear();
+            for(uint i=0; i < 8; i++) {
+                list_tasks.push_back(thread_pool.Submit([&](){
+                    while(!release) {
+                        std::this_thread::yield();
+                    }
+                    count++;
+                }));
+            }
+            while(thread_pool.GetThreadCount() < 2 &&
+                  std::chrono::steady_clock::now() < timeout) {
+                std::this_thread::yield();
+            }
+            REQUIRE(thread_pool.GetThreadCount() > 1);
+
+            release = true;
+            for(auto &task : list_tasks) {
+                task->Wait();
+            }
+            REQUIRE(count.load() == 16);
+        }
+    }
+
+    SECTION("Node placement")
+    {
+        for(auto affinity : { ThreadPool::Affinity::None,
+                              ThreadPool::Affinity::Cpu,
+                              ThreadPool::Affinity::NumaNode })
+        {
+            ThreadPool::Options options;
+            options.scheduling = ThreadPool::Scheduling::WorkStealing;
+            options.affinity = affinity;
+            options.thread_name = "ks_test_worker";
+
+            ThreadPool thread_pool(4,options);
+            uint const node_count = thread_pool.GetNodeCount();
+            REQUIRE(node_count >= 1);
+            if(affinity != ThreadPool::Affinity::NumaNode) {
+                REQUIRE(node_count == 1);
+            }
+            REQUIRE(thread_pool.GetCurrentNode() == 0);
+
+            std::atomic<uint> count(0);
+            std::atomic<bool> ok(true);
+            std::vector<shared_ptr<ThreadPool::Task>> list_tasks;
+            for(uint i=0; i < 100; i++) {
+                list_tasks.push_back(
+                            thread_pool.SubmitToNode(i,[&](){
+                                if(thread_pool.GetCurrentNode() >= node_count) {
+                                    ok = false;
+                                }
+                                count++;
+                            }));
+            }
+
+            for(auto &task : list_tasks) {
+                task->Wait();
+            }
+            REQUIRE(count.load() == 100);
+            REQUIRE(ok);
+        }
+    }
+
+    SECTION("Metrics")
+    {
+        using Histogram = ThreadPoolMetrics::Histogram;
+        REQUIRE(Histogram::GetBucket(std::chrono::nanoseconds(0)) == 0);
+        REQUIRE(Histogram::GetBucket(std::chrono::nanoseconds(999)) == 0);
+        REQUIRE(Histogram::GetBucket(std::chrono::microseconds(1)) == 1);
+        REQUIRE(Histogram::GetBucket(std::chrono::microseconds(3)) == 2);
+        REQUIRE(Histogram::GetBucket(std::chrono::hours(1)) ==
+                Histogram::k_bucket_count-1);
+
+        Histogram histogram;
+        histogram.list_counts[1] = 90;
+        histogram.list_counts[5] = 10;
+        REQUIRE(histogram.GetCount() == 100);
+        REQUIRE(histogram.GetPercentile(0.5).count() == 2);
+        REQUIRE(histogram.GetPercentile(0.99).count() == 32);
+
+        for(auto const &options : GetOptionsList())
+        {
+            ThreadPool thread_pool(2,options);
+            std::vector<shared_ptr<ThreadPool::Task>> list_tasks;
+            for(uint i=0; i < 200; i++) {
+                list_tasks.push_back(thread_pool.Submit([](){}));
+            }
+            for(auto &task : list_tasks) {
+                task->Wait();
+            }
+
+            // Wait is signalled before the run is recorded
+            thread_pool.Stop();
+
+            auto const metrics = thread_pool.GetMetrics();
+#if defined(KS_THREAD_POOL_NO_METRICS)
+            REQUIRE_FALSE(metrics.enabled);
+#else
+            REQUIRE(metrics.enabled);
+            REQUIRE(metrics.task_count == 200);
+            REQUIRE(metrics.queue_wait.GetCount() == 200);
+            REQUIRE(metrics.run_time.GetCount() == 200);
+            REQUIRE(metrics.tasks_per_second > 0);
+            REQUIRE(metrics.list_workers.size() ==
+                    std::max(options.max_thread_count,2u)+1);
+
+            u64 task_count=0;
+            for(auto const &worker : metrics.list_workers) {
+                task_count += worker.task_count;
+            }
+            REQUIRE(task_count == 200);
+            REQUIRE(metrics.GetUtilization() >= 0.0);
+            REQUIRE(metrics.GetUtilization() <= 1.0);
+
+            thread_pool.ResetMetrics();
+            REQUIRE(thread_pool.GetMetrics().task_count == 0);
+            REQUIRE(thread_pool.GetMetrics().queue_wait.GetCount() == 0);
+#endif
+        }
+    }
+}
@@ -0,0 +1,289 @@
+/*
+   Copyright (C) 2015 Preet Desai (preet.desai@gmail.com)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <catch/catch.hpp>
+#include <random>
+#include <ks/KsLog.hpp>
+#include <ks/shared/KsTimerWheel.hpp>
+
+// The wheel is advanced by hand in these tests so they
+// don't depend on the event loop's timing
+TEST_CASE("TimerWheel","[timerwheel]")
+{
+    using namespace ks;
+    using Clock = TimerWheel::Clock;
+
+    shared_ptr<EventLoop> evloop = make_shared<EventLoop>();
+    shared_ptr<TimerWheel> timer_wheel = MakeObject<TimerWheel>(evloop);
+
+    SECTION("Single shot timers fire once and never early")
+    {
+        uint count=0;
+        WheelTimer timer(timer_wheel,Milliseconds(50),[&](){ count++; });
+        timer.SetRepeating(false);
+
+        auto const before = Clock::now();
+        timer.Start();
+        auto const after = Clock::now();
+        REQUIRE(timer.GetActive());
+        REQUIRE(timer_wheel->GetActiveCount() == 1);
+
+        REQUIRE(timer_wheel->Advance(before+Milliseconds(49)) == 0);
+        REQUIRE(count == 0);
+
+        REQUIRE(timer_wheel->Advance(after+Milliseconds(51)) == 1);
+        REQUIRE(count == 1);
+        REQUIRE_FALSE(timer.GetActive());
+        REQUIRE(timer_wheel->GetActiveCount() == 0);
+
+        REQUIRE(timer_wheel->Advance(after+Milliseconds(500)) == 0);
+        REQUIRE(count == 1);
+    }
+
+    SECTION("Repeating timers")
+    {
+        uint count=0;
+        WheelTimer timer(timer_wheel,Milliseconds(10),[&](){ count++; });
+        timer.Start();
+        auto const after = Clock::now();
+
+        for(uint i=1; i <= 101; i++) {
+            timer_wheel->Advance(after+Milliseconds(i));
+        }
+        REQUIRE(count == 10);
+        REQUIRE(timer.GetActive());
+
+        // Missed intervals are skipped instead of fired in a burst
+        REQUIRE(timer_wheel->Advance(after+Milliseconds(1000)) == 1);
+        REQUIRE(count == 11);
+        REQUIRE(timer_wheel->Advance(after+Milliseconds(1011)) == 1);
+        REQUIRE(count == 12);
+
+        timer.Stop();
+        REQUIRE_FALSE(timer.GetActive());
+        REQUIRE(timer_wheel->Advance(after+Milliseconds(2000)) == 0);
+        REQUIRE(count == 12);
+
+        // Restarting uses the new interval; timers start from
+        // the wheel's time since it was advanced past now
+        timer.SetInterval(Milliseconds(100));
+        timer.Start();
+        auto const restart = after+Milliseconds(2000);
+        timer_wheel->Advance(restart+Milliseconds(99));
+        REQUIRE(count == 12);
+        timer_wheel->Advance(restart+Milliseconds(101));
+        REQUIRE(count == 13);
+    }
+
+    SECTION("Timers across every level of the wheel")
+    {
+        uint const k_timer_count = 5000;
+        std::mt19937 rng(1234);
+        std::uniform_int_distribution<uint> dist_interval(0,10*60*1000);
+
+        std::vector<Milliseconds> list_intervals;
+        std::vector<Clock::time_point> list_fired(k_timer_count);
+        std::vector<uint> list_counts(k_timer_count,0);
+        std::vector<unique_ptr<WheelTimer>> list_timers;
+
+        Clock::time_point step_time;
+
+        for(uint i=0; i < k_timer_count; i++) {
+            // Include a few deadlines past the top level
+            Milliseconds interval(dist_interval(rng));
+            if(i % 1000 == 0) {
+                interval = std::chrono::hours(6);
+            }
+            list_intervals.push_back(interval);
+            list_timers.emplace_back(
+                        new WheelTimer(
+                            timer_wheel,
+                            interval,
+                            [&,i](){
+                                list_counts[i]++;
+                                list_fired[i] = step_time;
+                            }));
+            list_timers.back()->SetRepeating(false);
+        }
+
+        auto const before = Clock::now();
+        for(auto &timer : list_timers) {
+            timer->Start();
+        }
+        auto const after = Clock::now();
+        REQUIRE(timer_wheel->GetActiveCount() == k_timer_count);
+
+        Milliseconds const k_step(997);
+        uint fired=0;
+        for(step_time = before;
+            step_time < after+std::chrono::hours(7);
+            step_time += k_step)
+        {
+            fired += timer_wheel->Advance(step_time);
+        }
+        REQUIRE(fired == k_timer_count);
+        REQUIRE(timer_wheel->GetActiveCount() == 0);
+
+        for(uint i=0; i < k_timer_count; i++) {
+            REQUIRE(list_counts[i] == 1);
+
+            // Fired on the first step at or after the deadline
+            bool const not_early =
+                    (list_fired[i] >= before+list_intervals[i]);
+            bool const not_late =
+                    (list_fired[i] < after+list_intervals[i]+k_step+Milliseconds(1));
+            REQUIRE(not_early);
+            REQUIRE(not_late);
+        }
+    }
+
+    SECTION("Coalesced deadlines")
+    {
+        // The most aligned point in the window is picked
+        REQUIRE(CoalesceDeadline(100,0) == 100);
+        REQUIRE(CoalesceDeadline(100,27) == 112);
+        REQUIRE(CoalesceDeadline(100,28) == 128);
+        REQUIRE(CoalesceDeadline(129,126) == 192);
+        REQUIRE(CoalesceDeadline(128,1000) == 1024);
+
+        for(u64 deadline=1000; deadline < 1200; deadline++) {
+            for(u64 slack : { 0u, 1u, 7u, 64u, 100u }) {
+                u64 const coalesced = CoalesceDeadline(deadline,slack);
+                bool const in_window =
+                        (coalesced >= deadline) &&
+                        (coalesced <= deadline+slack);
+                REQUIRE(in_window);
+            }
+        }
+    }
+
+    SECTION("Timers with slack share wakeups")
+    {
+        uint const k_timer_count = 100;
+        Milliseconds const k_slack(64);
+
+        std::vector<Clock::time_point> list_fired(k_timer_count);
+        std::vector<unique_ptr<WheelTimer>> list_timers;
+        Clock::time_point step_time;
+
+        for(uint i=0; i < k_timer_count; i++) {
+            list_timers.emplace_back(
+                        new WheelTimer(
+                            timer_wheel,
+                            Milliseconds(100+i),
+                            [&,i](){ list_fired[i] = step_time; }));
+            list_timers.back()->SetRepeating(false);
+            list_timers.back()->SetSlack(k_slack);
+        }
+
+        auto const before = Clock::now();
+        for(auto &timer : list_timers) {
+            timer->Start();
+        }
+        auto const after = Clock::now();
+
+        // Count the steps that fired anything
+        uint wakeups=0;
+        for(step_time = before;
+            step_time < after+Milliseconds(300);
+            step_time += Milliseconds(1))
+        {
+            if(timer_wheel->Advance(step_time) > 0) {
+                wakeups++;
+            }
+        }
+        REQUIRE(timer_wheel->GetActiveCount() == 0);
+
+        // Deadlines span 100ms so 64ms of slack needs at most
+        // three aligned ticks
+        REQUIRE(wakeups <= 3);
+
+        for(uint i=0; i < k_timer_count; i++) {
+            Milliseconds const interval(100+i);
+            bool const not_early = (list_fired[i] >= before+interval);
+            bool const within_slack =
+                    (list_fired[i] <= after+interval+k_slack+Milliseconds(1));
+            REQUIRE(not_early);
+            REQUIRE(within_slack);
+        }
+    }
+
+    SECTION("Repeating timers with slack keep their phase")
+    {
+        uint count=0;
+        WheelTimer timer(timer_wheel,Milliseconds(10),[&](){ count++; });
+        timer.SetSlack(Milliseconds(5));
+        timer.Start();
+        auto const after = Clock::now();
+
+        for(uint i=1; i <= 1000; i++) {
+            timer_wheel->Advance(after+Milliseconds(i));
+        }
+
+        // Slack delays each tick but doesn't add up over time
+        bool const count_ok = (count >= 99 && count <= 100);
+        REQUIRE(count_ok);
+    }
+
+    SECTION("Callbacks can start, stop and destroy timers")
+    {
+        uint count_a=0;
+        uint count_b=0;
+        uint count_c=0;
+
+        unique_ptr<WheelTimer> timer_a;
+        unique_ptr<WheelTimer> timer_b;
+        std::vector<unique_ptr<WheelTimer>> list_created;
+
+        // a destroys itself and stops b, which is due on the
+        // same tick, then adds timers that grow the entry list
+        timer_a.reset(new WheelTimer(timer_wheel,Milliseconds(10),[&](){
+            count_a++;
+            timer_a.reset();
+            timer_b->Stop();
+            for(uint i=0; i < 100; i++) {
+                list_created.emplace_back(
+                            new WheelTimer(timer_wheel,Milliseconds(5),
+                                           [&](){ count_c++; }));
+                list_created.back()->SetRepeating(false);
+                list_created.back()->Start();
+            }
+        }));
+        timer_b.reset(new WheelTimer(timer_wheel,Milliseconds(10),[&](){
+            count_b++;
+        }));
+
+        timer_a->Start();
+        timer_b->Start();
+        auto const after = Clock::now();
+
+        timer_wheel->Advance(after+Milliseconds(11));
+        REQUIRE(count_a == 1);
+        REQUIRE(count_b == 0);
+        REQUIRE(timer_a == nullptr);
+        REQUIRE_FALSE(timer_b->GetActive());
+        REQUIRE(timer_wheel->GetTimerCount() == 101);
+        REQUIRE(timer_wheel->GetActiveCount() == 100);
+
+        timer_wheel->Advance(after+Milliseconds(17));
+        REQUIRE(count_c == 100);
+        REQUIRE(timer_wheel->GetActiveCount() == 0);
+
+        list_created.clear();
+        timer_b.reset();
+        REQUIRE(timer_wheel->GetTimerCount() == 0);
+    }
+}
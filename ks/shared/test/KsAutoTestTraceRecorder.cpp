@@ -0,0 +1,242 @@
+/*
+   Copyright (C) 2015 Preet Desai (preet.desai@gmail.com)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <catch/catch.hpp>
+#include <string>
+#include <thread>
+#include <ks/KsLog.hpp>
+#include <ks/shared/KsTraceRecorder.hpp>
+#include <ks/shared/KsThreadPool.hpp>
+#include <ks/shared/KsDynamicProperty.hpp>
+
+namespace
+{
+    uint CountOccurrences(std::string const &str,std::string const &sub)
+    {
+        uint count=0;
+        for(size_t pos = str.find(sub);
+            pos != std::string::npos;
+            pos = str.find(sub,pos+sub.size()))
+        {
+            count++;
+        }
+        return count;
+    }
+
+#if !defined(KS_NO_TRACE)
+    // Returns the tid of the first event with the given name
+    // or of the thread_name metadata event for the given thread
+    std::string GetTid(std::string const &trace,std::string const &name)
+    {
+        size_t pos = trace.find("\"name\":\""+name+"\"");
+        if(pos == std::string::npos) {
+            return "";
+        }
+
+        // Metadata events have the tid before the thread name
+        std::string const tid_key = "\"tid\":";
+        pos = (trace.compare(pos-8,8,"\"args\":{") == 0) ?
+                    trace.rfind(tid_key,pos) : trace.find(tid_key,pos);
+
+        pos += tid_key.size();
+        return trace.substr(pos,trace.find_first_not_of("0123456789",pos)-pos);
+    }
+#endif
+}
+
+TEST_CASE("TraceRecorder","[trace]")
+{
+    using namespace ks;
+
+    TraceRecorder::Clear();
+
+    SECTION("Nothing is recorded while disabled")
+    {
+        TraceRecorder::SetEnabled(false);
+        {
+            KS_TRACE_SCOPE("disabled_scope","test");
+        }
+
+        REQUIRE(CountOccurrences(
+                    TraceRecorder::GetChromeTrace(),"disabled_scope") == 0);
+    }
+
+#if !defined(KS_NO_TRACE)
+    SECTION("Scopes record begin and end events")
+    {
+        TraceRecorder::SetEnabled(true);
+        TraceRecorder::SetThreadName("main");
+        {
+            KS_TRACE_SCOPE("outer_scope","test");
+            KS_TRACE_BEGIN("inner_scope","test");
+            KS_TRACE_END("inner_scope","test");
+        }
+        TraceRecorder::SetEnabled(false);
+
+        std::string const trace = TraceRecorder::GetChromeTrace();
+        REQUIRE(trace.find("{\"traceEvents\":[") == 0);
+        REQUIRE(CountOccurrences(trace,"\"name\":\"outer_scope\"") == 2);
+        REQUIRE(CountOccurrences(trace,"\"name\":\"inner_scope\"") == 2);
+        REQUIRE(CountOccurrences(trace,"\"ph\":\"B\"") == 2);
+        REQUIRE(CountOccurrences(trace,"\"ph\":\"E\"") == 2);
+        REQUIRE(CountOccurrences(trace,"\"args\":{\"name\":\"main\"}") == 1);
+
+        // Begin events come before their end events
+        REQUIRE(trace.find("\"name\":\"outer_scope\"") <
+                trace.find("\"name\":\"inner_scope\""));
+    }
+
+    SECTION("Pool tasks are recorded on worker threads")
+    {
+        TraceRecorder::SetEnabled(true);
+        {
+            ThreadPool::Options options;
+            options.thread_name = "trace_worker";
+            ThreadPool thread_pool(2,options);
+
+            using FunctionTask = ThreadPool::FunctionTask<std::function<void()>>;
+
+            std::vector<shared_ptr<ThreadPool::Task>> list_tasks;
+            for(uint i=0; i < 8; i++) {
+                auto task = make_shared<FunctionTask>([](){});
+                task->SetName("traced_task");
+                REQUIRE(thread_pool.PushBack(task));
+                list_tasks.push_back(task);
+            }
+            for(auto &task : list_tasks) {
+                task->Wait();
+            }
+        }
+        TraceRecorder::SetEnabled(false);
+
+        std::string const trace = TraceRecorder::GetChromeTrace();
+        REQUIRE(CountOccurrences(trace,"\"name\":\"traced_task\"") == 16);
+        REQUIRE(CountOccurrences(trace,"\"name\":\"trace_worker") > 0);
+    }
+
+    SECTION("DynamicProperty evaluations are recorded")
+    {
+        TraceRecorder::SetEnabled(true);
+        {
+            DynamicProperty<uint> a{"traced_a",1};
+            DynamicProperty<uint> b{"traced_b",[&](){ return a.Get()*2; }};
+            a.Assign(2);
+            REQUIRE(b.Get() == 4);
+        }
+        TraceRecorder::SetEnabled(false);
+
+        std::string const trace = TraceRecorder::GetChromeTrace();
+        REQUIRE(CountOccurrences(trace,"\"name\":\"traced_b\"") == 2);
+    }
+
+    SECTION("Full buffers keep the newest events")
+    {
+        uint const k_count = TraceRecorder::k_buffer_capacity;
+
+        TraceRecorder::SetEnabled(true);
+        for(uint i=0; i < k_count; i++) {
+            KS_TRACE_SCOPE("overflow_scope","test");
+        }
+        {
+            KS_TRACE_SCOPE("last_scope","test");
+        }
+        TraceRecorder::SetEnabled(false);
+
+        std::string const trace = TraceRecorder::GetChromeTrace();
+        REQUIRE(CountOccurrences(trace,"\"name\":\"overflow_scope\"") ==
+                k_count-2);
+        REQUIRE(CountOccurrences(trace,"\"name\":\"last_scope\"") == 2);
+    }
+
+    SECTION("Clear drops recorded events")
+    {
+        TraceRecorder::SetEnabled(true);
+        {
+            KS_TRACE_SCOPE("cleared_scope","test");
+        }
+        TraceRecorder::Clear();
+        {
+            KS_TRACE_SCOPE("kept_scope","test");
+        }
+        TraceRecorder::SetEnabled(false);
+
+        std::string const trace = TraceRecorder::GetChromeTrace();
+        REQUIRE(CountOccurrences(trace,"cleared_scope") == 0);
+        REQUIRE(CountOccurrences(trace,"kept_scope") == 2);
+    }
+
+    SECTION("Names are escaped and interned")
+    {
+        char const * name = TraceRecorder::Intern("quote\"slash\\tab\t");
+        REQUIRE(name == TraceRecorder::Intern(std::string(name)));
+
+        TraceRecorder::SetEnabled(true);
+        {
+            KS_TRACE_SCOPE(name,"test");
+        }
+        TraceRecorder::SetEnabled(false);
+
+        std::string const trace = TraceRecorder::GetChromeTrace();
+        REQUIRE(CountOccurrences(trace,"quote\\\"slash\\\\tab\\u0009") == 2);
+    }
+
+    SECTION("Interned names are capped")
+    {
+        char const * first = TraceRecorder::Intern("capped_name_first");
+
+        bool capped = false;
+        for(uint i=0; i <= TraceRecorder::k_max_interned_names && !capped; i++) {
+            std::string const name = "capped_name_"+std::to_string(i);
+            capped = (std::string(TraceRecorder::Intern(name)) != name);
+        }
+        REQUIRE(capped);
+
+        // Names interned before the cap are still found
+        REQUIRE(first == TraceRecorder::Intern("capped_name_first"));
+    }
+
+    SECTION("Reused buffers keep the thread of each event")
+    {
+        // Threads that run one after the other reuse the
+        // same buffer once the previous thread has exited
+        TraceRecorder::SetEnabled(true);
+        for(std::string const name : { "first", "second" }) {
+            std::thread thread([name]() {
+                TraceRecorder::SetThreadName(name+"_thread");
+                KS_TRACE_SCOPE(name == "first" ? "first_event" : "second_event","test");
+            });
+            thread.join();
+        }
+        TraceRecorder::SetEnabled(false);
+
+        std::string const trace = TraceRecorder::GetChromeTrace();
+        std::string const first_tid = GetTid(trace,"first_event");
+        std::string const second_tid = GetTid(trace,"second_event");
+        REQUIRE_FALSE(first_tid.empty());
+        REQUIRE(first_tid != second_tid);
+        REQUIRE(GetTid(trace,"first_thread") == first_tid);
+        REQUIRE(GetTid(trace,"second_thread") == second_tid);
+    }
+#else
+    SECTION("Tracing is compiled out")
+    {
+        TraceRecorder::SetEnabled(true);
+        REQUIRE_FALSE(TraceRecorder::IsEnabled());
+        REQUIRE(TraceRecorder::GetChromeTrace() ==
+                "{\"traceEvents\":[],\"displayTimeUnit\":\"ns\"}");
+    }
+#endif
+}
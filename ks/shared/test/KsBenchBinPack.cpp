@@ -0,0 +1,279 @@
+/*
+   Copyright (C) 2015 Preet Desai (preet.desai@gmail.com)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <catch/catch.hpp>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <ks/KsLog.hpp>
+#include <ks/shared/KsBinPackShelf.hpp>
+#include <ks/shared/KsBinPackBatch.hpp>
+#include <ks/shared/KsBinPackAtlas.hpp>
+#include <ks/shared/KsBinPackMaxRects.hpp>
+#include <ks/shared/KsBinPackSkyline.hpp>
+
+// Benchmarks are hidden ("[.]") and must be run explicitly:
+// ./test "[binpack_bench]"
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    // Glyph sizes for text rendered at pixel sizes between
+    // min_px and max_px: most glyphs are narrower than they
+    // are tall, with a few wide ones (W, M) and short ones
+    // (punctuation)
+    std::vector<ks::BinPackRectangle> MakeGlyphs(ks::uint count,
+                                                 ks::uint min_px,
+                                                 ks::uint max_px,
+                                                 ks::uint seed)
+    {
+        using namespace ks;
+
+        std::mt19937 rng(seed);
+        std::uniform_int_distribution<uint> dist_px(min_px,max_px);
+        std::normal_distribution<double> dist_aspect(0.6,0.15);
+        std::uniform_real_distribution<double> dist_height(0.5,1.0);
+        std::uniform_int_distribution<uint> dist_short(0,9);
+
+        std::vector<BinPackRectangle> list_glyphs(count);
+        for(auto &glyph : list_glyphs) {
+            double const px = dist_px(rng);
+            double height = px*dist_height(rng);
+            if(dist_short(rng) == 0) {
+                height *= 0.25;
+            }
+            double const width = px*std::max(0.2,std::min(1.2,dist_aspect(rng)));
+
+            glyph.width = std::max(1u,static_cast<uint>(width));
+            glyph.height = std::max(1u,static_cast<uint>(height));
+        }
+        return list_glyphs;
+    }
+
+    struct PackResult
+    {
+        ks::uint placed;
+        double occupancy;
+        double ns_per_rect;
+    };
+
+    template<typename BinPack>
+    PackResult Pack(std::vector<ks::BinPackRectangle> list_glyphs,
+                    ks::uint size,
+                    ks::uint spacing)
+    {
+        using namespace ks;
+
+        BinPack bin(size,size,spacing);
+        PackResult result{0,0,0};
+
+        u64 area=0;
+        auto const start = Clock::now();
+        for(auto &glyph : list_glyphs) {
+            if(bin.AddRectangle(glyph)) {
+                result.placed++;
+                area += glyph.width*glyph.height;
+            }
+        }
+        auto const end = Clock::now();
+
+        result.occupancy = 100.0*area/(u64(size)*size);
+        result.ns_per_rect =
+                std::chrono::duration<double,std::nano>(end-start).count()/
+                list_glyphs.size();
+
+        return result;
+    }
+
+    void LogResult(std::string const &name,PackResult const &result)
+    {
+        using namespace ks;
+
+        LOG.Info() << "  " << name
+                   << "  placed: " << result.placed
+                   << "  occupancy: " << result.occupancy << "%"
+                   << "  time: " << result.ns_per_rect << "ns/rect";
+    }
+
+    template<typename BinPack>
+    void LogOnlinePages(std::string const &name,
+                        std::vector<ks::BinPackRectangle> list_glyphs,
+                        ks::uint size,
+                        ks::uint spacing)
+    {
+        using namespace ks;
+
+        auto const start = Clock::now();
+        std::vector<BinPack> list_pages;
+        for(auto &glyph : list_glyphs) {
+            if(list_pages.empty() || !list_pages.back().AddRectangle(glyph)) {
+                list_pages.emplace_back(size,size,spacing);
+                list_pages.back().AddRectangle(glyph);
+            }
+        }
+        auto const end = Clock::now();
+
+        LOG.Info() << "  " << name
+                   << "  pages: " << list_pages.size()
+                   << "  time: " << std::chrono::duration<double,std::milli>(end-start).count() << "ms";
+    }
+}
+
+TEST_CASE("BinPack Benchmark","[.][binpack_bench]")
+{
+    using namespace ks;
+
+    struct Distribution
+    {
+        std::string name;
+        uint min_px;
+        uint max_px;
+    };
+
+    std::vector<Distribution> const list_distributions = {
+        { "UI text (12-16px)", 12, 16 },
+        { "Mixed text (12-48px)", 12, 48 },
+        { "Large glyphs (32-64px)", 32, 64 }
+    };
+
+    // Enough glyphs to overflow the atlas so occupancy is
+    // measured with the bin full
+    uint const k_size = 1024;
+    uint const k_spacing = 1;
+
+    for(auto const &dist : list_distributions) {
+        uint const glyph_count =
+                4*k_size*k_size/(dist.min_px*dist.min_px);
+
+        auto const list_glyphs =
+                MakeGlyphs(glyph_count,dist.min_px,dist.max_px,1234);
+
+        LOG.Info() << "BinPack Benchmark: " << dist.name << ", "
+                   << glyph_count << " glyphs into "
+                   << k_size << "x" << k_size;
+
+        LogResult("Shelf:   ",Pack<BinPackShelf>(list_glyphs,k_size,k_spacing));
+        LogResult("Skyline: ",Pack<BinPackSkyline>(list_glyphs,k_size,k_spacing));
+        LogResult("MaxRects:",Pack<BinPackMaxRects>(list_glyphs,k_size,k_spacing));
+    }
+
+    REQUIRE(true);
+}
+
+TEST_CASE("BinPackBatch Benchmark","[.][binpack_bench]")
+{
+    using namespace ks;
+
+    // A startup atlas build: every glyph of a few fonts is
+    // known up front and spread across as many pages as needed
+    uint const k_size = 512;
+    uint const k_spacing = 1;
+    auto list_glyphs = MakeGlyphs(4000,12,48,1234);
+
+    LOG.Info() << "BinPackBatch Benchmark: " << list_glyphs.size()
+               << " glyphs (12-48px) into " << k_size << "x" << k_size << " pages";
+
+    // Online: open a new page whenever one fills up,
+    // in arrival order
+    LogOnlinePages<BinPackShelf>("Online shelf:   ",list_glyphs,k_size,k_spacing);
+    LogOnlinePages<BinPackMaxRects>("Online maxrects:",list_glyphs,k_size,k_spacing);
+
+    {
+        auto list_atlas = list_glyphs;
+        BinPackAtlas atlas(k_size,k_size,k_spacing);
+        auto const start = Clock::now();
+        uint page;
+        for(auto &glyph : list_atlas) {
+            atlas.AddRectangle(glyph,page);
+        }
+        auto const end = Clock::now();
+
+        LOG.Info() << "  Online atlas:     pages: " << atlas.GetPageCount()
+                   << "  time: " << std::chrono::duration<double,std::milli>(end-start).count() << "ms";
+    }
+
+    {
+        auto list_batch = list_glyphs;
+        BinPackBatch batch(k_size,k_size,k_spacing);
+        auto const start = Clock::now();
+        auto const result = batch.Pack(list_batch);
+        auto const end = Clock::now();
+
+        LOG.Info() << "  Batch:            pages: " << result.bin_count
+                   << "  spilled past first page: " << result.list_spilled.size()
+                   << "  time: " << std::chrono::duration<double,std::milli>(end-start).count() << "ms";
+    }
+
+    REQUIRE(true);
+}
+
+TEST_CASE("BinPackShelf Rotation Benchmark","[.][binpack_bench]")
+{
+    using namespace ks;
+
+    // Mixed sprites: a mix of wide, tall and square images
+    std::mt19937 rng(1234);
+    std::uniform_int_distribution<uint> dist_side(8,128);
+    std::uniform_int_distribution<uint> dist_aspect(1,4);
+    std::uniform_int_distribution<uint> dist_shape(0,2);
+
+    std::vector<BinPackRectangle> list_sprites(2000);
+    for(auto &sprite : list_sprites) {
+        uint const side = dist_side(rng);
+        uint const other = std::max(1u,side/dist_aspect(rng));
+        uint const shape = dist_shape(rng);
+        sprite.width = (shape == 1) ? other : side;
+        sprite.height = (shape == 2) ? other : side;
+    }
+
+    uint const k_size = 1024;
+
+    LOG.Info() << "BinPackShelf Rotation Benchmark: "
+               << list_sprites.size() << " sprites (8-128px) into "
+               << k_size << "x" << k_size;
+
+    for(uint alignment : { 1u, 4u }) {
+        for(bool allow_rotation : { false, true }) {
+            auto list_rects = list_sprites;
+
+            BinPackShelf bin(k_size,k_size,1);
+            bin.SetAlignment(alignment);
+            bin.SetAllowRotation(allow_rotation);
+
+            uint placed=0;
+            uint rotated=0;
+            u64 area=0;
+            for(auto &rect : list_rects) {
+                if(bin.AddRectangle(rect)) {
+                    placed++;
+                    rotated += rect.rotated ? 1 : 0;
+                    area += rect.width*rect.height;
+                }
+            }
+
+            LOG.Info() << "  alignment: " << alignment
+                       << "  rotation: " << (allow_rotation ? "on " : "off")
+                       << "  placed: " << placed
+                       << "  rotated: " << rotated
+                       << "  occupancy: " << 100.0*area/(u64(k_size)*k_size) << "%";
+        }
+    }
+
+    REQUIRE(true);
+}
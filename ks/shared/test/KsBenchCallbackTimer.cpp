@@ -0,0 +1,149 @@
+/*
+   Copyright (C) 2015 Preet Desai (preet.desai@gmail.com)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <catch/catch.hpp>
+#include <algorithm>
+#include <future>
+#include <thread>
+#include <vector>
+#include <ks/KsLog.hpp>
+#include <ks/shared/KsCallbackTimer.hpp>
+
+// Benchmarks are hidden ("[.]") and must be run explicitly:
+// ./test "[timer_bench]"
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    struct JitterResult
+    {
+        std::vector<ks::s64> list_late_ns;
+        ks::u64 missed;
+        ks::s64 drift_ns;
+    };
+
+    // Runs a precise timer for tick_count ticks while load_count
+    // threads keep every other core busy
+    JitterResult RunJitter(std::chrono::nanoseconds interval,
+                           ks::uint tick_count,
+                           ks::uint load_count)
+    {
+        using namespace ks;
+
+        std::atomic<bool> loading(true);
+        std::vector<std::thread> list_load_threads;
+        for(uint i=0; i < load_count; i++) {
+            list_load_threads.emplace_back([&loading](){
+                while(loading.load(std::memory_order_relaxed)) {
+                    // spin
+                }
+            });
+        }
+
+        shared_ptr<EventLoop> evloop = make_shared<EventLoop>();
+        std::thread evloop_thread = EventLoop::LaunchInThread(evloop);
+
+        JitterResult result;
+        Clock::time_point start;
+        std::promise<void> done;
+
+        shared_ptr<CallbackTimer> timer;
+        timer = MakeObject<CallbackTimer>(
+                    evloop,
+                    Milliseconds(0),
+                    [&](){
+                        auto const now = Clock::now();
+
+                        // The index of this tick's deadline
+                        u64 const index = result.list_late_ns.size()+1+
+                                timer->GetMissedTicks();
+
+                        result.list_late_ns.push_back(
+                                    (now-(start+interval*index)).count());
+
+                        if(result.list_late_ns.size() == tick_count) {
+                            timer->Stop();
+                            result.missed = timer->GetMissedTicks();
+                            result.drift_ns = result.list_late_ns.back()-
+                                    result.list_late_ns.front();
+                            done.set_value();
+                        }
+                    });
+
+        evloop->PostCallback([&](){
+            timer->SetPreciseInterval(interval);
+            start = Clock::now();
+            timer->Start();
+        });
+        done.get_future().wait();
+
+        EventLoop::RemoveFromThread(evloop,evloop_thread,true);
+
+        loading = false;
+        for(auto &thread : list_load_threads) {
+            thread.join();
+        }
+
+        return result;
+    }
+
+    double GetPercentileUs(std::vector<ks::s64> list_samples,double percentile)
+    {
+        std::sort(list_samples.begin(),list_samples.end());
+        size_t const index = std::min(
+                    list_samples.size()-1,
+                    static_cast<size_t>(percentile*list_samples.size()));
+
+        return list_samples[index]/1000.0;
+    }
+}
+
+TEST_CASE("CallbackTimer Jitter Benchmark","[.][timer_bench]")
+{
+    using namespace ks;
+
+    uint const k_core_count =
+            std::max(1u,std::thread::hardware_concurrency());
+
+    for(auto interval : { std::chrono::nanoseconds(8333333), // 120Hz
+                          std::chrono::nanoseconds(1000000),
+                          std::chrono::nanoseconds(250000) })
+    {
+        // About half a second per run
+        uint const tick_count = static_cast<uint>(
+                    std::chrono::nanoseconds(std::chrono::milliseconds(500))/
+                    interval);
+
+        LOG.Info() << "CallbackTimer Jitter Benchmark: "
+                   << interval.count()/1000.0 << "us interval, "
+                   << tick_count << " ticks";
+
+        for(uint load_count : { 0u, k_core_count/2, k_core_count })
+        {
+            JitterResult const result = RunJitter(interval,tick_count,load_count);
+
+            LOG.Info() << "  busy threads: " << load_count
+                       << "  late p50: " << GetPercentileUs(result.list_late_ns,0.5) << "us"
+                       << "  p99: " << GetPercentileUs(result.list_late_ns,0.99) << "us"
+                       << "  max: " << GetPercentileUs(result.list_late_ns,1.0) << "us"
+                       << "  missed: " << result.missed
+                       << "  drift: " << result.drift_ns/1000.0 << "us";
+        }
+    }
+
+    REQUIRE(true);
+}
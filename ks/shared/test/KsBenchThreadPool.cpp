@@ -0,0 +1,468 @@
+/*
+   Copyright (C) 2015 Preet Desai (preet.desai@gmail.com)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <catch/catch.hpp>
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <ks/KsLog.hpp>
+#include <ks/shared/KsThreadPool.hpp>
+
+// Benchmarks are hidden ("[.]") and must be run explicitly:
+// ./test "[threadpool_bench]"
+
+// Counts heap allocations for the task allocation benchmark.
+// Replacing operator new affects every test linked with this
+// file, so it's only done when KS_BENCH_COUNT_HEAP_ALLOCS is
+// defined; build the benchmark as its own executable with it
+// defined to get allocation counts
+#if defined(KS_BENCH_COUNT_HEAP_ALLOCS)
+namespace
+{
+    std::atomic<ks::u64> g_heap_alloc_count(0);
+}
+
+void* operator new(size_t size)
+{
+    g_heap_alloc_count.fetch_add(1,std::memory_order_relaxed);
+    if(void* ptr = std::malloc(size ? size : 1)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr,size_t) noexcept
+{
+    std::free(ptr);
+}
+
+#if defined(__cpp_aligned_new)
+// Over-aligned types use these instead of the
+// operator new above
+void* operator new(size_t size,std::align_val_t align)
+{
+    g_heap_alloc_count.fetch_add(1,std::memory_order_relaxed);
+
+    // aligned_alloc needs a size that's a multiple of the alignment
+    size_t const alignment = size_t(align);
+    size_t const aligned_size = (std::max(size,size_t(1))+alignment-1)/alignment*alignment;
+    if(void* ptr = std::aligned_alloc(alignment,aligned_size)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr,std::align_val_t) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr,size_t,std::align_val_t) noexcept
+{
+    std::free(ptr);
+}
+#endif
+
+namespace
+{
+    bool const k_count_heap_allocs = true;
+    ks::u64 GetHeapAllocCount()
+    {
+        return g_heap_alloc_count;
+    }
+}
+#else
+namespace
+{
+    bool const k_count_heap_allocs = false;
+    ks::u64 GetHeapAllocCount()
+    {
+        return 0;
+    }
+}
+#endif
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    // Busy work that takes roughly work_us microseconds
+    void SpinFor(std::chrono::microseconds work_us)
+    {
+        auto const until = Clock::now() + work_us;
+        while(Clock::now() < until) {
+            // spin
+        }
+    }
+
+    // Each root task fans out into child tasks pushed
+    // from the worker thread it runs on
+    class FanOutTask : public ks::ThreadPool::Task
+    {
+    public:
+        FanOutTask(ks::ThreadPool* thread_pool,
+                   std::atomic<ks::uint>* remaining,
+                   ks::uint child_count,
+                   std::chrono::microseconds work_us) :
+            m_thread_pool(thread_pool),
+            m_remaining(remaining),
+            m_child_count(child_count),
+            m_work_us(work_us)
+        {}
+
+        void Cancel()
+        {
+            onCanceled();
+        }
+
+    private:
+        void process()
+        {
+            onStarted();
+            for(ks::uint i=0; i < m_child_count; i++) {
+                m_thread_pool->PushBack(
+                            ks::make_shared<FanOutTask>(
+                                m_thread_pool,m_remaining,0,m_work_us));
+            }
+            SpinFor(m_work_us);
+            (*m_remaining)--;
+            onFinished();
+            onEnded();
+        }
+
+        ks::ThreadPool* m_thread_pool;
+        std::atomic<ks::uint>* m_remaining;
+        ks::uint m_child_count;
+        std::chrono::microseconds m_work_us;
+    };
+
+    double RunFanOut(ks::uint thread_count,
+                     ks::ThreadPool::Scheduling scheduling,
+                     ks::uint root_count,
+                     ks::uint child_count,
+                     std::chrono::microseconds work_us)
+    {
+        ks::ThreadPool thread_pool(thread_count,scheduling);
+        std::atomic<ks::uint> remaining(root_count*(child_count+1));
+
+        auto const start = Clock::now();
+
+        for(ks::uint i=0; i < root_count; i++) {
+            thread_pool.PushBack(
+                        ks::make_shared<FanOutTask>(
+                            &thread_pool,&remaining,child_count,work_us));
+        }
+
+        while(remaining > 0) {
+            std::this_thread::yield();
+        }
+
+        std::chrono::duration<double,std::milli> const elapsed =
+                Clock::now()-start;
+
+        return elapsed.count();
+    }
+
+    class CountDownTask : public ks::ThreadPool::Task
+    {
+    public:
+        CountDownTask(std::atomic<ks::uint>* remaining) :
+            m_remaining(remaining)
+        {}
+
+        void Cancel()
+        {
+            onCanceled();
+        }
+
+    private:
+        void process()
+        {
+            onStarted();
+            (*m_remaining)--;
+            onFinished();
+            onEnded();
+        }
+
+        std::atomic<ks::uint>* m_remaining;
+    };
+
+    struct AllocResult
+    {
+        double tasks_per_second;
+        double allocs_per_second;
+        double allocs_per_task;
+    };
+
+    // Creates and pushes task_count tasks with make_task and
+    // measures the heap allocations made while they run. The
+    // pool uses a bounded ring so queueing doesn't allocate
+    template<typename MakeTaskFn>
+    AllocResult RunTaskAlloc(ks::uint task_count,MakeTaskFn make_task)
+    {
+        ks::ThreadPool::Options options;
+        options.queue_type = ks::ThreadPool::QueueType::BoundedRing;
+        options.queue_capacity = 1024;
+        options.overflow_policy = ks::ThreadPool::OverflowPolicy::Block;
+
+        ks::ThreadPool thread_pool(2,options);
+        std::atomic<ks::uint> remaining(task_count);
+
+        // Warm up the task slot free lists
+        std::atomic<ks::uint> warm_up(task_count/4);
+        for(ks::uint i=0; i < task_count/4; i++) {
+            make_task(thread_pool,&warm_up);
+        }
+        while(warm_up > 0) {
+            std::this_thread::yield();
+        }
+
+        ks::u64 const alloc_count_start = GetHeapAllocCount();
+        auto const start = Clock::now();
+
+        for(ks::uint i=0; i < task_count; i++) {
+            make_task(thread_pool,&remaining);
+        }
+        while(remaining > 0) {
+            std::this_thread::yield();
+        }
+
+        std::chrono::duration<double> const elapsed = Clock::now()-start;
+        double const alloc_count = GetHeapAllocCount()-alloc_count_start;
+
+        return AllocResult{
+            task_count/elapsed.count(),
+            alloc_count/elapsed.count(),
+            alloc_count/task_count
+        };
+    }
+
+    void LogTaskAlloc(std::string const &desc,AllocResult const &result)
+    {
+        if(!k_count_heap_allocs) {
+            ks::LOG.Info() << "  " << desc << ": "
+                           << ks::u64(result.tasks_per_second) << " tasks/s "
+                           << "(define KS_BENCH_COUNT_HEAP_ALLOCS to count allocs)";
+            return;
+        }
+
+        ks::LOG.Info() << "  " << desc << ": "
+                       << ks::u64(result.tasks_per_second) << " tasks/s, "
+                       << ks::u64(result.allocs_per_second) << " allocs/s, "
+                       << result.allocs_per_task << " allocs/task";
+    }
+
+    // Counts samples in power of two microsecond buckets:
+    // [0,1), [1,2), [2,4) ... [2^(N-2),inf)
+    class LatencyHistogram
+    {
+    public:
+        LatencyHistogram() :
+            m_list_counts(16,0)
+        {}
+
+        void Add(std::chrono::nanoseconds latency)
+        {
+            ks::uint bucket=0;
+            auto us = latency.count()/1000;
+            while(us > 0 && bucket+1 < m_list_counts.size()) {
+                us /= 2;
+                bucket++;
+            }
+            m_list_counts[bucket]++;
+            m_list_samples.push_back(latency.count());
+        }
+
+        double GetPercentileUs(double percentile)
+        {
+            std::sort(m_list_samples.begin(),m_list_samples.end());
+            size_t const index = std::min(
+                        m_list_samples.size()-1,
+                        static_cast<size_t>(percentile*m_list_samples.size()));
+
+            return m_list_samples[index]/1000.0;
+        }
+
+        void Log(std::string const &name)
+        {
+            ks::LOG.Info() << "  " << name
+                       << "  p50: " << GetPercentileUs(0.5) << "us"
+                       << "  p99: " << GetPercentileUs(0.99) << "us";
+
+            for(ks::uint i=0; i < m_list_counts.size(); i++) {
+                if(m_list_counts[i] == 0) {
+                    continue;
+                }
+                ks::uint const lower = (i == 0) ? 0 : (1u << (i-1));
+                ks::LOG.Info() << "    >= " << lower << "us: "
+                           << std::string(
+                                  (60*m_list_counts[i])/m_list_samples.size(),
+                                  '#')
+                           << " " << m_list_counts[i];
+            }
+        }
+
+    private:
+        std::vector<ks::uint> m_list_counts;
+        std::vector<ks::s64> m_list_samples;
+    };
+
+    // Submits one task at a time with a pause in between so the
+    // worker goes idle, and records the time from Submit to the
+    // task starting to run
+    void RunWakeLatency(ks::uint idle_spin_count,
+                        ks::uint sample_count,
+                        std::chrono::microseconds pause_us,
+                        LatencyHistogram &histogram)
+    {
+        ks::ThreadPool::Options options;
+        options.idle_spin_count = idle_spin_count;
+        ks::ThreadPool thread_pool(1,options);
+
+        for(ks::uint i=0; i < sample_count; i++) {
+            std::this_thread::sleep_for(pause_us);
+
+            Clock::time_point run_time;
+            auto const submit_time = Clock::now();
+            auto task = thread_pool.Submit([&run_time](){
+                run_time = Clock::now();
+            });
+            task->Wait();
+
+            histogram.Add(run_time-submit_time);
+        }
+    }
+}
+
+TEST_CASE("ThreadPool Benchmark","[.][threadpool_bench]")
+{
+    using namespace ks;
+
+    uint const k_root_count = 256;
+    uint const k_child_count = 64;
+
+    for(auto work_us : { std::chrono::microseconds(0),
+                         std::chrono::microseconds(10),
+                         std::chrono::microseconds(50) })
+    {
+        LOG.Info() << "ThreadPool Benchmark: "
+                   << k_root_count*(k_child_count+1) << " tasks, "
+                   << work_us.count() << "us per task";
+
+        for(uint thread_count=1; thread_count <= 64; thread_count *= 2)
+        {
+            double const shared_ms =
+                    RunFanOut(thread_count,
+                              ThreadPool::Scheduling::SharedQueue,
+                              k_root_count,k_child_count,work_us);
+
+            double const stealing_ms =
+                    RunFanOut(thread_count,
+                              ThreadPool::Scheduling::WorkStealing,
+                              k_root_count,k_child_count,work_us);
+
+            LOG.Info() << "  threads: " << thread_count
+                       << "  shared queue: " << shared_ms << "ms"
+                       << "  work stealing: " << stealing_ms << "ms";
+        }
+    }
+
+    REQUIRE(true);
+}
+
+TEST_CASE("ThreadPool Wake Latency Benchmark","[.][threadpool_bench]")
+{
+    using namespace ks;
+
+    uint const k_sample_count = 2000;
+
+    for(auto pause_us : { std::chrono::microseconds(20),
+                          std::chrono::microseconds(200) })
+    {
+        LOG.Info() << "ThreadPool Wake Latency Benchmark: "
+                   << k_sample_count << " tasks, "
+                   << pause_us.count() << "us between tasks";
+
+        LatencyHistogram park_histogram;
+        RunWakeLatency(0,k_sample_count,pause_us,park_histogram);
+        park_histogram.Log("park:");
+
+        LatencyHistogram spin_histogram;
+        RunWakeLatency(20000,k_sample_count,pause_us,spin_histogram);
+        spin_histogram.Log("spin then park:");
+    }
+
+    REQUIRE(true);
+}
+
+TEST_CASE("ThreadPool Task Allocation Benchmark","[.][threadpool_bench]")
+{
+    using namespace ks;
+
+    uint const k_task_count = 200000;
+
+    LOG.Info() << "ThreadPool Task Allocation Benchmark: "
+               << k_task_count << " tasks";
+
+    LogTaskAlloc(
+                "make_shared",
+                RunTaskAlloc(
+                    k_task_count,
+                    [](ThreadPool &thread_pool,std::atomic<uint>* remaining) {
+                        thread_pool.PushBack(
+                                    make_shared<CountDownTask>(remaining));
+                    }));
+
+    LogTaskAlloc(
+                "MakeTask",
+                RunTaskAlloc(
+                    k_task_count,
+                    [](ThreadPool &thread_pool,std::atomic<uint>* remaining) {
+                        thread_pool.PushBack(
+                                    ThreadPool::MakeTask<CountDownTask>(
+                                        remaining));
+                    }));
+
+    LogTaskAlloc(
+                "Submit",
+                RunTaskAlloc(
+                    k_task_count,
+                    [](ThreadPool &thread_pool,std::atomic<uint>* remaining) {
+                        thread_pool.Submit([remaining](){ (*remaining)--; });
+                    }));
+
+    // Too large for the smallest slot size class
+    LogTaskAlloc(
+                "Submit (256 byte capture)",
+                RunTaskAlloc(
+                    k_task_count,
+                    [](ThreadPool &thread_pool,std::atomic<uint>* remaining) {
+                        std::array<u8,256> data;
+                        data.fill(1);
+                        thread_pool.Submit([remaining,data](){
+                            (*remaining) -= data[0];
+                        });
+                    }));
+
+    REQUIRE(true);
+}
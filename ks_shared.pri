@@ -10,23 +10,53 @@ require_glm {
 
 include($${PATH_KS_SHARED}/thirdparty/lodepng/lodepng.pri)
 
+# Compiles out ThreadPool metrics bookkeeping
+ks_thread_pool_no_metrics {
+    DEFINES += KS_THREAD_POOL_NO_METRICS
+}
+
+# Compiles out KS_TRACE_* trace points
+ks_no_trace {
+    DEFINES += KS_NO_TRACE
+}
+
 HEADERS += \
     $${PATH_KS_SHARED}/KsProperty.hpp \
     $${PATH_KS_SHARED}/KsDeferredProperty.hpp \
     $${PATH_KS_SHARED}/KsDynamicProperty.hpp \
     $${PATH_KS_SHARED}/KsCallbackTimer.hpp \
+    $${PATH_KS_SHARED}/KsTimerWheel.hpp \
     $${PATH_KS_SHARED}/KsRecycleIndexList.hpp \
     $${PATH_KS_SHARED}/KsRangeAllocator.hpp \
     $${PATH_KS_SHARED}/KsGraph.hpp \
+    $${PATH_KS_SHARED}/KsBoundedMPMCQueue.hpp \
     $${PATH_KS_SHARED}/KsThreadPool.hpp \
+    $${PATH_KS_SHARED}/KsThreadPoolMetrics.hpp \
+    $${PATH_KS_SHARED}/KsParallelFor.hpp \
+    $${PATH_KS_SHARED}/KsTaskGraph.hpp \
+    $${PATH_KS_SHARED}/KsTraceRecorder.hpp \
+    $${PATH_KS_SHARED}/KsAsyncTask.hpp \
     $${PATH_KS_SHARED}/KsImageBase.hpp \
     $${PATH_KS_SHARED}/KsImagePNG.hpp \
     $${PATH_KS_SHARED}/KsImage.hpp \
-    $${PATH_KS_SHARED}/KsBinPackShelf.hpp
+    $${PATH_KS_SHARED}/KsBinPackShelf.hpp \
+    $${PATH_KS_SHARED}/KsBinPackMaxRects.hpp \
+    $${PATH_KS_SHARED}/KsBinPackSkyline.hpp \
+    $${PATH_KS_SHARED}/KsBinPackBatch.hpp \
+    $${PATH_KS_SHARED}/KsBinPackAtlas.hpp \
+    $${PATH_KS_SHARED}/KsBinPackDynamic.hpp
 
 
 SOURCES += \
     $${PATH_KS_SHARED}/KsDynamicProperty.cpp \
     $${PATH_KS_SHARED}/KsCallbackTimer.cpp \
+    $${PATH_KS_SHARED}/KsTimerWheel.cpp \
     $${PATH_KS_SHARED}/KsThreadPool.cpp \
-    $${PATH_KS_SHARED}/KsBinPackShelf.cpp
+    $${PATH_KS_SHARED}/KsTaskGraph.cpp \
+    $${PATH_KS_SHARED}/KsTraceRecorder.cpp \
+    $${PATH_KS_SHARED}/KsBinPackShelf.cpp \
+    $${PATH_KS_SHARED}/KsBinPackMaxRects.cpp \
+    $${PATH_KS_SHARED}/KsBinPackSkyline.cpp \
+    $${PATH_KS_SHARED}/KsBinPackBatch.cpp \
+    $${PATH_KS_SHARED}/KsBinPackAtlas.cpp \
+    $${PATH_KS_SHARED}/KsBinPackDynamic.cpp